@@ -0,0 +1,30 @@
+QT      -= gui
+CONFIG  += c++11 console
+CONFIG  -= app_bundle
+
+TARGET  = cass80-cli
+
+# Keep the intermediate files apart from the GUI target's
+OBJECTS_DIR = .obj-cli
+MOC_DIR = .moc-cli
+RCC_DIR = .rcc-cli
+MAKEFILE = Makefile.cli
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include($$PWD/cass80core.pri)
+
+SOURCES += \
+    $$PWD/src/cass80batch.cpp \
+    $$PWD/src/climain.cpp
+
+HEADERS += \
+    $$PWD/include/cass80batch.h
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/cass80/bin
+!isEmpty(target.path): INSTALLS += target
+
+RESOURCES += \
+    cass80.qrc
@@ -12,45 +12,20 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+include($$PWD/cass80core.pri)
+
 SOURCES += \
-    $$PWD/src/basictoken.cpp \
-    $$PWD/bdf/bdfcgenie.cpp \
-    $$PWD/bdf/bdfglyph.cpp \
     $$PWD/dialogs/aboutdlg.cpp \
     $$PWD/dialogs/casinfodlg.cpp \
     $$PWD/dialogs/preferencesdlg.cpp \
-    $$PWD/src/cass80handler.cpp \
     $$PWD/src/cass80main.cpp \
-    $$PWD/src/cass80xml.cpp \
-    $$PWD/src/main.cpp \
-    $$PWD/src/util.cpp \
-    $$PWD/z80/def2xml.cpp \
-    $$PWD/z80/z80dasm.cpp \
-    $$PWD/z80/z80def.cpp \
-    $$PWD/z80/z80defs.cpp \
-    $$PWD/z80/z80token.cpp \
-    bdf/bdfdata.cpp \
-    bdf/bdftrs80.cpp
+    $$PWD/src/main.cpp
 
 HEADERS += \
-    $$PWD/include/basictoken.h \
-    $$PWD/bdf/bdfcgenie.h \
-    $$PWD/bdf/bdfglyph.h \
     $$PWD/dialogs/aboutdlg.h \
     $$PWD/dialogs/casinfodlg.h \
     $$PWD/dialogs/preferencesdlg.h \
-    $$PWD/include/cass80handler.h \
-    $$PWD/include/cass80main.h \
-    $$PWD/include/cass80xml.h \
-    $$PWD/include/constants.h \
-    $$PWD/include/util.h \
-    $$PWD/z80/def2xml.h \
-    $$PWD/z80/z80dasm.h \
-    $$PWD/z80/z80def.h \
-    $$PWD/z80/z80defs.h \
-    $$PWD/z80/z80token.h \
-    bdf/bdfdata.h \
-    bdf/bdftrs80.h
+    $$PWD/include/cass80main.h
 
 FORMS += \
     $$PWD/dialogs/aboutdlg.ui \
@@ -59,17 +34,9 @@ FORMS += \
     cass80main.ui
     cass80main.ui \
 
-win32: LIBS += -lzlib
-unix: LIBS += -lz
-
 TRANSLATIONS += \
     cass80_de_DE.ts
 
-INCLUDEPATH += $$PWD/bdf
-INCLUDEPATH += $$PWD/dialogs
-INCLUDEPATH += $$PWD/z80
-INCLUDEPATH += $$PWD/include
-
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
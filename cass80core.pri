@@ -0,0 +1,71 @@
+# Sources shared by the cass80 GUI and the headless cass80-cli tool.
+# Nothing in here may depend on QtWidgets.
+
+QT      += core xml
+
+SOURCES += \
+    $$PWD/src/basictoken.cpp \
+    $$PWD/bdf/bdfcgenie.cpp \
+    $$PWD/bdf/bdfglyph.cpp \
+    $$PWD/src/cass80handler.cpp \
+    $$PWD/src/cass80tape.cpp \
+    $$PWD/src/cass80xml.cpp \
+    $$PWD/src/casbitalign.cpp \
+    $$PWD/src/cascache.cpp \
+    $$PWD/src/cascatalog.cpp \
+    $$PWD/src/casdigest.cpp \
+    $$PWD/src/casdiff.cpp \
+    $$PWD/src/casrecordfile.cpp \
+    $$PWD/src/casscanner.cpp \
+    $$PWD/src/cassimilar.cpp \
+    $$PWD/src/cassoftlist.cpp \
+    $$PWD/src/caswavdecoder.cpp \
+    $$PWD/src/caswavencoder.cpp \
+    $$PWD/src/caszip.cpp \
+    $$PWD/src/util.cpp \
+    $$PWD/z80/def2xml.cpp \
+    $$PWD/z80/z80dasm.cpp \
+    $$PWD/z80/z80def.cpp \
+    $$PWD/z80/z80defs.cpp \
+    $$PWD/z80/z80token.cpp \
+    $$PWD/z80/z80xref.cpp \
+    $$PWD/bdf/bdfdata.cpp \
+    $$PWD/bdf/bdftrs80.cpp
+
+HEADERS += \
+    $$PWD/include/basictoken.h \
+    $$PWD/bdf/bdfcgenie.h \
+    $$PWD/bdf/bdfglyph.h \
+    $$PWD/include/cass80handler.h \
+    $$PWD/include/cass80tape.h \
+    $$PWD/include/cass80xml.h \
+    $$PWD/include/casbitalign.h \
+    $$PWD/include/cascache.h \
+    $$PWD/include/cascatalog.h \
+    $$PWD/include/casdigest.h \
+    $$PWD/include/casdiff.h \
+    $$PWD/include/casrecordfile.h \
+    $$PWD/include/casscanner.h \
+    $$PWD/include/cassimilar.h \
+    $$PWD/include/cassoftlist.h \
+    $$PWD/include/caswavdecoder.h \
+    $$PWD/include/caswavencoder.h \
+    $$PWD/include/caszip.h \
+    $$PWD/include/constants.h \
+    $$PWD/include/util.h \
+    $$PWD/z80/def2xml.h \
+    $$PWD/z80/z80dasm.h \
+    $$PWD/z80/z80def.h \
+    $$PWD/z80/z80defs.h \
+    $$PWD/z80/z80token.h \
+    $$PWD/z80/z80xref.h \
+    $$PWD/bdf/bdfdata.h \
+    $$PWD/bdf/bdftrs80.h
+
+win32: LIBS += -lzlib
+unix: LIBS += -lz
+
+INCLUDEPATH += $$PWD/bdf
+INCLUDEPATH += $$PWD/dialogs
+INCLUDEPATH += $$PWD/z80
+INCLUDEPATH += $$PWD/include
@@ -82,4 +82,6 @@ void cass80InfoDlg::setup(Cass80Handler* cas)
     ui->le_format->setText(cas->basic() ? QLatin1String("BASIC") : QLatin1String("SYSTEM"));
     ui->le_digest->setText(QString::fromLatin1(cas->digest().toHex()));
     ui->le_crc32->setText(QString("%1").arg(cas->crc32(), 8, 16, QChar('0')));
+    ui->le_sha1->setText(QString::fromLatin1(cas->digests().sha1.toHex()));
+    ui->le_md5->setText(QString::fromLatin1(cas->digests().md5.toHex()));
 }
@@ -217,8 +217,9 @@ public:
     explicit BasicToken(bool esc_xml = false);
 
     const QString detokenize(const void* source, int maxsize);
+    QByteArray tokenize(const QString& text, bool cgenie = true) const;
+    static bool is_listing(const uchar* data, qint64 size);
 
 private:
-    QMap<int, QString> m_token;
     bool m_esc_xml;
 };
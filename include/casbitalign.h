@@ -0,0 +1,76 @@
+/****************************************************************************
+ *
+ * Cass80 tool - bit level realignment of cassette images
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QByteArray>
+#include "constants.h"
+
+/**
+ * @brief A sync byte found at some bit phase of a cassette image
+ */
+class CasBitSync
+{
+public:
+    CasBitSync()
+	: phase(-1), offs(-1), sync_byte(0), score(0)
+    {}
+
+    int phase;			//!< number of bits to skip in the byte at offs (0 to 7)
+    qint64 offs;		//!< offset of the byte with the first bit of the sync
+    quint8 sync_byte;		//!< CAS_TRS80_SYNC or CAS_CGENIE_SYNC
+    int score;			//!< 1 for a header, plus 1 for each valid block or matching line link
+};
+
+/**
+ * @brief Bit level search for the sync and header of misaligned images
+ *
+ * Raw dumps are sometimes shifted by a few bits, so the sync byte
+ * never shows up on a byte boundary. All 8 bit phases are searched in
+ * one pass: each 64 bit word is shifted by every phase and compared
+ * against the sync bytes, 8 bytes at a time. Candidates need the right
+ * byte in front of them and a valid header. SYSTEM images are scored
+ * by the number of blocks with valid checksums after it, BASIC images
+ * by the number of lines with matching links. Images which are aligned already
+ * skip the search.
+ */
+class CasBitAlign
+{
+public:
+    static CasBitSync find(const uchar* data, qint64 size);
+    static QByteArray realign(const uchar* data, qint64 size, const CasBitSync& sync);
+
+private:
+    static quint8 byte_at(const uchar* data, qint64 size, qint64 offs, int phase);
+    static int basic_lines(const uchar* data, qint64 size, qint64 offs, int phase);
+    static int score(const uchar* data, qint64 size, qint64 offs, int phase, quint8 sync);
+};
@@ -0,0 +1,87 @@
+/****************************************************************************
+ *
+ * Cass80 tool - persistent cache of decoded images
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QMutex>
+#include <QStringList>
+#include "casrecordfile.h"
+
+class Cass80Handler;
+
+/**
+ * @brief Persistent cache of decoded cassette images
+ *
+ * The cache file is a header followed by records which are only ever
+ * appended. Each record starts with a fixed size key: the hash of the
+ * canonical path, the size and modification time of the file, and its
+ * CRC32 and SHA1. The rest is the state of the Cass80Handler, and
+ * optionally the rendered listing with a caller defined variant, e.g.
+ * the disassembler options used for it.
+ *
+ * The file is memory mapped. Opening it walks only the record keys to
+ * build the index, and a lookup restores a handler from the mapped
+ * bytes without reading or decoding the image. A file whose size or
+ * modification time changed is a miss. Later records for the same
+ * path supersede earlier ones; flush() compacts the file once more
+ * than half of it is superseded.
+ *
+ * The file is a CasRecordFile, which several processes may share.
+ *
+ * lookup() and insert() may be called from several threads at once.
+ */
+class CasCache
+{
+public:
+    explicit CasCache(const QString& filename = QString());
+    ~CasCache();
+
+    static QString default_filename();
+
+    QString filename() const;
+    int count() const;
+
+    bool open(const QString& filename);
+    bool lookup(const QString& path, Cass80Handler* cas,
+		QStringList* listing = nullptr, const QByteArray& variant = QByteArray()) const;
+    void insert(const QString& path, const Cass80Handler* cas,
+		const QStringList& listing = QStringList(), const QByteArray& variant = QByteArray());
+    bool flush();
+    void close();
+
+private:
+    static quint64 path_key(const QString& path);
+
+    CasRecordFile m_records;
+    mutable QMutex m_mutex;
+};
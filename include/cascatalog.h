@@ -0,0 +1,125 @@
+/****************************************************************************
+ *
+ * Cass80 tool - deduplicating archive catalog
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QMultiHash>
+#include <QMutex>
+#include <QStringList>
+#include <QVector>
+#include "casrecordfile.h"
+
+class Cass80Handler;
+
+/**
+ * @brief Persistent content addressed catalog of cassette images
+ *
+ * Every image is indexed by the SHA1 of the file, the SHA1 of its
+ * payload, i.e. the decoded bytes without the lead-in, and the SHA1 of
+ * each of its blocks. The catalog answers where else an image, a
+ * program with another lead-in, or a single block occurs.
+ *
+ * The catalog file is a header followed by fixed layout records which
+ * are only ever appended, one per image. Opening it maps the file and
+ * walks the records to hash their digests to record offsets; nothing
+ * is parsed or copied, and each query is a hash lookup plus a compare
+ * of the mapped digests. Adding an image whose size, modification time
+ * and SHA1 did not change is a no-op, so an archive can be cataloged
+ * again after adding a few files. A changed image supersedes its old
+ * record; flush() compacts the file once more than half of it is
+ * superseded. The file is a CasRecordFile, which several processes
+ * may share.
+ *
+ * add() may be called from several threads at once.
+ */
+class CasCatalog
+{
+public:
+    /** @brief Kind of a match */
+    enum Match {
+	MATCH_FILE,		//!< byte identical image
+	MATCH_PAYLOAD,		//!< same decoded bytes, different lead-in
+	MATCH_BLOCK		//!< same block payload
+    };
+
+    /** @brief Another occurrence of an image or one of its blocks */
+    struct Hit {
+	QString path;		//!< path name of the other image
+	Match match;		//!< kind of the match
+	int block;		//!< index of the block asked for, or -1
+	int other;		//!< index of the block in the other image, or -1
+	quint16 addr;		//!< load address of the block in the other image
+    };
+
+    explicit CasCatalog(const QString& filename = QString());
+    ~CasCatalog();
+
+    QString filename() const;
+    int count() const;
+
+    bool open(const QString& filename);
+    bool add(const QString& path, const Cass80Handler* cas);
+    QVector<Hit> where(const QString& path) const;
+    QStringList files(const QByteArray& sha1) const;
+    QStringList payloads(const QByteArray& sha1) const;
+    QVector<Hit> blocks(const QByteArray& sha1) const;
+    bool flush();
+    void close();
+
+private:
+    /** @brief reference from a digest to a record and one of its blocks */
+    struct Ref {
+	qint64 offs;		//!< offset of the record
+	int block;		//!< index of the block, or -1 for the whole image
+	bool operator== (const Ref& other) const
+	{
+	    return offs == other.offs && block == other.block;
+	}
+    };
+
+    typedef QMultiHash<quint64, Ref> RefHash;
+
+    static QString canonical(const QString& path);
+    static quint64 path_key(const QString& path);
+    const uchar* record(qint64 offs) const;
+    QString name(qint64 offs) const;
+    void reindex();
+    void index(qint64 offs, bool insert);
+    QStringList matches(const RefHash& hash, const QByteArray& sha1, int digest) const;
+
+    CasRecordFile m_records;	//!< records by hash of the path
+    RefHash m_files;		//!< records by file SHA1
+    RefHash m_payloads;		//!< records by payload SHA1
+    RefHash m_blocks;		//!< blocks by SHA1
+    mutable QMutex m_mutex;
+};
@@ -0,0 +1,104 @@
+/****************************************************************************
+ *
+ * Cass80 tool - block level diff and patch
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QStringList>
+#include <QVector>
+#include "constants.h"
+
+class Cass80Handler;
+
+/**
+ * @brief Block level differences between two cassette images
+ *
+ * The blocks of a variant are aligned with those of a base image in
+ * three passes. First blocks with the same type and payload are paired,
+ * wherever they are. Then blocks of the same type loading to the same
+ * address and line. Last the remaining blocks are paired by content:
+ * the content defined windows of a rolling hash vote for the base block
+ * sharing most of them, which finds a block that was moved and patched.
+ * Blocks left over were added to or removed from the variant.
+ *
+ * Paired blocks with different payloads are reduced to edits, runs of
+ * bytes replaced in the base payload. The differences can be written
+ * as a compact patch, from which apply() rebuilds the variant given the
+ * base image. A variant can thus be kept as a delta against a canonical
+ * image instead of as a full copy.
+ */
+class CasDiff
+{
+public:
+    /** @brief How a block of the variant relates to the base */
+    enum Kind {
+	SAME,		//!< same block at the same position
+	MOVED,		//!< same payload, at another position or address
+	CHANGED,	//!< paired with a base block, the payload differs
+	ADDED,		//!< only in the variant
+	REMOVED		//!< only in the base
+    };
+
+    /** @brief Bytes replaced in the payload of a base block */
+    struct Edit {
+	int offs;		//!< offset in the base payload
+	QByteArray from;	//!< bytes of the base
+	QByteArray to;		//!< bytes of the variant
+    };
+
+    /** @brief One block of the variant, or a removed block of the base */
+    struct Entry {
+	Kind kind;		//!< how the blocks relate
+	int a;			//!< index of the base block, or -1 for ADDED
+	int b;			//!< index of the variant block, or -1 for REMOVED
+	QVector<Edit> edits;	//!< edits for CHANGED
+    };
+
+    CasDiff(const Cass80Handler* base, const Cass80Handler* variant);
+
+    const QVector<Entry>& entries() const;
+    int differences() const;
+    QStringList report() const;
+    QByteArray patch() const;
+
+    static bool is_patch(const QByteArray& data);
+    static bool apply(const Cass80Handler* base, const QByteArray& patch,
+		      Cass80Handler* result, QString* error = nullptr);
+
+private:
+    void align();
+    static QVector<Edit> edits(const QByteArray& from, const QByteArray& to);
+    static QString describe(const Cass80Block& block);
+    const Cass80Handler* m_base;
+    const Cass80Handler* m_variant;
+    QVector<Entry> m_entries;	//!< variant blocks in order, then removed base blocks
+};
@@ -0,0 +1,71 @@
+/****************************************************************************
+ *
+ * Cass80 tool - cassette image digests
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QVector>
+#include "constants.h"
+
+/**
+ * @brief All digests of a cassette image
+ *
+ * The file digests (CRC32, SHA1 and MD5) are computed in one pass over
+ * the image, feeding every chunk to all three while it is in the cache.
+ * The block digests are computed in one pass over the block payloads.
+ * The results are kept with the image, so that exporting XML or showing
+ * the info dialog does not need to hash anything again.
+ */
+class CasDigests
+{
+public:
+    CasDigests();
+
+    void clear();
+    bool has_blocks(int count) const;
+
+    void hash_file(const uchar* data, qint64 size);
+    void hash_blocks(const CasBlockList& blocks);
+
+    void store(QDataStream& stream) const;
+    bool restore(QDataStream& stream);
+
+    qint64 size;			//!< size of the file
+    quint32 crc32;			//!< CRC32 of the file
+    QByteArray sha1;			//!< SHA1 of the file
+    QByteArray md5;			//!< MD5 of the file
+    QByteArray payload;			//!< SHA1 of the decoded bytes of the image
+    QByteArray image;			//!< SHA1 of the concatenated block payloads
+    qint64 image_size;			//!< size of the concatenated block payloads
+    QVector<QByteArray> blocks;		//!< SHA1 of every block payload
+};
@@ -0,0 +1,109 @@
+/****************************************************************************
+ *
+ * Cass80 tool - memory mapped append-only record file
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+/**
+ * @brief Memory mapped file of records which are only ever appended
+ *
+ * The file is a header with a magic and a version, followed by the
+ * records. Each record starts with a 64 bit key and holds its length
+ * as a 32 bit value at a fixed offset. Later records for a key
+ * supersede earlier ones, and the index maps each key to its latest
+ * record.
+ *
+ * Opening the file maps it and walks only the record keys. Records
+ * appended are kept in memory until flush() writes them. A file with
+ * a different magic or version is started over, and a record which was
+ * cut short, e.g. by a crash, ends the file until flush() rewrites it.
+ *
+ * Several processes may share the file. flush() locks it, reads what
+ * the others appended or compacted, and appends at the real end of the
+ * file. The file is never truncated; compacting writes a new file and
+ * renames it, so the mappings of other processes stay valid. Since the
+ * records move, flush() builds the index anew.
+ *
+ * The class is not thread safe; its users lock around it.
+ */
+class CasRecordFile
+{
+public:
+    /** @brief location of a record */
+    struct Entry {
+	qint64 offs;		//!< offset of the record; past the mapped size it is pending
+	qint64 size;		//!< size of the record
+    };
+
+    CasRecordFile(const char* magic, quint32 version, int head, int length, int extra,
+		  const char* kind);
+    ~CasRecordFile();
+
+    QString filename() const;
+    int count() const;
+    const QHash<quint64, Entry>& index() const;
+
+    bool open(const QString& filename);
+    const uchar* data(qint64 offs) const;
+    QByteArray record(const Entry& entry) const;
+    qint64 append(const QByteArray& rec);
+    bool flush();
+    void close();
+
+private:
+    QByteArray header() const;
+    qint64 walk(const uchar* data, qint64 pos, qint64 end, qint64 base);
+    bool reload();
+    bool map(qint64 size);
+    void unmap();
+    bool compact();
+    void clear();
+
+    const QByteArray m_magic;	//!< 8 bytes magic of the header
+    const quint32 m_version;	//!< version of the header
+    const int m_head;		//!< minimum size of a record
+    const int m_length;		//!< offset of the quint32 length in a record
+    const int m_extra;		//!< bytes of a record not counted in its length
+    const char* m_kind;		//!< name of the file in messages, e.g. "cache"
+    QString m_filename;
+    QFile m_file;
+    QByteArray m_data;		//!< file contents if it cannot be mapped
+    uchar* m_map;
+    qint64 m_mapped;		//!< number of bytes in m_map up to the last complete record
+    qint64 m_live;		//!< number of bytes in records which are not superseded
+    QByteArray m_pending;	//!< records appended since the last flush()
+    QHash<quint64, Entry> m_index;	//!< latest record for each key
+};
@@ -0,0 +1,141 @@
+/****************************************************************************
+ *
+ * Cass80 tool - headless batch processing
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+#include "cassimilar.h"
+#include "cassoftlist.h"
+
+class bdfCgenie;
+class CasCache;
+class CasCatalog;
+class CasZip;
+class z80Dasm;
+class z80Defs;
+class Cass80Handler;
+
+class Cass80Batch
+{
+public:
+    enum Output {
+	OUT_NONE	= 0,
+	OUT_HASH	= (1u << 0),	//!< print CRC32 and SHA1 digests to stdout
+	OUT_LISTING	= (1u << 1),	//!< write BASIC source or Z80 disassembly (*.lst)
+	OUT_XML		= (1u << 2),	//!< write the cassette XML description (*.xml)
+	OUT_REPAIR	= (1u << 3),	//!< write a cleaned up cassette image (*.out)
+	OUT_WAV		= (1u << 4),	//!< write the image as audio (*.wav)
+	OUT_CSW		= (1u << 5),	//!< write the image as compressed square wave (*.csw)
+	OUT_SOFTLIST	= (1u << 6),	//!< write a MAME software list of all images
+	OUT_VERIFY	= (1u << 7),	//!< verify a MAME software list against the images
+	OUT_DUPLICATES	= (1u << 8),	//!< report where else in the catalog the images occur
+	OUT_SIMILAR	= (1u << 9),	//!< report clusters of near duplicate programs
+	OUT_DIFF	= (1u << 10),	//!< report the differences to the base image and write a patch (*.patch)
+	OUT_XREF	= (1u << 11)	//!< write the cross reference index of a SYSTEM program (*.xref)
+    };
+
+    /** @brief Result of processing one cassette image */
+    struct Result {
+	Result() : ok(false), has_rom(false) {}
+	QString path;		//!< path name of the input file
+	bool ok;		//!< true, if all requested outputs were produced
+	QStringList hashes;	//!< digest lines for OUT_HASH
+	QStringList errors;	//!< error messages for this file
+	bool has_rom;		//!< true, if rom is set for OUT_SOFTLIST or OUT_VERIFY
+	CasSoftlist::Rom rom;	//!< the image as a softlist rom
+	CasSimilar::Signature signature;	//!< MinHash signature for OUT_SIMILAR
+	QStringList diff;	//!< differences to the base image for OUT_DIFF
+    };
+
+    explicit Cass80Batch(quint32 outputs = OUT_HASH);
+    ~Cass80Batch();
+
+    quint32 outputs() const;
+    QString output_dir() const;
+    int jobs() const;
+    QStringList files() const;
+
+    void set_outputs(quint32 outputs);
+    void set_output_dir(const QString& output_dir);
+    void set_jobs(int jobs);
+    void set_uppercase(bool uppercase);
+    void set_split(bool split);
+    bool set_defs(const QString& filename);
+    bool set_cache(const QString& filename);
+    bool set_catalog(const QString& filename);
+    bool set_base(const QString& filename);
+    void set_softlist(const QString& filename, const QString& name);
+
+    int add_path(const QString& path);
+    int add_file_list(const QString& listname);
+
+    int run();
+    Result process(const QString& path) const;
+
+private:
+    void produce(Cass80Handler* cas, const QString& path, const QString& tag,
+		 const QStringList& listing, Result& res) const;
+    QStringList listing(Cass80Handler* cas) const;
+    QStringList xref(Cass80Handler* cas) const;
+    QByteArray analyze(Cass80Handler* cas, z80Dasm* dasm, quint16* pc_min, quint16* pc_max) const;
+    CasZip* open_zip(const QString& path);
+    int add_zip(const QString& path);
+    bool read_member(const QString& path, QByteArray& buffer, Result& res) const;
+    bool load_patch(const QString& path, Cass80Handler* cas, Result& res) const;
+    int softlist(const QVector<Result>& results) const;
+    void duplicates(const QVector<Result>& results) const;
+    void similar(const QVector<Result>& results) const;
+    QByteArray listing_variant() const;
+    void collisions(QVector<Result>& results) const;
+    QString output_path(const QString& path, const QString& tag, const QString& suffix) const;
+    bool writable(const QString& out, const QString& path, Result& res) const;
+    bool write_file(const QString& path, const QString& input, const QByteArray& data, Result& res) const;
+    quint32 m_outputs;
+    QString m_output_dir;
+    int m_jobs;
+    bool m_uppercase;
+    bool m_split;
+    QString m_softlist;
+    QString m_softlist_name;
+    QStringList m_files;
+    QByteArray m_rom;
+    QString m_defs_name;
+    z80Defs* m_defs;
+    bdfCgenie* m_bdf;
+    CasCache* m_cache;
+    CasCatalog* m_catalog;
+    QString m_base_name;
+    Cass80Handler* m_base;	//!< base image for OUT_DIFF and *.patch files
+    QHash<QString, CasZip*> m_zips;	//!< archives by path name, opened in add_path()
+};
@@ -33,11 +33,14 @@
  ****************************************************************************/
 #pragma once
 #include <QObject>
+#include <QDataStream>
 #include <QIODevice>
 #include <QCryptographicHash>
 #include "constants.h"
+#include "casdigest.h"
 
 class BasicToken;
+class CasXml;
 
 class Cass80Handler : public QObject
 {
@@ -45,9 +48,12 @@ class Cass80Handler : public QObject
 public:
 
     explicit Cass80Handler(QObject *parent = nullptr);
+    ~Cass80Handler();
 
     bool isEmpty() const;
     bool isValid() const;
+    bool complete() const;
+    qint64 consumed() const;
 
     Cass80Machine machine() const;
     bool basic() const;
@@ -61,20 +67,33 @@ public:
     quint16 blen() const;
     QByteArray digest() const;
     quint32 crc32() const;
+    const CasDigests& digests() const;
 
     bool load(const QString& filename);
     bool load(QIODevice* device);
+    bool load(const QByteArray& data);
+    bool load(const uchar* data, qint64 size);
 
     bool has_lmoffset();
     bool undo_lmoffset();
 
+    QByteArray payload() const;
     bool save(const QString& filename);
 
+    void set_data(const CasXml* xml);
+    bool set_source(const QStringList& source);
+    void store(QDataStream& stream) const;
+    bool restore(QDataStream& stream);
+
     int count() const;
-    CasBlockList blocks() const;
-    Cass80Block block(int index) const;
+    const CasBlockList& blocks() const;
+    const Cass80Block& block(int index) const;
 
     QStringList source() const;
+    QStringList source(int first, int count) const;
+    QVector<quint32> entries() const;
+    QByteArray memory(const QByteArray& rom = QByteArray(),
+		      quint16* pc_min = nullptr, quint16* pc_max = nullptr) const;
 
 public slots:
     bool set_blen(quint16 blen);
@@ -85,6 +104,9 @@ signals:
 
 private:
     void reset();
+    void set_arena(const QByteArray& arena);
+    QByteArray leadin() const;
+    void hash_image();
     BasicToken* m_bas;
     int m_verbose;
     Cass80Machine m_machine;
@@ -103,11 +125,14 @@ private:
     quint8 m_prefix;
     quint8 m_csum;
     bool m_basic;
+    bool m_complete;
+    qint64 m_consumed;		//!< bytes of the image up to the last byte decoded
 
     QCryptographicHash m_sha1;
-    quint32 m_crc32;
-    QByteArray m_digest;
-    QStringList m_source;
+    CasDigests m_digests;
+    mutable QStringList m_source;	//!< detokenized by source() on demand
+    mutable bool m_source_valid;
+    QByteArray m_arena;
     CasBlockList  m_blocks;
     qint64 m_total_size;
 };
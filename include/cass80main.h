@@ -40,6 +40,7 @@ namespace Ui { class Cass80Main; }
 QT_END_NAMESPACE
 
 class Cass80Handler;
+class CasCache;
 class bdfCgenie;
 class bdfTrs80;
 
@@ -81,5 +82,6 @@ private:
     qreal m_fontsize;
     bool m_internal_ttf;
     bool m_uppercase;
+    CasCache *m_cache;
     QString m_filepath;
 };
@@ -0,0 +1,86 @@
+/****************************************************************************
+ *
+ * Cass80 tool - tape images with multiple programs
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QObject>
+#include <QPair>
+#include <QVector>
+#include "constants.h"
+
+class Cass80Handler;
+
+class Cass80Tape : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Cass80Tape(QObject* parent = nullptr);
+    ~Cass80Tape();
+
+    bool isEmpty() const;
+    int count() const;
+    QList<Cass80Handler*> programs() const;
+    Cass80Handler* program(int index) const;
+    qint64 offset(int index) const;
+    qint64 size(int index) const;
+
+    int jobs() const;
+    qint64 min_leadin() const;
+
+    bool load(const QString& filename);
+    bool load(const QByteArray& data);
+    bool load(const uchar* data, qint64 size);
+
+    static QVector<qint64> boundaries(const uchar* data, qint64 size, qint64 min_leadin);
+
+public slots:
+    void set_jobs(int jobs);
+    void set_min_leadin(qint64 min_leadin);
+
+signals:
+    void Info(QString message);
+    void Error(QString message);
+
+private:
+    /** @brief messages of a handler; true for errors, false for infos */
+    typedef QVector<QPair<bool, QString>> Log;
+
+    void clear();
+    Cass80Handler* merge(const uchar* data, int index);
+    void decode(const uchar* data, int first, int last);
+    QVector<QMetaObject::Connection> collect(Cass80Handler* cas, Log* log) const;
+    void deliver(const Log& log);
+    int m_jobs;
+    qint64 m_min_leadin;
+    QList<Cass80Handler*> m_programs;
+    QVector<qint64> m_offsets;
+};
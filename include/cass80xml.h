@@ -33,13 +33,14 @@
  ****************************************************************************/
 #pragma once
 #include <QObject>
-#include <QDomDocument>
-#include <QDomElement>
-#include <QDomNode>
+#include <QIODevice>
+#include <QXmlStreamReader>
 
 #include "constants.h"
+#include "casdigest.h"
 
 class Cass80Handler;
+class CasXmlOutput;
 
 class CasXml : public QObject
 {
@@ -69,8 +70,13 @@ public:
     quint8 prefix() const;
     QString filename() const;
     CasBlockList blocks() const;
+    const CasDigests& digests() const;
+
+    static bool is_xml(const uchar* data, qint64 size);
 
     QString toXml() const;
+    bool write(QIODevice* device) const;
+    bool read(QIODevice* device);
 
 public slots:
     void set_data(const Cass80Handler* h);
@@ -86,6 +92,7 @@ public slots:
     void set_prefix(quint8 prefix);
     void set_filename(const QString& filename);
     void set_blocks(const CasBlockList& blocks);
+    void set_digests(const CasDigests& digests);
 
 signals:
     void sha1_digest_changed(const QByteArray& digest);
@@ -99,10 +106,13 @@ signals:
     void prefix_changed(quint8 prefix);
     void filename_changed(const QString& filename);
     void blocks_changed(CasBlockList& blocks);
+    void Info(QString message);
+    void Error(QString message);
 
 private:
-    QDomDocument cas_document() const;
-    QDomElement block_element(QDomDocument& doc, int index) const;
+    void write_block(CasXmlOutput& out, int index, const QByteArray& sha1) const;
+    bool read_block(QXmlStreamReader& xml, QByteArray& arena, CasBlockList& blocks,
+		    QVector<QByteArray>& sha1);
     QByteArray m_sha1_digest;
     Cass80Machine m_machine;
     bool m_basic;
@@ -114,4 +124,5 @@ private:
     quint8 m_prefix;
     QString m_filename;
     CasBlockList m_blocks;
+    CasDigests m_digests;
 };
@@ -0,0 +1,67 @@
+/****************************************************************************
+ *
+ * Cass80 tool - cassette lead-in and sync scanner
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QVector>
+#include "constants.h"
+
+/**
+ * @brief A lead-in followed by a sync byte found in a cassette image
+ *
+ * The lead-in is a (possibly empty) run of CAS_SILENCE and/or
+ * CAS_CGENIE_PRELUDE bytes in front of the sync byte.
+ */
+class CasLeadIn
+{
+public:
+    CasLeadIn()
+	: start(-1), sync(-1), sync_byte(CAS_SILENCE), fill(CAS_SILENCE)
+    {}
+
+    qint64 start;	//!< offset of the first lead-in byte (== sync for an empty lead-in)
+    qint64 sync;	//!< offset of the sync byte
+    quint8 sync_byte;	//!< CAS_TRS80_SYNC or CAS_CGENIE_SYNC
+    quint8 fill;	//!< CAS_SILENCE, or CAS_CGENIE_PRELUDE if the lead-in contains any
+
+    qint64 length() const { return sync - start; }
+};
+
+typedef QVector<CasLeadIn> CasLeadInList;
+
+class CasScanner
+{
+public:
+    static CasLeadInList scan(const uchar* data, qint64 size,
+			      qint64 min_run = 0, int max_count = -1);
+    static const char* isa();
+};
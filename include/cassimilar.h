@@ -0,0 +1,91 @@
+/****************************************************************************
+ *
+ * Cass80 tool - near duplicate detection
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+class Cass80Handler;
+
+/**
+ * @brief Index of MinHash signatures to find near duplicate programs
+ *
+ * Exact digests miss variants of a program, e.g. the same game with a
+ * cracked loader, a patched byte, or a block loaded elsewhere. This
+ * index compares what the programs contain instead: the bytes of the
+ * memory image loaded by the SYSTEM blocks, or the detokenized BASIC
+ * source without its line numbers.
+ *
+ * The contents are cut into overlapping shingles of 8 bytes, and the
+ * set of shingles is reduced to a signature of SIGNATURE minimum hash
+ * values. The fraction of equal values of two signatures estimates
+ * the Jaccard similarity of their shingle sets. The signatures are
+ * split into BANDS bands; images which agree in all rows of at least
+ * one band land in the same bucket, and only those candidates are
+ * compared. With 16 bands of 8 rows, pairs above a similarity of about
+ * 0.7 are found with high probability, while the work stays linear in
+ * the number of images.
+ */
+class CasSimilar
+{
+public:
+    enum {
+	SHINGLE		= 8,			//!< bytes per shingle
+	SIGNATURE	= 128,			//!< minimum hashes per signature
+	BANDS		= 16,			//!< LSH bands
+	ROWS		= SIGNATURE / BANDS	//!< minimum hashes per band
+    };
+
+    typedef QVector<quint32> Signature;
+
+    explicit CasSimilar(double threshold = 0.7);
+
+    static Signature signature(const Cass80Handler* cas);
+    static Signature signature(const QByteArray& data);
+    static double similarity(const Signature& a, const Signature& b);
+
+    int count() const;
+    QString name(int index) const;
+
+    int add(const QString& name, const Signature& sig);
+    QVector<QVector<int> > clusters() const;
+
+private:
+    static int find(QVector<int>& parent, int index);
+    double m_threshold;
+    QStringList m_names;
+    QVector<Signature> m_signatures;
+    QHash<quint64, QVector<int> > m_buckets;	//!< images by hash of band and its rows
+};
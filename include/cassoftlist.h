@@ -0,0 +1,84 @@
+/****************************************************************************
+ *
+ * Cass80 tool - MAME software list generator and verifier
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QHash>
+#include <QIODevice>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+#include "constants.h"
+
+class Cass80Handler;
+
+/**
+ * @brief MAME software list of the images in an archive
+ *
+ * Images are grouped by the SHA1 of their file, so every distinct
+ * image becomes one software entry however many copies there are.
+ * The list can be written as a MAME softlist XML, or an existing
+ * softlist can be verified against the archive with lookups by SHA1.
+ */
+class CasSoftlist
+{
+public:
+    /** @brief One image of the archive */
+    struct Rom {
+	Rom() : machine(MACH_INVALID), size(0), crc32(0) {}
+	QString path;		//!< path name of the image
+	QString description;	//!< description from the tape header or file name
+	QString publisher;	//!< author from the tape header, if any
+	Cass80Machine machine;	//!< machine the image is for
+	qint64 size;		//!< size of the file
+	quint32 crc32;		//!< CRC32 of the file
+	QByteArray sha1;	//!< SHA1 of the file
+    };
+
+    explicit CasSoftlist(const QString& name = QLatin1String("cgenie_cass"));
+
+    static Rom rom(const QString& path, const Cass80Handler* cas);
+
+    QString name() const;
+    int count() const;
+
+    void add(const Rom& rom);
+    bool write(QIODevice* device) const;
+    int verify(QIODevice* device, QStringList& report) const;
+
+private:
+    QString short_name(const Rom& rom, QSet<QString>& used) const;
+    QString m_name;
+    QVector<Rom> m_roms;			//!< distinct images in the order they were added
+    QVector<QStringList> m_duplicates;		//!< path names of the copies of each image
+    QHash<QByteArray, int> m_index;		//!< SHA1 to index into m_roms
+};
@@ -0,0 +1,143 @@
+/****************************************************************************
+ *
+ * Cass80 tool - cassette audio (WAV) decoder
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QObject>
+#include <QIODevice>
+#include <QVector>
+#include "constants.h"
+
+/**
+ * @brief Decoder for cassette recordings in RIFF WAVE files
+ *
+ * The PCM samples are read in chunks of fixed size, low-pass filtered
+ * and run through a Schmitt trigger whose levels follow the signal's
+ * DC offset and amplitude. The distances between rising edges are
+ * classified as short or long, which gives the bits for all supported
+ * encodings:
+ *
+ * TRS-80 500 baud: a clock pulse starts every bit cell, a 1 bit has a
+ * second pulse in the middle of the cell; 1 = short short, 0 = long.
+ *
+ * Colour Genie: a 1 bit is two cycles of the high frequency, a 0 bit
+ * one cycle of the low frequency; 1 = short short, 0 = long.
+ *
+ * TRS-80 1500 baud: one cycle per bit; 1 = short, 0 = long.
+ *
+ * The decoded bytes of each program are prefixed with the canonical
+ * lead-in and sync of its machine, so the result is a .cas image for
+ * the decoder_status_e state machine of Cass80Handler. Memory use is
+ * bounded by the chunk size and the size of the decoded programs.
+ */
+class CasWavDecoder : public QObject
+{
+    Q_OBJECT
+public:
+    enum Encoding {
+	ENC_NONE,
+	ENC_TRS80_500,		//!< TRS-80 Level II, 500 baud pulses
+	ENC_TRS80_1500,		//!< TRS-80 Model III, 1500 baud
+	ENC_CGENIE		//!< Colour Genie
+    };
+
+    explicit CasWavDecoder(QObject* parent = nullptr);
+
+    static bool is_wav(const uchar* data, qint64 size);
+
+    bool decode(const QString& filename);
+    bool decode(QIODevice* device);
+    bool decode(const uchar* data, qint64 size);
+
+    const QByteArray& cas() const;
+    int programs() const;
+    quint32 rate() const;
+
+signals:
+    void Info(QString message);
+    void Error(QString message);
+
+private:
+    /** @brief bit assembly for the two ways to map symbols to bits */
+    enum Framer {
+	FR_PAIRS,		//!< 1 = short short, 0 = long
+	FR_SINGLE,		//!< 1 = short, 0 = long
+	FR_COUNT
+    };
+
+    void reset();
+    bool format(const QByteArray& fmt);
+    bool stream(QIODevice* device, qint64 size);
+    void convert(const uchar* pcm, int frames);
+    void filter(int frames);
+    void trigger(int frames);
+    void edge(qint64 pos);
+    void interval(int len);
+    void classify(int len);
+    void tail();
+    void train();
+    void symbol(bool is_short);
+    void bit(Framer framer, int b);
+    void lock(Encoding enc, Framer framer);
+    void end_program();
+
+    quint32 m_rate;
+    int m_channels;
+    int m_bits;
+    int m_frame_size;
+
+    QVector<qint16> m_raw;	//!< converted samples with two samples of history
+    QVector<qint16> m_filt;	//!< filtered samples
+    int m_center;		//!< tracked DC offset
+    int m_env;			//!< tracked amplitude
+    bool m_high;		//!< Schmitt trigger output
+    qint64 m_pos;		//!< sample number of the current chunk's first sample
+    qint64 m_last_edge;		//!< sample number of the previous rising edge
+    qint64 m_last_fall;		//!< sample number of the previous falling edge
+
+    QVector<int> m_train;	//!< intervals collected to find the threshold
+    bool m_trained;
+    double m_short;		//!< average short interval
+    double m_long;		//!< average long interval
+    int m_gap;			//!< intervals longer than this end a program
+
+    quint16 m_shift[FR_COUNT];	//!< shift registers while looking for sync
+    bool m_pending;		//!< a short symbol is waiting for its pair
+    Encoding m_encoding;	//!< encoding of the current program
+    Framer m_framer;		//!< framer of the current program
+    int m_nbits;
+    quint8 m_byte;
+
+    QByteArray m_program;	//!< the program being decoded
+    QByteArray m_cas;		//!< all decoded programs
+    int m_programs;
+};
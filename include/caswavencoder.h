@@ -0,0 +1,103 @@
+/****************************************************************************
+ *
+ * Cass80 tool - cassette audio (WAV and CSW) encoder
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QObject>
+#include <QIODevice>
+#include <QVector>
+#include "caswavdecoder.h"
+
+class Cass80Handler;
+
+/**
+ * @brief Encoder for cassette images to WAV or CSW audio
+ *
+ * The waveform of each of the 256 byte values is computed once per
+ * encoding and sample rate. Encoding then only copies the table
+ * entries of the bytes into a buffer, which is written to the device
+ * whenever it is full. Sizes are summed from the tables before any
+ * data is written, so the headers are final and the output device
+ * may be sequential.
+ */
+class CasWavEncoder : public QObject
+{
+    Q_OBJECT
+public:
+    enum Format {
+	FMT_WAV,		//!< RIFF WAVE, 16 bit mono PCM
+	FMT_CSW			//!< compressed square wave v1.01, RLE
+    };
+
+    explicit CasWavEncoder(QObject* parent = nullptr);
+
+    quint32 rate() const;
+    static Format format(const QString& filename);
+
+    bool encode(const Cass80Handler* cas, const QString& filename);
+    bool encode(const QByteArray& payload, CasWavDecoder::Encoding enc,
+		QIODevice* device, Format fmt);
+
+public slots:
+    void set_rate(quint32 rate);
+
+signals:
+    void Info(QString message);
+    void Error(QString message);
+
+private:
+    /** @brief a part of a bit with constant level */
+    struct Segment {
+	int level;		//!< +1, -1, or 0 for silence
+	double secs;		//!< duration in seconds
+    };
+
+    void bit_segments(int b, QVector<Segment>& segs) const;
+    void tables(CasWavDecoder::Encoding enc);
+    void put_byte(quint8 byte);
+    void put_silence(qint64 samples);
+    void put_pulse(quint32 len);
+    void flush();
+
+    quint32 m_rate;
+    CasWavDecoder::Encoding m_encoding;
+    Format m_format;
+    QIODevice* m_device;
+    bool m_ok;
+
+    QByteArray m_pcm;		//!< 16 bit PCM of all byte values back to back
+    QVector<quint32> m_pulses;	//!< CSW pulse lengths of all byte values back to back
+    int m_pcm_offs[257];	//!< offsets of the byte values in m_pcm
+    int m_pulse_offs[257];	//!< offsets of the byte values in m_pulses
+    quint32 m_pending;		//!< CSW low pulse which may still grow
+    QByteArray m_buffer;	//!< output buffer
+};
@@ -0,0 +1,92 @@
+/****************************************************************************
+ *
+ * Cass80 tool - ZIP archive reader
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QFile>
+#include <QHash>
+#include <QVector>
+
+/**
+ * @brief Read members of a ZIP archive without extracting it
+ *
+ * The central directory is read once into an index. Members are
+ * inflated straight from the memory mapped archive into a buffer of
+ * the caller, which keeps its capacity for the next member. read() does
+ * not change the object, so several threads may inflate members of the
+ * same archive at once, each with its own buffer.
+ *
+ * Only stored and deflated members are supported; ZIP64 archives and
+ * encrypted members are not.
+ */
+class CasZip
+{
+public:
+    /** @brief One entry of the central directory */
+    struct Member {
+	Member() : method(0), flags(0), crc32(0), csize(0), usize(0), offs(0) {}
+	QString name;		//!< path name of the member in the archive
+	quint16 method;		//!< compression method (0: stored, 8: deflated)
+	quint16 flags;		//!< general purpose flags
+	quint32 crc32;		//!< CRC32 of the uncompressed data
+	qint64 csize;		//!< compressed size
+	qint64 usize;		//!< uncompressed size
+	qint64 offs;		//!< offset of the local header
+    };
+
+    CasZip();
+    ~CasZip();
+
+    static bool is_zip(const uchar* data, qint64 size);
+    static bool split(const QString& path, QString* archive = nullptr, QString* member = nullptr);
+
+    bool open(const QString& filename);
+    bool open(const uchar* data, qint64 size);
+    void close();
+    QString error_string() const;
+
+    int count() const;
+    const Member& member(int index) const;
+    int find(const QString& name) const;
+    QVector<int> cassettes() const;
+
+    bool read(int index, QByteArray& buffer, QString* error = nullptr) const;
+
+private:
+    QFile m_file;
+    uchar* m_map;
+    const uchar* m_data;
+    qint64 m_size;
+    QString m_error;
+    QVector<Member> m_members;
+    QHash<QString, int> m_index;
+};
@@ -58,11 +58,20 @@ typedef enum {
 }   cas_control_e;
 Q_ENUMS(cas_control_e);
 
+/**
+ * @brief One block of a cassette image
+ *
+ * The block does not own its payload. All payloads of an image are
+ * stored back to back in one arena, which is shared by every block
+ * of the image, and the block refers to its bytes by offset and length.
+ * Copying a block or a CasBlockList is thus cheap.
+ */
 class Cass80Block
 {
 public:
     Cass80Block()
-	: type(BT_INVALID), csum(0), addr(0), size(0), line(0), data()
+	: type(BT_INVALID), csum(0), addr(0), size(0), line(0)
+	, offs(0), len(0), arena()
     {}
 
     Cass80BlockType  type;
@@ -70,17 +79,38 @@ public:
     quint16 addr;
     quint16 size;
     quint16 line;
-    QByteArray data;
-    bool operator== (const Cass80Block& other)
+    int offs;			//!< offset of the payload in the arena
+    int len;			//!< length of the payload in the arena
+    QByteArray arena;		//!< arena shared by all blocks of the image
+
+    /** @brief pointer to the first byte of the payload */
+    const uchar* bytes() const
+    {
+	return reinterpret_cast<const uchar *>(arena.constData()) + offs;
+    }
+
+    /**
+     * @brief the payload as QByteArray
+     * The result refers to the arena without copying it; it stays
+     * valid as long as the arena of this block is alive.
+     */
+    QByteArray data() const
+    {
+	return QByteArray::fromRawData(arena.constData() + offs, len);
+    }
+
+    bool operator== (const Cass80Block& other) const
     {
 	return type == other.type &&
 		csum == other.csum &&
 		addr == other.addr &&
 		size == other.size &&
 		line == other.line &&
-		data == other.data;
+		len == other.len &&
+		0 == memcmp(bytes(), other.bytes(), static_cast<size_t>(len));
     }
 };
+Q_DECLARE_TYPEINFO(Cass80Block, Q_MOVABLE_TYPE);
 
-typedef QList<Cass80Block> CasBlockList;
+typedef QVector<Cass80Block> CasBlockList;
 Q_DECLARE_METATYPE(CasBlockList);
@@ -33,252 +33,464 @@
  ****************************************************************************/
 #include "basictoken.h"
 
-static const QLatin1String g_amp("&amp;");
-static const QLatin1String g_lt("&lt;");
-static const QLatin1String g_gt("&gt;");
+/** @brief A keyword and its token */
+struct BasicKeyword {
+    int token;			//!< byte 80h-FFh, or FFxxh for the Colour Genie tokens
+    const char* name;		//!< keyword as listed
+};
 
-BasicToken::BasicToken(bool esc_xml)
-    : m_token()
-    , m_esc_xml(esc_xml)
-{
-    m_token.insert(tEND,          "END");
-    m_token.insert(tFOR,          "FOR");
-    m_token.insert(tRESET,        "RESET");
-    m_token.insert(tSET,          "SET");
-    m_token.insert(tCLS,          "CLS");
-    m_token.insert(tCMD,          "CMD");
-    m_token.insert(tRANDOM,       "RANDOM");
-    m_token.insert(tNEXT,         "NEXT");
-
-    m_token.insert(tDATA,         "DATA");
-    m_token.insert(tINPUT,        "INPUT");
-    m_token.insert(tDIM,          "DIM");
-    m_token.insert(tREAD,         "READ");
-    m_token.insert(tLET,          "LET");
-    m_token.insert(tGOTO,         "GOTO");
-    m_token.insert(tRUN,          "RUN");
-    m_token.insert(tIF,           "IF");
-
-    m_token.insert(tRESTORE,      "RESTORE");
-    m_token.insert(tGOSUB,        "GOSUB");
-    m_token.insert(tRETURN,       "RETURN");
-    m_token.insert(tREM,          "REM");
-    m_token.insert(tSTOP,         "STOP");
-    m_token.insert(tELSE,         "ELSE");
-    m_token.insert(tTRON,         "TRON");
-    m_token.insert(tTROFF,        "TROFF");
-
-    m_token.insert(tDEFSTR,       "DEFSTR");
-    m_token.insert(tDEFINT,       "DEFINT");
-    m_token.insert(tDEFSNG,       "DEFSNG");
-    m_token.insert(tDEFDBL,       "DEFDBL");
-    m_token.insert(tLINE,         "LINE");
-    m_token.insert(tEDIT,         "EDIT");
-    m_token.insert(tERROR,        "ERROR");
-    m_token.insert(tRESUME,       "RESUME");
-
-    m_token.insert(tOUT,          "OUT");
-    m_token.insert(tON,           "ON");
-    m_token.insert(tOPEN,         "OPEN");
-    m_token.insert(tFIELD,        "FIELD");
-    m_token.insert(tGET,          "GET");
-    m_token.insert(tPUT,          "PUT");
-    m_token.insert(tCLOSE,        "CLOSE");
-    m_token.insert(tLOAD,         "LOAD");
-
-    m_token.insert(tMERGE,        "MERGE");
-    m_token.insert(tNAME,         "NAME");
-    m_token.insert(tKILL,         "KILL");
-    m_token.insert(tLSET,         "LSET");
-    m_token.insert(tRSET,         "RSET");
-    m_token.insert(tSAVE,         "SAVE");
-    m_token.insert(tSYSTEM,       "SYSTEM");
-    m_token.insert(tLPRINT,       "LPRINT");
-
-    m_token.insert(tDEF,          "DEF");
-    m_token.insert(tPOKE,         "POKE");
-    m_token.insert(tPRINT,        "PRINT");
-    m_token.insert(tCONT,         "CONT");
-    m_token.insert(tLIST,         "LIST");
-    m_token.insert(tLLIST,        "LLIST");
-    m_token.insert(tDELETE,       "DELETE");
-    m_token.insert(tAUTO,         "AUTO");
-
-    m_token.insert(tCLEAR,        "CLEAR");
-    m_token.insert(tCLOAD,        "CLOAD");
-    m_token.insert(tCSAVE,        "CSAVE");
-    m_token.insert(tNEW,          "NEW");
-    m_token.insert(tTAB_LPAREN,   "TAB(");
-    m_token.insert(tTO,           "TO");
-    m_token.insert(tFN,           "FN");
-    m_token.insert(tUSING,        "USING");
-
-    m_token.insert(tVARPTR,       "VARPTR");
-    m_token.insert(tUSR,          "USR");
-    m_token.insert(tERL,          "ERL");
-    m_token.insert(tERR,          "ERR");
-    m_token.insert(tSTRING_DOLLAR,"STRING$");
-    m_token.insert(tINSTR,        "INSTR");
-    m_token.insert(tCHECK,        "CHECK");
-    m_token.insert(tTIME_DOLLAR,  "TIME$");
-
-    m_token.insert(tMEM,          "MEM");
-    m_token.insert(tINKEY_DOLLAR, "INKEY$");
-    m_token.insert(tTHEN,         "THEN");
-    m_token.insert(tNOT,          "NOT");
-    m_token.insert(tSTEP,         "STEP");
-    m_token.insert(tPLUS,         "+");
-    m_token.insert(tMINUS,        "-");
-    m_token.insert(tMULTIPLY,     "*");
-
-    m_token.insert(tDIVIDE,       "/");
-    m_token.insert(tLBRACKET,     "[");
-    m_token.insert(tAND,          "AND");
-    m_token.insert(tOR,           "OR");
-    m_token.insert(tGT,           ">");
-    m_token.insert(tEQ,           "=");
-    m_token.insert(tLT,           "<");
-    m_token.insert(tSGN,          "SGN");
-
-    m_token.insert(tINT,          "INT");
-    m_token.insert(tABS,          "ABS");
-    m_token.insert(tFRE,          "FRE");
-    m_token.insert(tINP,          "INP");
-    m_token.insert(tPOS,          "POS");
-    m_token.insert(tSQR,          "SQR");
-    m_token.insert(tRND,          "RND");
-    m_token.insert(tLOG,          "LOG");
-
-    m_token.insert(tEXP,          "EXP");
-    m_token.insert(tCOS,          "COS");
-    m_token.insert(tSIN,          "SIN");
-    m_token.insert(tTAN,          "TAN");
-    m_token.insert(tATN,          "ATN");
-    m_token.insert(tPEEK,         "PEEK");
-    m_token.insert(tCVI,          "CVI");
-    m_token.insert(tCVS,          "CVS");
-
-    m_token.insert(tCVD,          "CVD");
-    m_token.insert(tEOF,          "EOF");
-    m_token.insert(tLOC,          "LOC");
-    m_token.insert(tLOF,          "LOF");
-    m_token.insert(tMKI_DOLLAR,   "MKI$");
-    m_token.insert(tMKS_DOLLAR,   "MKS$");
-    m_token.insert(tMKD_DOLLAR,   "MKD$");
-    m_token.insert(tCINT,         "CINT");
-
-    m_token.insert(tCSNG,         "CSNG");
-    m_token.insert(tCDBL,         "CDBL");
-    m_token.insert(tFIX,          "FIX");
-    m_token.insert(tLEN,          "LEN");
-    m_token.insert(tSTR_DOLLAR,   "STR$");
-    m_token.insert(tVAL,          "VAL");
-    m_token.insert(tASC,          "ASC");
-    m_token.insert(tCHR_DOLLAR,   "CHR$");
-
-    m_token.insert(tLEFT_DOLLAR,  "LEFT$");
-    m_token.insert(tRIGHT_DOLLAR, "RIGHT$");
-    m_token.insert(tMID_DOLLAR,   "MID$");
-    m_token.insert(tQUOTE,        "'");
-    m_token.insert(tOCT374,        "\\374");
-    m_token.insert(tOCT375,        "\\375");
-    m_token.insert(tOCT376,        "\\376");
-    m_token.insert(tOCT377,        "\\377");
+static const BasicKeyword g_keywords[] = {
+    {BasicToken::tEND,            "END"},
+    {BasicToken::tFOR,            "FOR"},
+    {BasicToken::tRESET,          "RESET"},
+    {BasicToken::tSET,            "SET"},
+    {BasicToken::tCLS,            "CLS"},
+    {BasicToken::tCMD,            "CMD"},
+    {BasicToken::tRANDOM,         "RANDOM"},
+    {BasicToken::tNEXT,           "NEXT"},
+
+    {BasicToken::tDATA,           "DATA"},
+    {BasicToken::tINPUT,          "INPUT"},
+    {BasicToken::tDIM,            "DIM"},
+    {BasicToken::tREAD,           "READ"},
+    {BasicToken::tLET,            "LET"},
+    {BasicToken::tGOTO,           "GOTO"},
+    {BasicToken::tRUN,            "RUN"},
+    {BasicToken::tIF,             "IF"},
+
+    {BasicToken::tRESTORE,        "RESTORE"},
+    {BasicToken::tGOSUB,          "GOSUB"},
+    {BasicToken::tRETURN,         "RETURN"},
+    {BasicToken::tREM,            "REM"},
+    {BasicToken::tSTOP,           "STOP"},
+    {BasicToken::tELSE,           "ELSE"},
+    {BasicToken::tTRON,           "TRON"},
+    {BasicToken::tTROFF,          "TROFF"},
+
+    {BasicToken::tDEFSTR,         "DEFSTR"},
+    {BasicToken::tDEFINT,         "DEFINT"},
+    {BasicToken::tDEFSNG,         "DEFSNG"},
+    {BasicToken::tDEFDBL,         "DEFDBL"},
+    {BasicToken::tLINE,           "LINE"},
+    {BasicToken::tEDIT,           "EDIT"},
+    {BasicToken::tERROR,          "ERROR"},
+    {BasicToken::tRESUME,         "RESUME"},
+
+    {BasicToken::tOUT,            "OUT"},
+    {BasicToken::tON,             "ON"},
+    {BasicToken::tOPEN,           "OPEN"},
+    {BasicToken::tFIELD,          "FIELD"},
+    {BasicToken::tGET,            "GET"},
+    {BasicToken::tPUT,            "PUT"},
+    {BasicToken::tCLOSE,          "CLOSE"},
+    {BasicToken::tLOAD,           "LOAD"},
+
+    {BasicToken::tMERGE,          "MERGE"},
+    {BasicToken::tNAME,           "NAME"},
+    {BasicToken::tKILL,           "KILL"},
+    {BasicToken::tLSET,           "LSET"},
+    {BasicToken::tRSET,           "RSET"},
+    {BasicToken::tSAVE,           "SAVE"},
+    {BasicToken::tSYSTEM,         "SYSTEM"},
+    {BasicToken::tLPRINT,         "LPRINT"},
+
+    {BasicToken::tDEF,            "DEF"},
+    {BasicToken::tPOKE,           "POKE"},
+    {BasicToken::tPRINT,          "PRINT"},
+    {BasicToken::tCONT,           "CONT"},
+    {BasicToken::tLIST,           "LIST"},
+    {BasicToken::tLLIST,          "LLIST"},
+    {BasicToken::tDELETE,         "DELETE"},
+    {BasicToken::tAUTO,           "AUTO"},
+
+    {BasicToken::tCLEAR,          "CLEAR"},
+    {BasicToken::tCLOAD,          "CLOAD"},
+    {BasicToken::tCSAVE,          "CSAVE"},
+    {BasicToken::tNEW,            "NEW"},
+    {BasicToken::tTAB_LPAREN,     "TAB("},
+    {BasicToken::tTO,             "TO"},
+    {BasicToken::tFN,             "FN"},
+    {BasicToken::tUSING,          "USING"},
+
+    {BasicToken::tVARPTR,         "VARPTR"},
+    {BasicToken::tUSR,            "USR"},
+    {BasicToken::tERL,            "ERL"},
+    {BasicToken::tERR,            "ERR"},
+    {BasicToken::tSTRING_DOLLAR,  "STRING$"},
+    {BasicToken::tINSTR,          "INSTR"},
+    {BasicToken::tCHECK,          "CHECK"},
+    {BasicToken::tTIME_DOLLAR,    "TIME$"},
+
+    {BasicToken::tMEM,            "MEM"},
+    {BasicToken::tINKEY_DOLLAR,   "INKEY$"},
+    {BasicToken::tTHEN,           "THEN"},
+    {BasicToken::tNOT,            "NOT"},
+    {BasicToken::tSTEP,           "STEP"},
+    {BasicToken::tPLUS,           "+"},
+    {BasicToken::tMINUS,          "-"},
+    {BasicToken::tMULTIPLY,       "*"},
+
+    {BasicToken::tDIVIDE,         "/"},
+    {BasicToken::tLBRACKET,       "["},
+    {BasicToken::tAND,            "AND"},
+    {BasicToken::tOR,             "OR"},
+    {BasicToken::tGT,             ">"},
+    {BasicToken::tEQ,             "="},
+    {BasicToken::tLT,             "<"},
+    {BasicToken::tSGN,            "SGN"},
+
+    {BasicToken::tINT,            "INT"},
+    {BasicToken::tABS,            "ABS"},
+    {BasicToken::tFRE,            "FRE"},
+    {BasicToken::tINP,            "INP"},
+    {BasicToken::tPOS,            "POS"},
+    {BasicToken::tSQR,            "SQR"},
+    {BasicToken::tRND,            "RND"},
+    {BasicToken::tLOG,            "LOG"},
+
+    {BasicToken::tEXP,            "EXP"},
+    {BasicToken::tCOS,            "COS"},
+    {BasicToken::tSIN,            "SIN"},
+    {BasicToken::tTAN,            "TAN"},
+    {BasicToken::tATN,            "ATN"},
+    {BasicToken::tPEEK,           "PEEK"},
+    {BasicToken::tCVI,            "CVI"},
+    {BasicToken::tCVS,            "CVS"},
+
+    {BasicToken::tCVD,            "CVD"},
+    {BasicToken::tEOF,            "EOF"},
+    {BasicToken::tLOC,            "LOC"},
+    {BasicToken::tLOF,            "LOF"},
+    {BasicToken::tMKI_DOLLAR,     "MKI$"},
+    {BasicToken::tMKS_DOLLAR,     "MKS$"},
+    {BasicToken::tMKD_DOLLAR,     "MKD$"},
+    {BasicToken::tCINT,           "CINT"},
+
+    {BasicToken::tCSNG,           "CSNG"},
+    {BasicToken::tCDBL,           "CDBL"},
+    {BasicToken::tFIX,            "FIX"},
+    {BasicToken::tLEN,            "LEN"},
+    {BasicToken::tSTR_DOLLAR,     "STR$"},
+    {BasicToken::tVAL,            "VAL"},
+    {BasicToken::tASC,            "ASC"},
+    {BasicToken::tCHR_DOLLAR,     "CHR$"},
+
+    {BasicToken::tLEFT_DOLLAR,    "LEFT$"},
+    {BasicToken::tRIGHT_DOLLAR,   "RIGHT$"},
+    {BasicToken::tMID_DOLLAR,     "MID$"},
+    {BasicToken::tQUOTE,          "'"},
+    {BasicToken::tOCT374,         "\\374"},
+    {BasicToken::tOCT375,         "\\375"},
+    {BasicToken::tOCT376,         "\\376"},
+    {BasicToken::tOCT377,         "\\377"},
 
     /* Colour Genie specific strings (after 0xff) */
-    m_token.insert(tCOLOUR,       "COLOUR");
-    m_token.insert(tFCOLOU,       "FCOLOU");    /* (sic!) */
-    m_token.insert(tKEYPAD,       "KEYPAD");
-    m_token.insert(tJOY,          "JOY");
-    m_token.insert(tPLOT,         "PLOT");
-    m_token.insert(tFGR,          "FGR");
-    m_token.insert(tLGR,          "LGR");
-    m_token.insert(tFCLS,         "FCLS");
-
-    m_token.insert(tPLAY,         "PLAY");
-    m_token.insert(tCIRCLE,       "CIRCLE");
-    m_token.insert(tSCALE,        "SCALE");
-    m_token.insert(tSHAPE,        "SHAPE");
-    m_token.insert(tNSHAPE,       "NSHAPE");
-    m_token.insert(tXSHAPE,       "XSHAPE");
-    m_token.insert(tPAINT,        "PAINT");
-    m_token.insert(tCPOINT,       "CPOINT");
-
-    m_token.insert(tNPLOT,        "NPLOT");
-    m_token.insert(tSOUND,        "SOUND");
-    m_token.insert(tCHAR,         "CHAR");
-    m_token.insert(tRENUM,        "RENUM");
-    m_token.insert(tSWAP,         "SWAP");
-    m_token.insert(tFKEY,         "FKEY");
-    m_token.insert(tCALL,         "CALL");
-    m_token.insert(tVERIFY,       "VERIFY");
-
-    m_token.insert(tBGRD,         "BGRD");
-    m_token.insert(tNBGRD,        "NBGRD");
+    {BasicToken::tCOLOUR,         "COLOUR"},
+    {BasicToken::tFCOLOU,         "FCOLOU"},    /* (sic!) */
+    {BasicToken::tKEYPAD,         "KEYPAD"},
+    {BasicToken::tJOY,            "JOY"},
+    {BasicToken::tPLOT,           "PLOT"},
+    {BasicToken::tFGR,            "FGR"},
+    {BasicToken::tLGR,            "LGR"},
+    {BasicToken::tFCLS,           "FCLS"},
+
+    {BasicToken::tPLAY,           "PLAY"},
+    {BasicToken::tCIRCLE,         "CIRCLE"},
+    {BasicToken::tSCALE,          "SCALE"},
+    {BasicToken::tSHAPE,          "SHAPE"},
+    {BasicToken::tNSHAPE,         "NSHAPE"},
+    {BasicToken::tXSHAPE,         "XSHAPE"},
+    {BasicToken::tPAINT,          "PAINT"},
+    {BasicToken::tCPOINT,         "CPOINT"},
+
+    {BasicToken::tNPLOT,          "NPLOT"},
+    {BasicToken::tSOUND,          "SOUND"},
+    {BasicToken::tCHAR,           "CHAR"},
+    {BasicToken::tRENUM,          "RENUM"},
+    {BasicToken::tSWAP,           "SWAP"},
+    {BasicToken::tFKEY,           "FKEY"},
+    {BasicToken::tCALL,           "CALL"},
+    {BasicToken::tVERIFY,         "VERIFY"},
+
+    {BasicToken::tBGRD,           "BGRD"},
+    {BasicToken::tNBGRD,          "NBGRD"},
+};
+
+/** @brief A node of the keyword trie */
+struct BasicTrieNode {
+    char ch;			//!< character of the keyword
+    int token;			//!< token of the keyword ending here, or -1
+    int child;			//!< first node of the next character, or 0
+    int sibling;		//!< next node for another character, or 0
+};
+
+/**
+ * @brief Text of every byte of a tokenized line, plain and XML escaped
+ *
+ * Index 0 of each table is plain text, index 1 escapes &, < and > for
+ * XML. The tables and the keyword trie for tokenize() are built once
+ * from g_keywords.
+ */
+struct BasicTables {
+    QString code[2][256];	//!< byte outside of strings: ASCII or keyword
+    QString ext[2][256];	//!< byte after FFh: Colour Genie keyword
+    QString str[2][256];	//!< byte inside of a string: Latin-1 character
+    QVector<BasicTrieNode> trie;	//!< keyword trie; node 0 is the root
 
+    BasicTables()
+    {
+	const BasicTrieNode root = {0, -1, 0, 0};
+	trie += root;
+	for (int c = 0; c < 256; c++) {
+	    const QString latin1(QChar(static_cast<uchar>(c)));
+	    const QString octal = QString("\\377\\%1").arg(c, 3, 8, QChar('0'));
+	    str[0][c] = latin1;
+	    str[1][c] = escape(latin1);
+	    code[0][c] = c < 0x80 ? latin1 : QString();
+	    ext[0][c] = octal;
+	}
+	for (const BasicKeyword& kw : g_keywords) {
+	    // FFh is the prefix of the extended tokens
+	    if (kw.token != BasicToken::tOCT377)
+		insert(kw.name, kw.token);
+	    if (kw.token < 0x100)
+		code[0][kw.token] = QString::fromLatin1(kw.name);
+	    else
+		ext[0][kw.token & 0xff] = QString::fromLatin1(kw.name);
+	}
+	for (int c = 0; c < 256; c++) {
+	    code[1][c] = escape(code[0][c]);
+	    ext[1][c] = escape(ext[0][c]);
+	}
+    }
+
+    /**
+     * @brief Add the keyword @p name for @p token to the trie
+     * @param name keyword as listed
+     * @param token its token
+     */
+    void insert(const char* name, int token)
+    {
+	int node = 0;
+	for (const char* p = name; *p; p++) {
+	    int* link = &trie[node].child;
+	    while (*link > 0 && trie[*link].ch != *p)
+		link = &trie[*link].sibling;
+	    if (*link > 0) {
+		node = *link;
+		continue;
+	    }
+	    const BasicTrieNode n = {*p, -1, 0, 0};
+	    node = trie.count();
+	    *link = node;
+	    trie += n;
+	}
+	trie[node].token = token;
+    }
+
+    /**
+     * @brief Find the longest keyword at @p pos of @p text
+     * @param text line of plain text
+     * @param pos position in the text
+     * @param cgenie if true, match the Colour Genie keywords, too
+     * @param length pointer to an int receiving the keyword's length
+     * @return the token, or -1 if no keyword starts at @p pos
+     */
+    int match(const QString& text, int pos, bool cgenie, int* length) const
+    {
+	int token = -1;
+	int node = 0;
+	for (int i = pos; i < text.size(); i++) {
+	    const ushort ch = text.at(i).unicode();
+	    node = trie[node].child;
+	    while (node > 0 && static_cast<uchar>(trie[node].ch) != ch)
+		node = trie[node].sibling;
+	    if (node <= 0)
+		break;
+	    const int t = trie[node].token;
+	    if (t >= 0 && (cgenie || t < 0x100)) {
+		token = t;
+		*length = i + 1 - pos;
+	    }
+	}
+	return token;
+    }
+
+    static QString escape(const QString& text)
+    {
+	if (text == QLatin1String("&"))
+	    return QStringLiteral("&amp;");
+	if (text == QLatin1String("<"))
+	    return QStringLiteral("&lt;");
+	if (text == QLatin1String(">"))
+	    return QStringLiteral("&gt;");
+	return text;
+    }
+};
+
+static const BasicTables& tables()
+{
+    static const BasicTables t;
+    return t;
+}
+
+BasicToken::BasicToken(bool esc_xml)
+    : m_esc_xml(esc_xml)
+{
 }
 
+/**
+ * @brief Return the text of the tokenized line at @p source
+ *
+ * Every byte is looked up in a table of pre-escaped strings, and the
+ * text is collected in one buffer, which holds a line of up to 1 KiB
+ * without touching the heap.
+ *
+ * @param source pointer to the tokenized line
+ * @param maxsize maximum number of bytes; a NUL byte ends the line earlier
+ * @return the line as text
+ */
 const QString BasicToken::detokenize(const void* source, int maxsize)
 {
+    const BasicTables& t = tables();
+    const int xml = m_esc_xml ? 1 : 0;
     const uchar* src = reinterpret_cast<const uchar *>(source);
-    QStringList buff;
-    int string = 0;
-
-    for (/* */; *src && maxsize-- > 0; src++) {
-        if (string) {
-            if ('"' == *src)
-                string = 0;
-            switch (*src) {
-            case '&':
-		buff += m_esc_xml ? g_amp : QString(QChar(*src));
-                break;
-            case '<':
-		buff += m_esc_xml ? g_lt : QString(QChar(*src));
-		break;
-            case '>':
-		buff += m_esc_xml ? g_gt : QString(QChar(*src));
+    QVarLengthArray<QChar, 1024> buff;
+    bool string = false;
+
+    for (/* */; *src && maxsize > 0; src++, maxsize--) {
+	const QString* text;
+	if (string) {
+	    text = &t.str[xml][*src];
+	    string = '"' != *src;
+	} else if (0xff == *src) {
+	    if (maxsize < 2)
 		break;
-            default:
-		buff += QString::fromLatin1(reinterpret_cast<const char *>(src), 1);
-                break;
-            }
-            continue;
-        }
-        if (0xff == *src) {
-            src++;
-	    QString token = m_token.value(0xff00 | *src);
-	    if (token.isEmpty())
-		token = QString("\\377\\%1").arg(*src, 3, 8, QChar('0'));
-	    buff += token;
-            continue;
-        }
-        if (*src > 0x7f) {
-	    if (m_token[*src] == QStringLiteral("&"))
-		buff += m_esc_xml ? g_amp : m_token[*src];
-	    else if (m_token[*src] == QStringLiteral("<"))
-		buff += m_esc_xml ? g_lt : m_token[*src];
-	    else if (m_token[*src] == QStringLiteral(">"))
-		buff += m_esc_xml ? g_gt : m_token[*src];
-	    else
-		buff += m_token[*src];
-            continue;
-        }
-        switch (*src) {
-        case '&':
-	    buff += m_esc_xml ? g_amp : QString(QChar(*src));
+	    src++;
+	    maxsize--;
+	    text = &t.ext[xml][*src];
+	} else {
+	    text = &t.code[xml][*src];
+	    string = '"' == *src;
+	}
+	buff.append(text->constData(), text->size());
+    }
+    return QString(buff.constData(), buff.size());
+}
+
+/**
+ * @brief Return the tokenized line for the plain text @p text
+ *
+ * The text is what detokenize() returns for a line. Outside of strings
+ * the longest keyword at each position is replaced by its token, and
+ * the Colour Genie keywords by FFh and their token. Strings, the rest
+ * of a REM, and DATA up to the next colon are copied as they are. An
+ * apostrophe is stored as :REM' like BASIC does itself.
+ *
+ * @param text line without its line number
+ * @param cgenie if true, tokenize the Colour Genie keywords, too
+ * @return QByteArray with the tokens, terminated by a NUL byte
+ */
+QByteArray BasicToken::tokenize(const QString& text, bool cgenie) const
+{
+    const BasicTables& t = tables();
+    const int size = text.size();
+    QByteArray dst;
+    bool string = false;
+    bool data = false;
+    bool rem = false;
+    int pos = 0;
+
+    dst.reserve(size + 3);
+    while (pos < size) {
+	const ushort uc = text.at(pos).unicode();
+	const char ch = static_cast<char>(uc < 0x100 ? uc : '?');
+	int length = 1;
+	if (rem || string || (data && ':' != ch) || '"' == ch) {
+	    dst += ch;
+	    string ^= '"' == ch;
+	    pos++;
+	    continue;
+	}
+	data = false;
+
+	// An extended token without a keyword is listed as \377\ooo
+	if (text.midRef(pos, 5) == QLatin1String("\\377\\") && pos + 8 <= size) {
+	    bool ok;
+	    const uint code = text.mid(pos + 5, 3).toUInt(&ok, 8);
+	    if (ok && code < 0x100) {
+		dst += static_cast<char>(0xff);
+		dst += static_cast<char>(code);
+		pos += 8;
+		continue;
+	    }
+	}
+
+	const int token = t.match(text, pos, cgenie, &length);
+	if (token < 0) {
+	    dst += ch;
+	    pos++;
+	    continue;
+	}
+	pos += length;
+	switch (token) {
+	case tQUOTE:
+	    dst += ':';
+	    dst += static_cast<char>(tREM);
+	    dst += static_cast<char>(tQUOTE);
+	    rem = true;
 	    break;
-        case '<':
-	    buff += m_esc_xml ? g_lt : QString(QChar(*src));
+	case tREM:
+	    dst += static_cast<char>(tREM);
+	    if (dst.endsWith(":\223") && pos < size && '\'' == text.at(pos)) {
+		dst += static_cast<char>(tQUOTE);
+		pos++;
+	    }
+	    rem = true;
 	    break;
-        case '>':
-	    buff += m_esc_xml ? g_gt : QString(QChar(*src));
+	case tDATA:
+	    dst += static_cast<char>(tDATA);
+	    data = true;
 	    break;
-        default:
-	    buff += QString::fromLatin1(reinterpret_cast<const char *>(src), 1);
-            break;
-        }
-        if ('"' == *src)
-            string = 1;
+	default:
+	    if (token > 0xff)
+		dst += static_cast<char>(0xff);
+	    dst += static_cast<char>(token & 0xff);
+	    break;
+	}
+    }
+    dst += '\0';
+    return dst;
+}
+
+/**
+ * @brief Return true if @p data looks like a plain text BASIC listing
+ *
+ * Every non-empty line must start with a line number, and there must
+ * be no control characters besides tabs and line ends.
+ *
+ * @param data pointer to the first byte
+ * @param size number of bytes
+ * @return true for a listing, false otherwise
+ */
+bool BasicToken::is_listing(const uchar* data, qint64 size)
+{
+    bool start = true;
+    bool lines = false;
+    for (qint64 i = 0; i < size; i++) {
+	const uchar ch = data[i];
+	if ('\n' == ch || '\r' == ch) {
+	    start = true;
+	    continue;
+	}
+	if (ch < 0x20 && '\t' != ch)
+	    return false;
+	if (start && ' ' != ch && '\t' != ch) {
+	    if (ch < '0' || ch > '9')
+		return false;
+	    start = false;
+	    lines = true;
+	}
     }
-    return buff.join(QString());
+    return lines;
 }
@@ -0,0 +1,298 @@
+/****************************************************************************
+ *
+ * Cass80 tool - bit level realignment of cassette images
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <QtEndian>
+#include "casbitalign.h"
+#include "casscanner.h"
+
+/** @brief number of BASIC lines verified when scoring a header */
+static const int g_basic_lines = 8;
+
+/** @brief a byte value in all 8 bytes of a word */
+static inline quint64 splat(quint8 b)
+{
+    return Q_UINT64_C(0x0101010101010101) * b;
+}
+
+/**
+ * @brief Return the high bit of every byte of @p v which is zero
+ * Unlike the common has-zero trick this is exact for every byte.
+ */
+static inline quint64 zero_bytes(quint64 v)
+{
+    const quint64 low7 = Q_UINT64_C(0x7f7f7f7f7f7f7f7f);
+    return ~(((v & low7) + low7) | v | low7);
+}
+
+/**
+ * @brief Load 8 bytes big endian, padding with zeroes after the end
+ */
+static inline quint64 load_be64(const uchar* data, qint64 size, qint64 offs)
+{
+    if (offs + 8 <= size)
+	return qFromBigEndian<quint64>(data + offs);
+    quint64 w = 0;
+    for (int i = 0; i < 8; i++)
+	w = (w << 8) | (offs + i < size ? data[offs + i] : 0);
+    return w;
+}
+
+/**
+ * @brief Return the byte at @p offs after skipping @p phase bits
+ * @param data pointer to the image
+ * @param size number of bytes in the image
+ * @param offs byte offset
+ * @param phase number of bits to skip
+ * @return the realigned byte; bits past the end are zero
+ */
+quint8 CasBitAlign::byte_at(const uchar* data, qint64 size, qint64 offs, int phase)
+{
+    if (offs < 0 || offs >= size)
+	return 0;
+    const quint32 hi = data[offs];
+    const quint32 lo = offs + 1 < size ? data[offs + 1] : 0;
+    return static_cast<quint8>(((hi << 8) | lo) >> (8 - phase));
+}
+
+/**
+ * @brief Count the BASIC lines at @p offs with matching links
+ *
+ * BASIC lines have no checksum. Every line must end with a NUL and
+ * have a line number of at most 65529. The link of the first line
+ * gives the address of the second; from then on each line counts if
+ * its link is its own address plus its length. A single line is thus
+ * no evidence. At most g_basic_lines lines are verified.
+ *
+ * @param data pointer to the image
+ * @param size number of bytes in the image
+ * @param offs byte offset of the link of the first line
+ * @param phase number of bits to skip
+ * @return number of lines with matching links
+ */
+int CasBitAlign::basic_lines(const uchar* data, qint64 size, qint64 offs, int phase)
+{
+    int result = 0;
+    quint16 addr = 0;
+    for (int i = 0; i <= g_basic_lines && offs + 4 < size; i++) {
+	const quint16 link = static_cast<quint16>(byte_at(data, size, offs, phase) +
+						  256 * byte_at(data, size, offs + 1, phase));
+	const quint16 line = static_cast<quint16>(byte_at(data, size, offs + 2, phase) +
+						  256 * byte_at(data, size, offs + 3, phase));
+	if (!link || line > 65529)
+	    break;
+	qint64 end = offs + 4;
+	while (end < size && end < offs + 1023 && byte_at(data, size, end, phase))
+	    end++;
+	if (end >= size || byte_at(data, size, end, phase))
+	    break;
+	const qint64 len = end + 1 - offs;
+	if (i > 0) {
+	    if (static_cast<quint16>(addr + len) != link)
+		break;
+	    result++;
+	}
+	addr = link;
+	offs = end + 1;
+    }
+    return result;
+}
+
+/**
+ * @brief Score a sync byte candidate
+ *
+ * The byte in front of the sync must belong to the lead-in, unless
+ * the sync is at the very start of the image. A SYSTEM header scores
+ * 1 plus the number of following blocks with valid checksums, up to
+ * and including the entry block. A BASIC header scores 1 plus the
+ * number of lines with matching links after it, since the header
+ * alone is no evidence: the Colour Genie has none, and D3 D3 D3 can
+ * be anything.
+ *
+ * @return score, or 0 if this is no sync
+ */
+int CasBitAlign::score(const uchar* data, qint64 size, qint64 offs, int phase, quint8 sync)
+{
+    if (offs > 0 || phase > 0) {
+	const quint8 fill = byte_at(data, size, offs - 1, phase);
+	if (fill != CAS_SILENCE && (sync == CAS_TRS80_SYNC || fill != CAS_CGENIE_PRELUDE))
+	    return 0;
+    }
+
+    quint8 hdr[8];
+    for (int i = 0; i < 8; i++)
+	hdr[i] = byte_at(data, size, offs + 1 + i, phase);
+
+    // The lines follow the 3 header bytes and the name, or just the name
+    if (hdr[0] == CAS_TRS80_BASIC_HEADER &&
+	hdr[1] == CAS_TRS80_BASIC_HEADER &&
+	hdr[2] == CAS_TRS80_BASIC_HEADER)
+	return 1 + basic_lines(data, size, offs + 5, phase);
+
+    if (hdr[0] != CAS_SYSTEM_HEADER || hdr[7] != CAS_SYSTEM_DATA)
+	return sync == CAS_CGENIE_SYNC ? 1 + basic_lines(data, size, offs + 2, phase) : 0;
+
+    int result = 1;
+    qint64 pos = offs + 8;
+    while (pos < size) {
+	const quint8 type = byte_at(data, size, pos, phase);
+	if (type == CAS_SYSTEM_ENTRY)
+	    return result + 1;
+	if (type != CAS_SYSTEM_DATA)
+	    break;
+	const int count = byte_at(data, size, pos + 1, phase);
+	const int len = count ? count : 256;
+	if (pos + 4 + len >= size)
+	    break;
+	quint8 csum = static_cast<quint8>(byte_at(data, size, pos + 2, phase) +
+					  byte_at(data, size, pos + 3, phase));
+	for (int i = 0; i < len; i++)
+	    csum = static_cast<quint8>(csum + byte_at(data, size, pos + 4 + i, phase));
+	if (csum != byte_at(data, size, pos + 4 + len, phase))
+	    break;
+	result++;
+	pos += 5 + len;
+    }
+    return result;
+}
+
+/**
+ * @brief Find the bit phase and offset of the sync byte
+ *
+ * The first sync byte at phase 0, the one the handler decodes from,
+ * is checked first: if its header is verified by valid checksums or
+ * matching BASIC line links, the image is aligned and the search over all
+ * phases is skipped. Otherwise a verified header at phase 0 is still
+ * preferred, even if another phase scores higher, so aligned images
+ * decode unchanged. Failing that the candidate with the highest score
+ * at the other phases wins, if it has at least a verified header.
+ *
+ * @param data pointer to the image
+ * @param size number of bytes in the image
+ * @return CasBitSync with phase -1 if no sync was found
+ */
+CasBitSync CasBitAlign::find(const uchar* data, qint64 size)
+{
+    const quint64 trs80 = splat(CAS_TRS80_SYNC);
+    const quint64 cgenie = splat(CAS_CGENIE_SYNC);
+    CasBitSync best[8];
+
+    const CasLeadInList leadins = CasScanner::scan(data, size, 0, 1);
+    if (!leadins.isEmpty()) {
+	const CasLeadIn& lead = leadins.first();
+	best[0].score = score(data, size, lead.sync, 0, lead.sync_byte);
+	if (best[0].score > 1) {
+	    best[0].phase = 0;
+	    best[0].offs = lead.sync;
+	    best[0].sync_byte = lead.sync_byte;
+	    return best[0];
+	}
+	best[0].score = 0;
+    }
+
+    quint64 w1 = load_be64(data, size, 0);
+    for (qint64 i = 0; i < size; i += 8) {
+	const quint64 w0 = w1;
+	w1 = load_be64(data, size, i + 8);
+	for (int phase = 0; phase < 8; phase++) {
+	    // The 8 bytes starting at i, realigned to this phase
+	    const quint64 w = phase ? (w0 << phase) | (w1 >> (64 - phase)) : w0;
+	    quint64 mask = zero_bytes(w ^ trs80) | zero_bytes(w ^ cgenie);
+	    while (mask) {
+		const int bit = qCountLeadingZeroBits(mask);
+		mask &= ~(Q_UINT64_C(0x8000000000000000) >> bit);
+		const qint64 offs = i + bit / 8;
+		if (offs >= size)
+		    break;
+		const quint8 sync = static_cast<quint8>(w >> (56 - 8 * (bit / 8)));
+		const int s = score(data, size, offs, phase, sync);
+		if (s > best[phase].score) {
+		    best[phase].phase = phase;
+		    best[phase].offs = offs;
+		    best[phase].sync_byte = sync;
+		    best[phase].score = s;
+		}
+	    }
+	}
+    }
+
+    if (best[0].score > 1)
+	return best[0];
+    CasBitSync res = best[0];
+    for (int phase = 1; phase < 8; phase++)
+	if (best[phase].score > qMax(1, res.score))
+	    res = best[phase];
+    return res;
+}
+
+/**
+ * @brief Return the image realigned to the bit phase of @p sync
+ *
+ * The result starts with the canonical lead-in and sync for the
+ * machine, followed by the bytes after the sync. They are shifted
+ * 8 at a time; the last partial byte is dropped.
+ *
+ * @param data pointer to the image
+ * @param size number of bytes in the image
+ * @param sync const reference to the sync found by find()
+ * @return QByteArray with the realigned image
+ */
+QByteArray CasBitAlign::realign(const uchar* data, qint64 size, const CasBitSync& sync)
+{
+    QByteArray res;
+    if (sync.phase < 0)
+	return res;
+
+    if (sync.sync_byte == CAS_TRS80_SYNC)
+	res = QByteArray(256, CAS_SILENCE);
+    res += static_cast<char>(sync.sync_byte);
+
+    const qint64 first = sync.offs + 1;
+    const qint64 count = sync.phase ? size - first - 1 : size - first;
+    if (count <= 0)
+	return res;
+    const int lead = res.size();
+    res.resize(lead + static_cast<int>(count));
+    uchar* dst = reinterpret_cast<uchar *>(res.data()) + lead;
+
+    const int phase = sync.phase;
+    qint64 i = 0;
+    for (; i + 8 <= count && first + i + 16 <= size; i += 8) {
+	const quint64 w0 = qFromBigEndian<quint64>(data + first + i);
+	const quint64 w1 = qFromBigEndian<quint64>(data + first + i + 8);
+	const quint64 w = phase ? (w0 << phase) | (w1 >> (64 - phase)) : w0;
+	qToBigEndian<quint64>(w, dst + i);
+    }
+    for (; i < count; i++)
+	dst[i] = byte_at(data, size, first + i, phase);
+    return res;
+}
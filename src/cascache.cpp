@@ -0,0 +1,248 @@
+/****************************************************************************
+ *
+ * Cass80 tool - persistent cache of decoded images
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <cstring>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QtEndian>
+#include "cascache.h"
+#include "cass80handler.h"
+
+static const char g_magic[8] = {'C', 'A', 'S', '8', '0', 'C', 'C', 'H'};
+static const quint32 g_version = 5;
+
+enum {
+    KEY_PATH	= 0,		//!< quint64 hash of the canonical path
+    KEY_SIZE	= 8,		//!< qint64 size of the file
+    KEY_MTIME	= 16,		//!< qint64 modification time in ms since the epoch
+    KEY_CRC32	= 24,		//!< quint32 CRC32 of the file
+    KEY_LENGTH	= 28,		//!< quint32 length of the record after the key
+    KEY_SHA1	= 32,		//!< 20 bytes SHA1 of the file
+    KEY_SIZEOF	= 56		//!< size of the key including 4 reserved bytes
+};
+
+static QDataStream& setup(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_5_6);
+    return stream;
+}
+
+CasCache::CasCache(const QString& filename)
+    : m_records(g_magic, g_version, KEY_SIZEOF, KEY_LENGTH, KEY_SIZEOF, "cache")
+    , m_mutex()
+{
+    if (!filename.isEmpty())
+	open(filename);
+}
+
+CasCache::~CasCache()
+{
+    close();
+}
+
+/**
+ * @brief Return the cache file shared by the GUI and the command line tool
+ * @return path name of the cache file
+ */
+QString CasCache::default_filename()
+{
+    return QString("%1/cass80/cass80.cache")
+	    .arg(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation));
+}
+
+QString CasCache::filename() const
+{
+    return m_records.filename();
+}
+
+/**
+ * @brief Return the number of images in the cache
+ */
+int CasCache::count() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_records.count();
+}
+
+/**
+ * @brief Open the cache file @p filename, creating it if necessary
+ *
+ * A file with a different magic or version is started over.
+ *
+ * @param filename path name of the cache file
+ * @return true on success, or false if the file cannot be opened
+ */
+bool CasCache::open(const QString& filename)
+{
+    return m_records.open(filename);
+}
+
+/**
+ * @brief Restore the image @p path into @p cas, if it is cached
+ *
+ * The file is only looked at with stat(); it is neither read nor
+ * decoded. If @p listing is given, it receives the cached listing if
+ * one was stored with the same @p variant, or is cleared otherwise.
+ *
+ * @param path path name of the cassette image
+ * @param cas pointer to the Cass80Handler to restore
+ * @param listing optional pointer to a QStringList for the listing
+ * @param variant variant of the listing
+ * @return true on a hit, or false on a miss
+ */
+bool CasCache::lookup(const QString& path, Cass80Handler* cas, QStringList* listing, const QByteArray& variant) const
+{
+    const QFileInfo info(path);
+    if (filename().isEmpty() || !info.isFile())
+	return false;
+    const QString canonical = info.canonicalFilePath();
+
+    QByteArray rec;
+    {
+	QMutexLocker lock(&m_mutex);
+	auto it = m_records.index().constFind(path_key(canonical));
+	if (it == m_records.index().constEnd())
+	    return false;
+	rec = m_records.record(it.value());
+    }
+
+    const uchar* key = reinterpret_cast<const uchar *>(rec.constData());
+    if (qFromLittleEndian<qint64>(key + KEY_SIZE) != info.size() ||
+	qFromLittleEndian<qint64>(key + KEY_MTIME) != info.lastModified().toMSecsSinceEpoch())
+	return false;
+
+    QByteArray body = QByteArray::fromRawData(rec.constData() + KEY_SIZEOF, rec.size() - KEY_SIZEOF);
+    QDataStream stream(body);
+    setup(stream);
+    QString name;
+    stream >> name;
+    if (name != canonical || !cas->restore(stream))
+	return false;
+
+    const CasDigests& digests = cas->digests();
+    if (digests.crc32 != qFromLittleEndian<quint32>(key + KEY_CRC32) ||
+	digests.sha1 != QByteArray::fromRawData(rec.constData() + KEY_SHA1, 20))
+	return false;
+
+    if (listing) {
+	bool has_listing = false;
+	QByteArray cached_variant;
+	listing->clear();
+	stream >> has_listing;
+	if (has_listing) {
+	    stream >> cached_variant;
+	    if (cached_variant == variant)
+		stream >> *listing;
+	}
+	if (stream.status() != QDataStream::Ok)
+	    listing->clear();
+    }
+    return true;
+}
+
+/**
+ * @brief Add the image @p path decoded into @p cas to the cache
+ *
+ * The record is kept in memory until flush() appends it to the file.
+ *
+ * @param path path name of the cassette image
+ * @param cas pointer to the Cass80Handler with the decoded image
+ * @param listing rendered listing, or an empty list for none
+ * @param variant variant of the listing
+ */
+void CasCache::insert(const QString& path, const Cass80Handler* cas, const QStringList& listing, const QByteArray& variant)
+{
+    const QFileInfo info(path);
+    if (filename().isEmpty() || !info.isFile())
+	return;
+    const QString canonical = info.canonicalFilePath();
+    const CasDigests& digests = cas->digests();
+
+    QByteArray rec(KEY_SIZEOF, '\0');
+    {
+	QDataStream stream(&rec, QIODevice::WriteOnly | QIODevice::Append);
+	setup(stream);
+	stream << canonical;
+	cas->store(stream);
+	stream << !listing.isEmpty();
+	if (!listing.isEmpty())
+	    stream << variant << listing;
+    }
+
+    const quint64 key = path_key(canonical);
+    uchar* p = reinterpret_cast<uchar *>(rec.data());
+    qToLittleEndian<quint64>(key, p + KEY_PATH);
+    qToLittleEndian<qint64>(info.size(), p + KEY_SIZE);
+    qToLittleEndian<qint64>(info.lastModified().toMSecsSinceEpoch(), p + KEY_MTIME);
+    qToLittleEndian<quint32>(digests.crc32, p + KEY_CRC32);
+    qToLittleEndian<quint32>(static_cast<quint32>(rec.size() - KEY_SIZEOF), p + KEY_LENGTH);
+    memcpy(p + KEY_SHA1, digests.sha1.constData(), static_cast<size_t>(qMin(digests.sha1.size(), 20)));
+
+    QMutexLocker lock(&m_mutex);
+    m_records.append(rec);
+}
+
+/**
+ * @brief Append the records inserted since the last call to the file
+ *
+ * The file is locked against other processes, see CasRecordFile.
+ * This must not run concurrently with lookup() or insert().
+ *
+ * @return true on success, or false on error
+ */
+bool CasCache::flush()
+{
+    return m_records.flush();
+}
+
+/**
+ * @brief Flush and close the cache file
+ */
+void CasCache::close()
+{
+    m_records.close();
+}
+
+/**
+ * @brief Hash the canonical path name of an image to its key
+ * @param path canonical path name
+ * @return the first 64 bits of the SHA1 of the path
+ */
+quint64 CasCache::path_key(const QString& path)
+{
+    const QByteArray sha1 = QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Sha1);
+    return qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(sha1.constData()));
+}
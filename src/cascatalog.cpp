@@ -0,0 +1,417 @@
+/****************************************************************************
+ *
+ * Cass80 tool - deduplicating archive catalog
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <cstring>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSet>
+#include <QtEndian>
+#include "cascatalog.h"
+#include "cass80handler.h"
+
+static const char g_magic[8] = {'C', 'A', 'S', '8', '0', 'C', 'A', 'T'};
+static const quint32 g_version = 1;
+
+enum {
+    REC_PATH	= 0,		//!< quint64 hash of the canonical path
+    REC_SIZE	= 8,		//!< qint64 size of the file
+    REC_MTIME	= 16,		//!< qint64 modification time in ms since the epoch, or 0
+    REC_LENGTH	= 24,		//!< quint32 length of the record
+    REC_BLOCKS	= 28,		//!< quint32 number of blocks
+    REC_SHA1	= 32,		//!< 20 bytes SHA1 of the file
+    REC_PAYLOAD	= 52,		//!< 20 bytes SHA1 of the payload
+    REC_NAME	= 72,		//!< quint32 length of the UTF-8 path name
+    REC_SIZEOF	= 80,		//!< size of the record head including 4 reserved bytes
+    BLK_SHA1	= 0,		//!< 20 bytes SHA1 of the block payload, zero for none
+    BLK_ADDR	= 20,		//!< quint16 load address of the block
+    BLK_TYPE	= 22,		//!< quint8 type of the block
+    BLK_SIZEOF	= 24		//!< size of a block entry including 1 reserved byte
+};
+
+/**
+ * @brief Return the hash key of a 20 byte SHA1 at @p sha1, or 0 for none
+ * The digests are uniformly distributed, so their first 64 bits will do.
+ */
+static inline quint64 sha1_key(const uchar* sha1)
+{
+    return qFromLittleEndian<quint64>(sha1);
+}
+
+static inline bool is_sha1(const QByteArray& sha1)
+{
+    return sha1.size() == 20;
+}
+
+CasCatalog::CasCatalog(const QString& filename)
+    : m_records(g_magic, g_version, REC_SIZEOF, REC_LENGTH, 0, "catalog")
+    , m_files()
+    , m_payloads()
+    , m_blocks()
+    , m_mutex()
+{
+    if (!filename.isEmpty())
+	open(filename);
+}
+
+CasCatalog::~CasCatalog()
+{
+    close();
+}
+
+QString CasCatalog::filename() const
+{
+    return m_records.filename();
+}
+
+/**
+ * @brief Return the number of images in the catalog
+ */
+int CasCatalog::count() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_records.count();
+}
+
+/**
+ * @brief Open the catalog file @p filename, creating it if necessary
+ *
+ * A file with a different magic or version is started over.
+ *
+ * @param filename path name of the catalog file
+ * @return true on success, or false if the file cannot be opened
+ */
+bool CasCatalog::open(const QString& filename)
+{
+    const bool ok = m_records.open(filename);
+    reindex();
+    return ok;
+}
+
+/**
+ * @brief Add the image @p path decoded into @p cas to the catalog
+ *
+ * Images which are not files of their own, e.g. members of an archive,
+ * are recorded without a modification time and are only compared by
+ * their size and SHA1. The record is kept in memory until flush()
+ * appends it to the file.
+ *
+ * @param path path name of the cassette image
+ * @param cas pointer to the Cass80Handler with the decoded image
+ * @return true if the image was added or changed, false if it is unchanged
+ */
+bool CasCatalog::add(const QString& path, const Cass80Handler* cas)
+{
+    const QFileInfo info(path);
+    if (filename().isEmpty())
+	return false;
+    const QString canonical = CasCatalog::canonical(path);
+    const QByteArray name = canonical.toUtf8();
+    const CasDigests& digests = cas->digests();
+    const CasBlockList& list = cas->blocks();
+    const bool has_blocks = digests.has_blocks(list.count());
+    const qint64 size = info.isFile() ? info.size() : digests.size;
+    const qint64 mtime = info.isFile() ? info.lastModified().toMSecsSinceEpoch() : 0;
+
+    const int blocks = list.count();
+    const int length = (REC_SIZEOF + blocks * BLK_SIZEOF + name.size() + 7) & ~7;
+    QByteArray rec(length, '\0');
+    uchar* p = reinterpret_cast<uchar *>(rec.data());
+    const quint64 key = path_key(canonical);
+    qToLittleEndian<quint64>(key, p + REC_PATH);
+    qToLittleEndian<qint64>(size, p + REC_SIZE);
+    qToLittleEndian<qint64>(mtime, p + REC_MTIME);
+    qToLittleEndian<quint32>(static_cast<quint32>(length), p + REC_LENGTH);
+    qToLittleEndian<quint32>(static_cast<quint32>(blocks), p + REC_BLOCKS);
+    if (is_sha1(digests.sha1))
+	memcpy(p + REC_SHA1, digests.sha1.constData(), 20);
+    if (is_sha1(digests.payload))
+	memcpy(p + REC_PAYLOAD, digests.payload.constData(), 20);
+    qToLittleEndian<quint32>(static_cast<quint32>(name.size()), p + REC_NAME);
+    for (int i = 0; i < blocks; i++) {
+	uchar* b = p + REC_SIZEOF + i * BLK_SIZEOF;
+	if (has_blocks && is_sha1(digests.blocks[i]))
+	    memcpy(b + BLK_SHA1, digests.blocks[i].constData(), 20);
+	qToLittleEndian<quint16>(list[i].addr, b + BLK_ADDR);
+	b[BLK_TYPE] = static_cast<uchar>(list[i].type);
+    }
+    memcpy(p + REC_SIZEOF + blocks * BLK_SIZEOF, name.constData(), static_cast<size_t>(name.size()));
+
+    QMutexLocker lock(&m_mutex);
+    auto it = m_records.index().constFind(key);
+    if (it != m_records.index().constEnd()) {
+	const CasRecordFile::Entry old = it.value();
+	const uchar* o = record(old.offs);
+	// Compare everything but the record length, which is the same for the same blocks
+	if (old.size == length &&
+	    0 == memcmp(o, p, REC_LENGTH) &&
+	    0 == memcmp(o + REC_BLOCKS, p + REC_BLOCKS, static_cast<size_t>(length - REC_BLOCKS)))
+	    return false;
+	index(old.offs, false);
+    }
+    index(m_records.append(rec), true);
+    return true;
+}
+
+/**
+ * @brief Return where else the image @p path, its payload, or its blocks occur
+ *
+ * Images which are byte identical are reported as MATCH_FILE, those
+ * which differ only in the lead-in as MATCH_PAYLOAD. For the other
+ * images every block shared with @p path is reported as MATCH_BLOCK.
+ *
+ * @param path path name of an image in the catalog
+ * @return list of hits, empty if there are none or @p path is not cataloged
+ */
+QVector<CasCatalog::Hit> CasCatalog::where(const QString& path) const
+{
+    QVector<Hit> hits;
+    QMutexLocker lock(&m_mutex);
+    auto it = m_records.index().constFind(path_key(canonical(path)));
+    if (it == m_records.index().constEnd())
+	return hits;
+    const qint64 self = it.value().offs;
+    const uchar* p = record(self);
+
+    QSet<qint64> seen;
+    seen.insert(self);
+    const struct {
+	const RefHash* hash;
+	int digest;
+	Match match;
+    } whole[2] = {
+	{&m_files, REC_SHA1, MATCH_FILE},
+	{&m_payloads, REC_PAYLOAD, MATCH_PAYLOAD}
+    };
+    for (const auto& w : whole) {
+	const uchar* sha1 = p + w.digest;
+	const quint64 key = sha1_key(sha1);
+	if (!key)
+	    continue;
+	for (auto ref = w.hash->constFind(key); ref != w.hash->constEnd() && ref.key() == key; ++ref) {
+	    const qint64 offs = ref.value().offs;
+	    if (seen.contains(offs) || memcmp(record(offs) + w.digest, sha1, 20))
+		continue;
+	    seen.insert(offs);
+	    hits += Hit{name(offs), w.match, -1, -1, 0};
+	}
+    }
+
+    const int blocks = static_cast<int>(qFromLittleEndian<quint32>(p + REC_BLOCKS));
+    for (int i = 0; i < blocks; i++) {
+	const uchar* sha1 = p + REC_SIZEOF + i * BLK_SIZEOF + BLK_SHA1;
+	const quint64 key = sha1_key(sha1);
+	if (!key)
+	    continue;
+	for (auto ref = m_blocks.constFind(key); ref != m_blocks.constEnd() && ref.key() == key; ++ref) {
+	    const Ref& r = ref.value();
+	    if (seen.contains(r.offs))
+		continue;
+	    const uchar* b = record(r.offs) + REC_SIZEOF + r.block * BLK_SIZEOF;
+	    if (memcmp(b + BLK_SHA1, sha1, 20))
+		continue;
+	    hits += Hit{name(r.offs), MATCH_BLOCK, i, r.block, qFromLittleEndian<quint16>(b + BLK_ADDR)};
+	}
+    }
+    return hits;
+}
+
+/**
+ * @brief Return the images whose file SHA1 is @p sha1
+ * @param sha1 20 bytes SHA1
+ * @return list of path names
+ */
+QStringList CasCatalog::files(const QByteArray& sha1) const
+{
+    QMutexLocker lock(&m_mutex);
+    return matches(m_files, sha1, REC_SHA1);
+}
+
+/**
+ * @brief Return the images whose payload SHA1 is @p sha1
+ * @param sha1 20 bytes SHA1
+ * @return list of path names
+ */
+QStringList CasCatalog::payloads(const QByteArray& sha1) const
+{
+    QMutexLocker lock(&m_mutex);
+    return matches(m_payloads, sha1, REC_PAYLOAD);
+}
+
+/**
+ * @brief Return the blocks whose payload SHA1 is @p sha1
+ * @param sha1 20 bytes SHA1
+ * @return list of hits with the image, block index, and load address
+ */
+QVector<CasCatalog::Hit> CasCatalog::blocks(const QByteArray& sha1) const
+{
+    QVector<Hit> hits;
+    if (!is_sha1(sha1))
+	return hits;
+    const uchar* digest = reinterpret_cast<const uchar *>(sha1.constData());
+    const quint64 key = sha1_key(digest);
+    QMutexLocker lock(&m_mutex);
+    for (auto ref = m_blocks.constFind(key); ref != m_blocks.constEnd() && ref.key() == key; ++ref) {
+	const Ref& r = ref.value();
+	const uchar* b = record(r.offs) + REC_SIZEOF + r.block * BLK_SIZEOF;
+	if (memcmp(b + BLK_SHA1, digest, 20))
+	    continue;
+	hits += Hit{name(r.offs), MATCH_BLOCK, -1, r.block, qFromLittleEndian<quint16>(b + BLK_ADDR)};
+    }
+    return hits;
+}
+
+/**
+ * @brief Append the records added since the last call to the file
+ *
+ * The file is locked against other processes, see CasRecordFile.
+ * Since the records move, the hashes are built anew.
+ * This must not run concurrently with add() or the queries.
+ *
+ * @return true on success, or false on error
+ */
+bool CasCatalog::flush()
+{
+    const bool ok = m_records.flush();
+    reindex();
+    return ok;
+}
+
+/**
+ * @brief Flush and close the catalog file
+ */
+void CasCatalog::close()
+{
+    m_records.close();
+    reindex();
+}
+
+/**
+ * @brief Return the name an image is cataloged under
+ * Files are known by their canonical path, members of archives by
+ * their absolute path.
+ */
+QString CasCatalog::canonical(const QString& path)
+{
+    const QFileInfo info(path);
+    return info.isFile() ? info.canonicalFilePath() : info.absoluteFilePath();
+}
+
+/**
+ * @brief Hash the canonical path name of an image to its key
+ * @param path canonical path name
+ * @return the first 64 bits of the SHA1 of the path
+ */
+quint64 CasCatalog::path_key(const QString& path)
+{
+    const QByteArray sha1 = QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Sha1);
+    return qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(sha1.constData()));
+}
+
+/**
+ * @brief Return a pointer to the record at @p offs
+ * Mapped records are returned without copying them.
+ */
+const uchar* CasCatalog::record(qint64 offs) const
+{
+    return m_records.data(offs);
+}
+
+/**
+ * @brief Return the path name of the record at @p offs
+ */
+QString CasCatalog::name(qint64 offs) const
+{
+    const uchar* p = record(offs);
+    const int blocks = static_cast<int>(qFromLittleEndian<quint32>(p + REC_BLOCKS));
+    const int length = static_cast<int>(qFromLittleEndian<quint32>(p + REC_NAME));
+    return QString::fromUtf8(reinterpret_cast<const char *>(p + REC_SIZEOF + blocks * BLK_SIZEOF), length);
+}
+
+/**
+ * @brief Build the hashes of the digests of all records anew
+ */
+void CasCatalog::reindex()
+{
+    m_files.clear();
+    m_payloads.clear();
+    m_blocks.clear();
+    foreach(const CasRecordFile::Entry& entry, m_records.index())
+	index(entry.offs, true);
+}
+
+/**
+ * @brief Insert the digests of the record at @p offs into the hashes, or remove them
+ * @param offs offset of the record
+ * @param insert true to insert, false to remove
+ */
+void CasCatalog::index(qint64 offs, bool insert)
+{
+    const uchar* p = record(offs);
+    const auto update = [offs, insert](RefHash& hash, const uchar* sha1, int block) {
+	const quint64 key = sha1_key(sha1);
+	if (!key)
+	    return;
+	if (insert)
+	    hash.insert(key, Ref{offs, block});
+	else
+	    hash.remove(key, Ref{offs, block});
+    };
+    update(m_files, p + REC_SHA1, -1);
+    update(m_payloads, p + REC_PAYLOAD, -1);
+    const int blocks = static_cast<int>(qFromLittleEndian<quint32>(p + REC_BLOCKS));
+    for (int i = 0; i < blocks; i++)
+	update(m_blocks, p + REC_SIZEOF + i * BLK_SIZEOF + BLK_SHA1, i);
+}
+
+/**
+ * @brief Return the path names of the records in @p hash with the SHA1 @p sha1
+ * @param hash one of m_files or m_payloads
+ * @param sha1 20 bytes SHA1
+ * @param digest offset of the digest in the record
+ * @return list of path names
+ */
+QStringList CasCatalog::matches(const RefHash& hash, const QByteArray& sha1, int digest) const
+{
+    QStringList names;
+    if (!is_sha1(sha1))
+	return names;
+    const uchar* p = reinterpret_cast<const uchar *>(sha1.constData());
+    const quint64 key = sha1_key(p);
+    for (auto ref = hash.constFind(key); ref != hash.constEnd() && ref.key() == key; ++ref) {
+	const qint64 offs = ref.value().offs;
+	if (0 == memcmp(record(offs) + digest, p, 20))
+	    names += name(offs);
+    }
+    return names;
+}
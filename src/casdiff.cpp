@@ -0,0 +1,518 @@
+/****************************************************************************
+ *
+ * Cass80 tool - block level diff and patch
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <QDataStream>
+#include <QHash>
+#include "casdiff.h"
+#include "cass80handler.h"
+#include "cass80xml.h"
+
+static const char g_magic[8] = {'C', 'A', 'S', '8', '0', 'P', 'A', 'T'};
+static const quint32 g_version = 1;
+
+//! Equal bytes between two differences which still join them into one edit
+static const int g_merge_gap = 4;
+//! Width of the rolling hash window
+static const int g_window = 16;
+//! Prime multiplier of the rolling hash
+static const quint32 g_prime = 0x01000193u;
+//! Edits and bytes listed per block by report()
+static const int g_report_edits = 8;
+static const int g_report_bytes = 16;
+
+/** @brief Operations of a patch, one per block of the variant */
+enum {
+    OP_COPY,		//!< payload of a base block
+    OP_EDIT,		//!< payload of a base block with edits
+    OP_DATA		//!< payload included in the patch
+};
+
+static QDataStream& setup(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_5_6);
+    return stream;
+}
+
+/**
+ * @brief Call @p anchor with every content defined window hash of @p data
+ *
+ * The hash of each window of g_window bytes is rolled along the data,
+ * and about every 8th window, chosen by its hash, is an anchor. Since
+ * the choice depends only on the bytes, the same content yields the
+ * same anchors wherever it is in a block.
+ */
+template <typename F>
+static void anchors(const QByteArray& data, F anchor)
+{
+    if (data.size() < g_window)
+	return;
+    const uchar* p = reinterpret_cast<const uchar *>(data.constData());
+    quint32 out = 1;
+    for (int i = 0; i < g_window; i++)
+	out *= g_prime;
+    quint32 h = 0;
+    for (int i = 0; i < data.size(); i++) {
+	h = h * g_prime + p[i];
+	if (i >= g_window)
+	    h -= out * p[i - g_window];
+	if (i >= g_window - 1 && 0 == (h & 7))
+	    anchor(h);
+    }
+}
+
+static inline quint64 addr_key(const Cass80Block& b)
+{
+    return (static_cast<quint64>(static_cast<quint32>(b.type)) << 32) |
+	    (static_cast<quint64>(b.addr) << 16) | b.line;
+}
+
+static QString hex(const QByteArray& bytes)
+{
+    if (bytes.isEmpty())
+	return QStringLiteral("-");
+    QStringList list;
+    for (int i = 0; i < bytes.size() && i < g_report_bytes; i++)
+	list += QString("%1").arg(static_cast<uchar>(bytes[i]), 2, 16, QChar('0'));
+    if (bytes.size() > g_report_bytes)
+	list += QLatin1String("...");
+    return list.join(QChar(' '));
+}
+
+CasDiff::CasDiff(const Cass80Handler* base, const Cass80Handler* variant)
+    : m_base(base)
+    , m_variant(variant)
+    , m_entries()
+{
+    align();
+}
+
+/**
+ * @brief Return the blocks of the variant in order, followed by the removed blocks of the base
+ */
+const QVector<CasDiff::Entry>& CasDiff::entries() const
+{
+    return m_entries;
+}
+
+/**
+ * @brief Return the number of entries which are not SAME
+ */
+int CasDiff::differences() const
+{
+    int count = 0;
+    foreach(const Entry& e, m_entries)
+	count += e.kind != SAME;
+    return count;
+}
+
+/**
+ * @brief Return the differences as text, one line per block and edit
+ */
+QStringList CasDiff::report() const
+{
+    const CasBlockList& a = m_base->blocks();
+    const CasBlockList& b = m_variant->blocks();
+    QStringList lines;
+    foreach(const Entry& e, m_entries) {
+	switch (e.kind) {
+	case SAME:
+	    break;
+	case MOVED:
+	    lines += QString("block %1 %2: moved from block %3 %4")
+		     .arg(e.b).arg(describe(b[e.b]))
+		     .arg(e.a).arg(describe(a[e.a]));
+	    break;
+	case CHANGED:
+	    {
+		int bytes = 0;
+		foreach(const Edit& edit, e.edits)
+		    bytes += qMax(edit.from.size(), edit.to.size());
+		lines += QString("block %1 %2: %3 byte(s) differ from block %4 %5")
+			 .arg(e.b).arg(describe(b[e.b])).arg(bytes)
+			 .arg(e.a).arg(describe(a[e.a]));
+		for (int i = 0; i < e.edits.count() && i < g_report_edits; i++)
+		    lines += QString("    +%1: %2 -> %3")
+			     .arg(e.edits[i].offs, 4, 16, QChar('0'))
+			     .arg(hex(e.edits[i].from))
+			     .arg(hex(e.edits[i].to));
+		if (e.edits.count() > g_report_edits)
+		    lines += QString("    ... %1 more edit(s)").arg(e.edits.count() - g_report_edits);
+	    }
+	    break;
+	case ADDED:
+	    lines += QString("block %1 %2: added").arg(e.b).arg(describe(b[e.b]));
+	    break;
+	case REMOVED:
+	    lines += QString("base block %1 %2: removed").arg(e.a).arg(describe(a[e.a]));
+	    break;
+	}
+    }
+    return lines;
+}
+
+/**
+ * @brief Return the patch which turns the base into the variant
+ *
+ * The patch holds the header of the variant, the SHA1 of the block
+ * payloads of both images, and per block of the variant its header and
+ * either the index of the base block, the index and the edits, or the
+ * payload itself for added blocks.
+ *
+ * @return the patch
+ */
+QByteArray CasDiff::patch() const
+{
+    const CasBlockList& b = m_variant->blocks();
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    setup(stream);
+    stream.writeRawData(g_magic, sizeof(g_magic));
+    stream << g_version;
+    stream << m_base->digests().image << m_variant->digests().image;
+    stream << static_cast<qint32>(m_variant->machine()) << m_variant->basic();
+    stream << m_variant->hdr_name() << m_variant->hdr_author()
+	   << m_variant->hdr_copyright() << m_variant->hdr_description();
+    stream << m_variant->sync() << m_variant->prefix() << m_variant->filename();
+    stream << static_cast<quint32>(b.count());
+    foreach(const Entry& e, m_entries) {
+	if (e.b < 0)
+	    continue;
+	const Cass80Block& blk = b[e.b];
+	const quint8 op = ADDED == e.kind ? OP_DATA : CHANGED == e.kind ? OP_EDIT : OP_COPY;
+	stream << op << static_cast<qint8>(blk.type) << blk.csum << blk.addr << blk.size << blk.line;
+	switch (op) {
+	case OP_COPY:
+	    stream << static_cast<qint32>(e.a);
+	    break;
+	case OP_EDIT:
+	    stream << static_cast<qint32>(e.a) << static_cast<quint32>(e.edits.count());
+	    foreach(const Edit& edit, e.edits)
+		stream << static_cast<qint32>(edit.offs) << static_cast<qint32>(edit.from.size()) << edit.to;
+	    break;
+	case OP_DATA:
+	    stream << blk.data();
+	    break;
+	}
+    }
+    return data;
+}
+
+/**
+ * @brief Return true if @p data starts like a patch written by patch()
+ */
+bool CasDiff::is_patch(const QByteArray& data)
+{
+    return data.startsWith(QByteArray::fromRawData(g_magic, sizeof(g_magic)));
+}
+
+/**
+ * @brief Rebuild the variant from the image @p base and @p patch into @p result
+ * @param base pointer to the Cass80Handler with the base image
+ * @param patch the patch written by patch()
+ * @param result pointer to the Cass80Handler to receive the variant
+ * @param error optional pointer to a QString for the error message
+ * @return true on success, or false if the patch is invalid or for another base
+ */
+bool CasDiff::apply(const Cass80Handler* base, const QByteArray& patch, Cass80Handler* result, QString* error)
+{
+    const auto fail = [error](const QString& message) {
+	if (error)
+	    *error = message;
+	return false;
+    };
+    if (!is_patch(patch))
+	return fail(QStringLiteral("Not a cassette patch"));
+
+    QDataStream stream(patch);
+    setup(stream);
+    stream.skipRawData(sizeof(g_magic));
+    quint32 version;
+    QByteArray base_sha1, variant_sha1;
+    stream >> version;
+    if (version != g_version)
+	return fail(QString("Unsupported patch version %1").arg(version));
+    stream >> base_sha1 >> variant_sha1;
+    if (base_sha1 != base->digests().image)
+	return fail(QStringLiteral("The patch is for another base image"));
+
+    qint32 machine;
+    bool basic;
+    QString hdr_name, hdr_author, hdr_copyright, hdr_description, filename;
+    quint8 sync, prefix;
+    quint32 count;
+    stream >> machine >> basic;
+    stream >> hdr_name >> hdr_author >> hdr_copyright >> hdr_description;
+    stream >> sync >> prefix >> filename;
+    stream >> count;
+
+    const CasBlockList& a = base->blocks();
+    CasBlockList blocks;
+    QByteArray arena;
+    for (quint32 n = 0; n < count && stream.status() == QDataStream::Ok; n++) {
+	quint8 op;
+	qint8 type;
+	Cass80Block blk;
+	stream >> op >> type >> blk.csum >> blk.addr >> blk.size >> blk.line;
+	blk.type = static_cast<Cass80BlockType>(type);
+	blk.offs = arena.size();
+
+	if (OP_DATA == op) {
+	    QByteArray data;
+	    stream >> data;
+	    arena += data;
+	} else {
+	    qint32 index;
+	    stream >> index;
+	    if (index < 0 || index >= a.count())
+		return fail(QString("Block %1 refers to a missing base block").arg(n));
+	    const QByteArray from = a[index].data();
+	    if (OP_COPY == op) {
+		arena += from;
+	    } else {
+		quint32 edits;
+		stream >> edits;
+		int pos = 0;
+		for (quint32 i = 0; i < edits && stream.status() == QDataStream::Ok; i++) {
+		    qint32 offs, size;
+		    QByteArray to;
+		    stream >> offs >> size >> to;
+		    if (offs < pos || size < 0 || offs + size > from.size())
+			return fail(QString("Block %1 has an invalid edit").arg(n));
+		    arena += from.mid(pos, offs - pos);
+		    arena += to;
+		    pos = offs + size;
+		}
+		arena += from.mid(pos);
+	    }
+	}
+	blk.len = arena.size() - blk.offs;
+	blocks += blk;
+    }
+    if (stream.status() != QDataStream::Ok)
+	return fail(QStringLiteral("The patch is truncated"));
+
+    // All blocks share the finished arena
+    for (int i = 0; i < blocks.count(); i++)
+	blocks[i].arena = arena;
+
+    CasXml xml;
+    xml.set_machine(static_cast<Cass80Machine>(machine));
+    xml.set_basic(basic);
+    xml.set_hdr_name(hdr_name);
+    xml.set_hdr_author(hdr_author);
+    xml.set_hdr_copyright(hdr_copyright);
+    xml.set_hdr_description(hdr_description);
+    xml.set_sync(sync);
+    xml.set_prefix(prefix);
+    xml.set_filename(filename);
+    xml.set_blocks(blocks);
+    result->set_data(&xml);
+    if (result->digests().image != variant_sha1)
+	return fail(QStringLiteral("The patched image does not match its SHA1"));
+    return true;
+}
+
+/**
+ * @brief Pair the blocks of the variant with those of the base
+ */
+void CasDiff::align()
+{
+    const CasBlockList& a = m_base->blocks();
+    const CasBlockList& b = m_variant->blocks();
+    QVector<int> pair(b.count(), -1);
+    QVector<bool> used(a.count(), false);
+
+    // Same type and payload, preferring the same address
+    QHash<QByteArray, QVector<int> > by_data;
+    for (int i = 0; i < a.count(); i++)
+	by_data[a[i].data()] += i;
+    for (int j = 0; j < b.count(); j++) {
+	int found = -1;
+	foreach(int i, by_data.value(b[j].data())) {
+	    if (used[i] || a[i].type != b[j].type)
+		continue;
+	    if (found < 0 || a[i].addr == b[j].addr)
+		found = i;
+	    if (a[i].addr == b[j].addr)
+		break;
+	}
+	if (found >= 0) {
+	    pair[j] = found;
+	    used[found] = true;
+	}
+    }
+
+    // Same type, address, and line
+    QHash<quint64, QVector<int> > by_addr;
+    for (int i = 0; i < a.count(); i++)
+	if (!used[i])
+	    by_addr[addr_key(a[i])] += i;
+    for (int j = 0; j < b.count(); j++) {
+	if (pair[j] >= 0)
+	    continue;
+	foreach(int i, by_addr.value(addr_key(b[j]))) {
+	    if (!used[i]) {
+		pair[j] = i;
+		used[i] = true;
+		break;
+	    }
+	}
+    }
+
+    // Most shared anchors of the rolling hash; blocks without payload by type
+    QHash<quint32, QVector<int> > by_anchor;
+    for (int i = 0; i < a.count(); i++)
+	if (!used[i])
+	    anchors(a[i].data(), [&by_anchor, i](quint32 h) {
+		QVector<int>& list = by_anchor[h];
+		if (list.isEmpty() || list.last() != i)
+		    list += i;
+	    });
+    for (int j = 0; j < b.count(); j++) {
+	if (pair[j] >= 0)
+	    continue;
+	QHash<int, int> votes;
+	anchors(b[j].data(), [&](quint32 h) {
+	    foreach(int i, by_anchor.value(h))
+		if (!used[i] && a[i].type == b[j].type)
+		    votes[i]++;
+	});
+	int best = -1;
+	for (auto it = votes.constBegin(); it != votes.constEnd(); ++it)
+	    if (best < 0 || it.value() > votes.value(best) || (it.value() == votes.value(best) && it.key() < best))
+		best = it.key();
+	if (best < 0 && 0 == b[j].len) {
+	    for (int i = 0; i < a.count() && best < 0; i++)
+		if (!used[i] && 0 == a[i].len && a[i].type == b[j].type)
+		    best = i;
+	}
+	if (best >= 0) {
+	    pair[j] = best;
+	    used[best] = true;
+	}
+    }
+
+    m_entries.clear();
+    for (int j = 0; j < b.count(); j++) {
+	const int i = pair[j];
+	Entry e;
+	e.a = i;
+	e.b = j;
+	if (i < 0) {
+	    e.kind = ADDED;
+	} else if (a[i].data() != b[j].data()) {
+	    e.kind = CHANGED;
+	    e.edits = edits(a[i].data(), b[j].data());
+	} else if (i == j && a[i].addr == b[j].addr && a[i].size == b[j].size &&
+		   a[i].line == b[j].line && a[i].csum == b[j].csum) {
+	    e.kind = SAME;
+	} else {
+	    e.kind = MOVED;
+	}
+	m_entries += e;
+    }
+    for (int i = 0; i < a.count(); i++) {
+	if (used[i])
+	    continue;
+	Entry e;
+	e.kind = REMOVED;
+	e.a = i;
+	e.b = -1;
+	m_entries += e;
+    }
+}
+
+/**
+ * @brief Return the edits which turn @p from into @p to
+ *
+ * The common head and tail are skipped. If the lengths are equal, the
+ * rest is split into runs of differing bytes, joining runs which are
+ * less than g_merge_gap bytes apart. Otherwise the rest is replaced.
+ *
+ * @param from payload of the base block
+ * @param to payload of the variant block
+ * @return list of edits in ascending order of their offsets
+ */
+QVector<CasDiff::Edit> CasDiff::edits(const QByteArray& from, const QByteArray& to)
+{
+    QVector<Edit> list;
+    const int n = qMin(from.size(), to.size());
+    int head = 0;
+    while (head < n && from[head] == to[head])
+	head++;
+    int tail = 0;
+    while (tail < n - head && from[from.size() - 1 - tail] == to[to.size() - 1 - tail])
+	tail++;
+
+    if (from.size() != to.size()) {
+	list += Edit{head, from.mid(head, from.size() - tail - head), to.mid(head, to.size() - tail - head)};
+	return list;
+    }
+
+    const int end = from.size() - tail;
+    int i = head;
+    while (i < end) {
+	if (from[i] == to[i]) {
+	    i++;
+	    continue;
+	}
+	const int start = i;
+	int last = i;
+	while (i < end && i - last <= g_merge_gap) {
+	    if (from[i] != to[i])
+		last = i;
+	    i++;
+	}
+	list += Edit{start, from.mid(start, last + 1 - start), to.mid(start, last + 1 - start)};
+	i = last + 1;
+    }
+    return list;
+}
+
+/**
+ * @brief Return a short description of @p block for report()
+ */
+QString CasDiff::describe(const Cass80Block& block)
+{
+    switch (block.type) {
+    case BT_BASIC:
+	return QString("(BASIC line %1)").arg(block.line);
+    case BT_SYSTEM:
+	return QString("(SYSTEM %1h, %2 bytes)")
+		.arg(block.addr, 4, 16, QChar('0')).arg(block.len);
+    case BT_ENTRY:
+	return QString("(ENTRY %1h)").arg(block.addr, 4, 16, QChar('0'));
+    default:
+	return QString("(%1 bytes)").arg(block.len);
+    }
+}
@@ -0,0 +1,151 @@
+/****************************************************************************
+ *
+ * Cass80 tool - cassette image digests
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <zlib.h>
+#include "casdigest.h"
+
+/**
+ * @brief Size of the chunks fed to the file digests
+ * Small enough to stay in the L2 cache while all digests read it.
+ */
+static const qint64 chunk_size = 64 * 1024;
+
+CasDigests::CasDigests()
+    : size(0)
+    , crc32(0)
+    , sha1()
+    , md5()
+    , payload()
+    , image()
+    , image_size(0)
+    , blocks()
+{
+}
+
+void CasDigests::clear()
+{
+    size = 0;
+    crc32 = 0;
+    sha1.clear();
+    md5.clear();
+    payload.clear();
+    image.clear();
+    image_size = 0;
+    blocks.clear();
+}
+
+/**
+ * @brief Return true if the block digests are there for @p count blocks
+ * @param count number of blocks
+ * @return true if hash_blocks() was run for a list of that size
+ */
+bool CasDigests::has_blocks(int count) const
+{
+    return !image.isEmpty() && blocks.count() == count;
+}
+
+/**
+ * @brief Compute the CRC32, SHA1 and MD5 of a file in one pass
+ * @param data pointer to the first byte of the file
+ * @param size number of bytes in the file
+ */
+void CasDigests::hash_file(const uchar* data, qint64 size)
+{
+    this->size = size;
+    QCryptographicHash h_sha1(QCryptographicHash::Sha1);
+    QCryptographicHash h_md5(QCryptographicHash::Md5);
+    uLong crc = ::crc32(0L, Z_NULL, 0);
+
+    for (qint64 offs = 0; offs < size; offs += chunk_size) {
+	const int len = static_cast<int>(qMin(chunk_size, size - offs));
+	const char* chunk = reinterpret_cast<const char *>(data + offs);
+	crc = ::crc32(crc, reinterpret_cast<const Bytef *>(chunk), static_cast<uInt>(len));
+	h_sha1.addData(chunk, len);
+	h_md5.addData(chunk, len);
+    }
+    crc32 = static_cast<quint32>(crc);
+    sha1 = h_sha1.result();
+    md5 = h_md5.result();
+}
+
+/**
+ * @brief Compute the SHA1 of every block and of all blocks concatenated
+ *
+ * Each payload is read once and fed to both its own SHA1 and the image
+ * SHA1. Entry blocks get no SHA1 of their own, but their payload is part
+ * of the image, as it is in the XML export.
+ *
+ * @param list const reference to the list of blocks
+ */
+void CasDigests::hash_blocks(const CasBlockList& list)
+{
+    QCryptographicHash h_image(QCryptographicHash::Sha1);
+    QCryptographicHash h_block(QCryptographicHash::Sha1);
+
+    blocks.clear();
+    blocks.reserve(list.count());
+    image_size = 0;
+    foreach(const Cass80Block& b, list) {
+	const char* bytes = reinterpret_cast<const char *>(b.bytes());
+	h_image.addData(bytes, b.len);
+	image_size += b.len;
+	if (BT_ENTRY == b.type) {
+	    blocks += QByteArray();
+	    continue;
+	}
+	h_block.reset();
+	h_block.addData(bytes, b.len);
+	blocks += h_block.result();
+    }
+    image = h_image.result();
+}
+
+/**
+ * @brief Write all digests to @p stream
+ * @param stream reference to the QDataStream to write to
+ */
+void CasDigests::store(QDataStream& stream) const
+{
+    stream << size << crc32 << sha1 << md5 << payload << image << image_size << blocks;
+}
+
+/**
+ * @brief Read all digests written by store() from @p stream
+ * @param stream reference to the QDataStream to read from
+ * @return true on success, or false if the stream was short or corrupt
+ */
+bool CasDigests::restore(QDataStream& stream)
+{
+    stream >> size >> crc32 >> sha1 >> md5 >> payload >> image >> image_size >> blocks;
+    return stream.status() == QDataStream::Ok;
+}
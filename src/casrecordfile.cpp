@@ -0,0 +1,362 @@
+/****************************************************************************
+ *
+ * Cass80 tool - memory mapped append-only record file
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <cstring>
+#include <QDir>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QMap>
+#include <QSaveFile>
+#include <QtEndian>
+#include "casrecordfile.h"
+
+enum {
+    HEADER_SIZE	= 16		//!< magic, version, reserved
+};
+
+/**
+ * @brief Create a record file
+ * @param magic 8 bytes magic of the header
+ * @param version version of the header
+ * @param head minimum size of a record
+ * @param length offset of the quint32 length in a record
+ * @param extra bytes of a record not counted in its length
+ * @param kind name of the file in messages
+ */
+CasRecordFile::CasRecordFile(const char* magic, quint32 version, int head, int length, int extra,
+			     const char* kind)
+    : m_magic(magic, 8)
+    , m_version(version)
+    , m_head(head)
+    , m_length(length)
+    , m_extra(extra)
+    , m_kind(kind)
+    , m_filename()
+    , m_file()
+    , m_data()
+    , m_map(nullptr)
+    , m_mapped(0)
+    , m_live(0)
+    , m_pending()
+    , m_index()
+{
+}
+
+CasRecordFile::~CasRecordFile()
+{
+    close();
+}
+
+QString CasRecordFile::filename() const
+{
+    return m_filename;
+}
+
+/**
+ * @brief Return the number of keys in the file
+ */
+int CasRecordFile::count() const
+{
+    return m_index.count();
+}
+
+/**
+ * @brief Return the latest record for each key
+ */
+const QHash<quint64, CasRecordFile::Entry>& CasRecordFile::index() const
+{
+    return m_index;
+}
+
+/**
+ * @brief Open the file @p filename, creating it if necessary
+ * @param filename path name of the file
+ * @return true on success, or false if the file cannot be opened
+ */
+bool CasRecordFile::open(const QString& filename)
+{
+    close();
+
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+    m_filename = filename;
+    if (!reload()) {
+	qWarning("Cannot open %s '%s': %s", m_kind, qPrintable(filename),
+		 qPrintable(m_file.errorString()));
+	m_filename.clear();
+	return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Return a pointer to the record at @p offs
+ * The pointer is valid until the next append() or flush().
+ */
+const uchar* CasRecordFile::data(qint64 offs) const
+{
+    if (offs < m_mapped)
+	return m_map + offs;
+    return reinterpret_cast<const uchar *>(m_pending.constData()) + (offs - m_mapped);
+}
+
+/**
+ * @brief Return the bytes of the record at @p entry
+ * Mapped records are returned without copying them.
+ */
+QByteArray CasRecordFile::record(const Entry& entry) const
+{
+    if (entry.offs + entry.size <= m_mapped)
+	return QByteArray::fromRawData(reinterpret_cast<const char *>(m_map) + entry.offs,
+				       static_cast<int>(entry.size));
+    return m_pending.mid(static_cast<int>(entry.offs - m_mapped), static_cast<int>(entry.size));
+}
+
+/**
+ * @brief Append the record @p rec, superseding the record with the same key
+ *
+ * The record is kept in memory until flush() appends it to the file.
+ *
+ * @param rec the record with its key and length filled in
+ * @return offset of the record
+ */
+qint64 CasRecordFile::append(const QByteArray& rec)
+{
+    const qint64 offs = m_mapped + m_pending.size();
+    m_pending += rec;
+    walk(reinterpret_cast<const uchar *>(m_pending.constData()), offs - m_mapped,
+	 m_pending.size(), m_mapped);
+    return offs;
+}
+
+/**
+ * @brief Append the records appended since the last call to the file
+ *
+ * The file is locked against other processes while the records they
+ * appended are indexed and the records appended here are written at
+ * the real end of the file. The offsets of the records change.
+ *
+ * @return true on success, or false on error
+ */
+bool CasRecordFile::flush()
+{
+    if (m_filename.isEmpty() || m_pending.isEmpty())
+	return true;
+
+    QLockFile lock(m_filename + QLatin1String(".lock"));
+    if (!lock.lock()) {
+	qWarning("Cannot lock %s '%s'", m_kind, qPrintable(m_filename));
+	return false;
+    }
+
+    // Read what other processes appended, or the file they compacted,
+    // and put the records appended here on top of it
+    const QByteArray pending = m_pending;
+    if (!reload()) {
+	qWarning("Cannot open %s '%s': %s", m_kind, qPrintable(m_filename),
+		 qPrintable(m_file.errorString()));
+	clear();
+	return false;
+    }
+    m_pending = pending;
+    walk(reinterpret_cast<const uchar *>(m_pending.constData()), 0, m_pending.size(), m_mapped);
+
+    // A bad header or a record cut short is rewritten, never truncated
+    if (m_mapped < HEADER_SIZE || m_mapped != m_file.size() ||
+	m_live * 2 < m_mapped + m_pending.size() - HEADER_SIZE)
+	return compact();
+
+    if (!m_file.seek(m_mapped) ||
+	m_file.write(m_pending) != m_pending.size() || !m_file.flush()) {
+	qWarning("Writing %s '%s' failed: %s", m_kind, qPrintable(m_filename),
+		 qPrintable(m_file.errorString()));
+	return false;
+    }
+    m_pending.clear();
+    return map(m_file.size());
+}
+
+/**
+ * @brief Flush and close the file
+ */
+void CasRecordFile::close()
+{
+    flush();
+    clear();
+}
+
+QByteArray CasRecordFile::header() const
+{
+    QByteArray hdr(HEADER_SIZE, '\0');
+    uchar* p = reinterpret_cast<uchar *>(hdr.data());
+    memcpy(p, m_magic.constData(), 8);
+    qToLittleEndian<quint32>(m_version, p + 8);
+    return hdr;
+}
+
+/**
+ * @brief Index the complete records from @p pos up to @p end of @p data
+ * @param data pointer to the records
+ * @param pos offset of the first record in @p data
+ * @param end offset past the last byte in @p data
+ * @param base offset of @p data in the file
+ * @return offset past the last complete record
+ */
+qint64 CasRecordFile::walk(const uchar* data, qint64 pos, qint64 end, qint64 base)
+{
+    while (pos + m_head <= end) {
+	const qint64 size = m_extra + qFromLittleEndian<quint32>(data + pos + m_length);
+	if (size < m_head || pos + size > end)
+	    break;
+	const quint64 key = qFromLittleEndian<quint64>(data + pos);
+	if (m_index.contains(key))
+	    m_live -= m_index[key].size;
+	m_index.insert(key, Entry{base + pos, size});
+	m_live += size;
+	pos += size;
+    }
+    return pos;
+}
+
+/**
+ * @brief Open the file anew and index its records
+ *
+ * The file is opened by its name, so a file which another process
+ * compacted and renamed is picked up. The records which were not
+ * flushed yet are dropped.
+ *
+ * @return true on success, or false if the file cannot be opened
+ */
+bool CasRecordFile::reload()
+{
+    unmap();
+    m_file.close();
+    m_pending.clear();
+    m_index.clear();
+    m_live = 0;
+
+    m_file.setFileName(m_filename);
+    if (!m_file.open(QIODevice::ReadWrite))
+	return false;
+
+    if (!map(m_file.size()) || m_mapped < HEADER_SIZE ||
+	memcmp(m_map, m_magic.constData(), 8) ||
+	qFromLittleEndian<quint32>(m_map + 8) != m_version) {
+	unmap();
+	return true;
+    }
+    m_mapped = walk(m_map, HEADER_SIZE, m_mapped, 0);
+    return true;
+}
+
+/**
+ * @brief Map the first @p size bytes of the file
+ * If the file cannot be mapped, it is read into memory instead.
+ * @return true on success, or false on error
+ */
+bool CasRecordFile::map(qint64 size)
+{
+    unmap();
+    if (size <= 0)
+	return true;
+    m_map = m_file.map(0, size);
+    if (!m_map) {
+	if (!m_file.seek(0))
+	    return false;
+	m_data = m_file.read(size);
+	if (m_data.size() != size) {
+	    m_data.clear();
+	    return false;
+	}
+	m_map = reinterpret_cast<uchar *>(m_data.data());
+    }
+    m_mapped = size;
+    return true;
+}
+
+void CasRecordFile::unmap()
+{
+    if (m_map && m_data.isEmpty())
+	m_file.unmap(m_map);
+    m_data.clear();
+    m_map = nullptr;
+    m_mapped = 0;
+}
+
+/**
+ * @brief Rewrite the file with only the records still in use
+ *
+ * The new file replaces the old one by renaming it. It must be called
+ * with the file locked.
+ *
+ * @return true on success, or false on error
+ */
+bool CasRecordFile::compact()
+{
+    // Keep the records in the order they were written
+    QMap<qint64, qint64> order;
+    foreach(const Entry& entry, m_index)
+	order.insert(entry.offs, entry.size);
+
+    QByteArray data = header();
+    data.reserve(static_cast<int>(HEADER_SIZE + m_live));
+    for (auto it = order.constBegin(); it != order.constEnd(); ++it)
+	data.append(reinterpret_cast<const char *>(this->data(it.key())), static_cast<int>(it.value()));
+    unmap();
+    m_file.close();
+
+    QSaveFile output(m_filename);
+    if (!output.open(QIODevice::WriteOnly) || output.write(data) != data.size() || !output.commit()) {
+	qWarning("Writing %s '%s' failed: %s", m_kind, qPrintable(m_filename),
+		 qPrintable(output.errorString()));
+	clear();
+	return false;
+    }
+    if (!reload()) {
+	clear();
+	return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Close the file and forget all records without writing them
+ */
+void CasRecordFile::clear()
+{
+    unmap();
+    m_file.close();
+    m_filename.clear();
+    m_pending.clear();
+    m_index.clear();
+    m_live = 0;
+}
@@ -0,0 +1,944 @@
+/****************************************************************************
+ *
+ * Cass80 tool - headless batch processing
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <QAtomicInt>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include "cass80batch.h"
+#include "cass80handler.h"
+#include "cass80tape.h"
+#include "cass80xml.h"
+#include "cascache.h"
+#include "cascatalog.h"
+#include "casdiff.h"
+#include "caswavencoder.h"
+#include "caszip.h"
+#include "bdfcgenie.h"
+#include "z80defs.h"
+#include "z80dasm.h"
+
+static const QLatin1String g_default_defs(":/resources/cgenie-dasm.xml");
+static const QLatin1String g_default_rom(":/resources/cgenie.rom");
+
+//! Per worker buffer for inflated archive members; it keeps its capacity
+static thread_local QByteArray g_member_buffer;
+
+/**
+ * @brief Worker pulling the next unprocessed file from a shared index
+ *
+ * A fixed number of these run in a QThreadPool, so the number of
+ * images in flight never exceeds the number of jobs.
+ */
+class Cass80BatchWorker : public QRunnable
+{
+public:
+    Cass80BatchWorker(const Cass80Batch* batch, Cass80Batch::Result* results, int count, QAtomicInt* next)
+	: m_batch(batch)
+	, m_results(results)
+	, m_count(count)
+	, m_next(next)
+    {}
+
+    void run() override
+    {
+	for (;;) {
+	    const int index = m_next->fetchAndAddRelaxed(1);
+	    if (index >= m_count)
+		break;
+	    // Files already failed before the run are not processed
+	    if (!m_results[index].errors.isEmpty())
+		continue;
+	    m_results[index] = m_batch->process(m_results[index].path);
+	}
+    }
+
+private:
+    const Cass80Batch* m_batch;
+    Cass80Batch::Result* m_results;
+    int m_count;
+    QAtomicInt* m_next;
+};
+
+Cass80Batch::Cass80Batch(quint32 outputs)
+    : m_outputs(outputs)
+    , m_output_dir()
+    , m_jobs(QThread::idealThreadCount())
+    , m_uppercase(false)
+    , m_split(false)
+    , m_softlist()
+    , m_softlist_name()
+    , m_files()
+    , m_rom()
+    , m_defs_name(g_default_defs)
+    , m_defs(new z80Defs(g_default_defs))
+    , m_bdf(new bdfCgenie(DEFAULT_BDF_PIXEL_SIZE))
+    , m_cache(nullptr)
+    , m_catalog(nullptr)
+    , m_base_name()
+    , m_base(nullptr)
+    , m_zips()
+{
+    QFile rom(g_default_rom);
+    if (rom.open(QIODevice::ReadOnly)) {
+	m_rom = rom.readAll();
+	rom.close();
+    }
+    if (m_jobs < 1)
+	m_jobs = 1;
+}
+
+Cass80Batch::~Cass80Batch()
+{
+    qDeleteAll(m_zips);
+    delete m_base;
+    delete m_catalog;
+    delete m_cache;
+    delete m_bdf;
+    delete m_defs;
+}
+
+quint32 Cass80Batch::outputs() const
+{
+    return m_outputs;
+}
+
+QString Cass80Batch::output_dir() const
+{
+    return m_output_dir;
+}
+
+int Cass80Batch::jobs() const
+{
+    return m_jobs;
+}
+
+QStringList Cass80Batch::files() const
+{
+    return m_files;
+}
+
+void Cass80Batch::set_outputs(quint32 outputs)
+{
+    m_outputs = outputs;
+}
+
+/**
+ * @brief Set the directory where listings, XML and repaired images go
+ *
+ * If no output directory is set, the files are written next to their
+ * input files. Input files with the same base name in different
+ * directories overwrite each other's output in a common directory.
+ *
+ * @param output_dir path of the output directory
+ */
+void Cass80Batch::set_output_dir(const QString& output_dir)
+{
+    m_output_dir = output_dir;
+}
+
+void Cass80Batch::set_jobs(int jobs)
+{
+    m_jobs = jobs < 1 ? 1 : jobs;
+}
+
+void Cass80Batch::set_uppercase(bool uppercase)
+{
+    m_uppercase = uppercase;
+}
+
+/**
+ * @brief Treat each input file as a tape with possibly many programs
+ *
+ * Outputs for the programs get a "-NN" tag appended to the base name
+ * if more than one program is found on a tape.
+ *
+ * @param split true to split tapes into programs
+ */
+void Cass80Batch::set_split(bool split)
+{
+    m_split = split;
+}
+
+/**
+ * @brief Load the Z80 definitions used for disassembly listings
+ * @param filename name of the definitions XML file
+ * @return true on success, or false on error
+ */
+bool Cass80Batch::set_defs(const QString& filename)
+{
+    m_defs_name = filename;
+    return m_defs->load(filename);
+}
+
+/**
+ * @brief Use the cache file @p filename for decoded images and listings
+ *
+ * Images which did not change since they were cached are restored
+ * from the cache instead of being decoded. Tapes processed with
+ * set_split() are always decoded.
+ *
+ * @param filename path name of the cache file
+ * @return true on success, or false if the file cannot be opened
+ */
+bool Cass80Batch::set_cache(const QString& filename)
+{
+    delete m_cache;
+    m_cache = new CasCache();
+    if (m_cache->open(filename))
+	return true;
+    delete m_cache;
+    m_cache = nullptr;
+    return false;
+}
+
+/**
+ * @brief Add the images to the catalog file @p filename
+ *
+ * Every image decoded or restored from the cache is added with its
+ * file, payload, and block digests. Images already in the catalog
+ * which did not change are left alone. Tapes processed with
+ * set_split() are not cataloged.
+ *
+ * @param filename path name of the catalog file
+ * @return true on success, or false if the file cannot be opened
+ */
+bool Cass80Batch::set_catalog(const QString& filename)
+{
+    delete m_catalog;
+    m_catalog = new CasCatalog();
+    if (m_catalog->open(filename))
+	return true;
+    delete m_catalog;
+    m_catalog = nullptr;
+    return false;
+}
+
+/**
+ * @brief Use the image @p filename as the base for OUT_DIFF and patches
+ *
+ * With OUT_DIFF every image is compared block by block with the base,
+ * and a <name>.patch is written from which the image can be rebuilt.
+ * Input files named *.patch are applied to the base instead of being
+ * loaded, and the result is processed like any other image.
+ *
+ * @param filename path name of the base image
+ * @return true on success, or false if the image cannot be loaded
+ */
+bool Cass80Batch::set_base(const QString& filename)
+{
+    delete m_base;
+    m_base = new Cass80Handler();
+    if (m_base->load(filename) && !m_base->isEmpty()) {
+	m_base_name = filename;
+	return true;
+    }
+    qCritical("Cannot load the base image '%s'", qPrintable(filename));
+    delete m_base;
+    m_base = nullptr;
+    return false;
+}
+
+/**
+ * @brief Set the MAME software list written by OUT_SOFTLIST or read by OUT_VERIFY
+ * @param filename name of the softlist XML file, or "-" for stdout
+ * @param name name of the software list, e.g. "cgenie_cass"
+ */
+void Cass80Batch::set_softlist(const QString& filename, const QString& name)
+{
+    m_softlist = filename;
+    m_softlist_name = name;
+}
+
+/**
+ * @brief Add a cassette image, or all *.cas and *.wav files below a directory
+ * @param path file or directory name
+ * @return number of files added
+ */
+int Cass80Batch::add_path(const QString& path)
+{
+    QFileInfo info(path);
+    if (info.isDir()) {
+	QStringList found;
+	QDirIterator it(path, QStringList() << QLatin1String("*.cas") << QLatin1String("*.wav") << QLatin1String("*.zip"),
+			QDir::Files | QDir::Readable, QDirIterator::Subdirectories);
+	while (it.hasNext())
+	    found += it.next();
+	found.sort();
+	int count = 0;
+	foreach(const QString& file, found) {
+	    if (file.endsWith(QLatin1String(".zip"), Qt::CaseInsensitive)) {
+		count += add_zip(file);
+	    } else {
+		m_files += file;
+		count++;
+	    }
+	}
+	return count;
+    }
+    if (info.isFile()) {
+	if (path.endsWith(QLatin1String(".zip"), Qt::CaseInsensitive))
+	    return add_zip(path);
+	m_files += path;
+	return 1;
+    }
+    QString archive, member;
+    if (CasZip::split(path, &archive, &member)) {
+	const CasZip* zip = open_zip(archive);
+	if (zip && zip->find(member) >= 0) {
+	    m_files += path;
+	    return 1;
+	}
+    }
+    qCritical("No such file or directory: '%s'", qPrintable(path));
+    return 0;
+}
+
+/**
+ * @brief Open and index the ZIP archive @p path once
+ *
+ * The archive stays mapped for the lifetime of the batch.
+ *
+ * @param path path name of the ZIP archive
+ * @return pointer to the CasZip, or nullptr on error
+ */
+CasZip* Cass80Batch::open_zip(const QString& path)
+{
+    const QString key = QFileInfo(path).absoluteFilePath();
+    CasZip* zip = m_zips.value(key);
+    if (zip)
+	return zip;
+    zip = new CasZip;
+    if (!zip->open(path)) {
+	qCritical("Cannot read ZIP archive '%s': %s",
+		  qPrintable(path), qPrintable(zip->error_string()));
+	delete zip;
+	return nullptr;
+    }
+    m_zips.insert(key, zip);
+    return zip;
+}
+
+/**
+ * @brief Add the cassette images inside a ZIP archive
+ *
+ * Each member is added as "archive.zip/member", so that the members
+ * of one archive are inflated in parallel by the workers.
+ *
+ * @param path path name of the ZIP archive
+ * @return number of members added
+ */
+int Cass80Batch::add_zip(const QString& path)
+{
+    const CasZip* zip = open_zip(path);
+    if (!zip)
+	return 0;
+    const QVector<int> members = zip->cassettes();
+    foreach(int index, members)
+	m_files += QString("%1/%2").arg(path).arg(zip->member(index).name);
+    return members.count();
+}
+
+/**
+ * @brief Inflate the archive member named by @p path into @p buffer
+ *
+ * This is called from the worker threads; the archives were all
+ * opened in add_path() and are only read here.
+ *
+ * @param path path name "archive.zip/member"
+ * @param buffer buffer to inflate into; it keeps its capacity
+ * @param res Result to add errors to
+ * @return true on success, or false on error
+ */
+bool Cass80Batch::read_member(const QString& path, QByteArray& buffer, Result& res) const
+{
+    QString archive, member;
+    CasZip::split(path, &archive, &member);
+    const CasZip* zip = m_zips.value(QFileInfo(archive).absoluteFilePath());
+    const int index = zip ? zip->find(member) : -1;
+    if (index < 0) {
+	res.errors += QString("No member '%1' in '%2'").arg(member).arg(archive);
+	return false;
+    }
+    QString error;
+    if (!zip->read(index, buffer, &error)) {
+	res.errors += error;
+	return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Rebuild the image of the patch file @p path from the base into @p cas
+ * @param path path name of the patch
+ * @param cas pointer to the Cass80Handler to receive the image
+ * @param res Result to add errors to
+ * @return true on success, or false on error
+ */
+bool Cass80Batch::load_patch(const QString& path, Cass80Handler* cas, Result& res) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+	res.errors += QString("Cannot open '%1': %2").arg(path).arg(file.errorString());
+	return false;
+    }
+    QString error;
+    if (!CasDiff::apply(m_base, file.readAll(), cas, &error)) {
+	res.errors += error;
+	return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Add the files and directories listed in @p listname
+ *
+ * The list contains one path per line. Empty lines are ignored.
+ * A @p listname of "-" reads the list from stdin.
+ *
+ * @param listname name of the list file
+ * @return number of files added
+ */
+int Cass80Batch::add_file_list(const QString& listname)
+{
+    QFile list(listname);
+    bool res;
+    if (listname == QLatin1String("-")) {
+	res = list.open(stdin, QIODevice::ReadOnly | QIODevice::Text);
+    } else {
+	res = list.open(QIODevice::ReadOnly | QIODevice::Text);
+    }
+    if (!res) {
+	qCritical("Could not open '%s' for reading:\n%s", qPrintable(listname),
+		  qPrintable(list.errorString()));
+	return 0;
+    }
+
+    int count = 0;
+    QTextStream stream(&list);
+    while (!stream.atEnd()) {
+	const QString line = stream.readLine().trimmed();
+	if (line.isEmpty())
+	    continue;
+	count += add_path(line);
+    }
+    return count;
+}
+
+/**
+ * @brief Process all files with a bounded pool of worker threads
+ *
+ * Digest lines are printed to stdout and error messages to stderr,
+ * both in the order in which the files were added.
+ *
+ * @return number of files which failed
+ */
+int Cass80Batch::run()
+{
+    QVector<Result> results(m_files.count());
+    for (int i = 0; i < m_files.count(); i++)
+	results[i].path = m_files[i];
+    collisions(results);
+
+    if (!m_output_dir.isEmpty() && !QDir().mkpath(m_output_dir)) {
+	qCritical("Could not create output directory '%s'", qPrintable(m_output_dir));
+	return results.count();
+    }
+
+    QAtomicInt next(0);
+    QThreadPool pool;
+    const int workers = qMin(m_jobs, results.count());
+    pool.setMaxThreadCount(qMax(workers, 1));
+    for (int i = 0; i < workers; i++)
+	pool.start(new Cass80BatchWorker(this, results.data(), results.count(), &next));
+    pool.waitForDone();
+    if (m_cache)
+	m_cache->flush();
+    if (m_catalog)
+	m_catalog->flush();
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    int failed = 0;
+    if (m_outputs & (OUT_SOFTLIST | OUT_VERIFY))
+	failed += softlist(results);
+    if (m_catalog && (m_outputs & OUT_DUPLICATES))
+	duplicates(results);
+    if (m_outputs & OUT_SIMILAR)
+	similar(results);
+    if (m_base && (m_outputs & OUT_DIFF)) {
+	foreach(const Result& res, results) {
+	    if (!res.ok)
+		continue;
+	    out << res.path << (res.diff.isEmpty() ? ": same as " : ": differs from ") << m_base_name << '\n';
+	    foreach(const QString& line, res.diff)
+		out << "    " << line << '\n';
+	}
+    }
+    foreach(const Result& res, results) {
+	foreach(const QString& hash, res.hashes)
+	    out << hash << '\n';
+	foreach(const QString& error, res.errors)
+	    err << res.path << ": " << error << '\n';
+	if (!res.ok)
+	    failed++;
+    }
+    out.flush();
+    err.flush();
+    return failed;
+}
+
+/**
+ * @brief Fail the files whose outputs would overwrite those of another
+ *
+ * Inputs with the same base name, like game.cas and game.wav, or x.cas
+ * from two directories written to one output directory, would be written
+ * to the same output files by different worker threads. Only the first
+ * of them is processed.
+ *
+ * @param results reference to the QVector of Results to update
+ */
+void Cass80Batch::collisions(QVector<Result>& results) const
+{
+    const quint32 files = OUT_LISTING | OUT_XML | OUT_REPAIR | OUT_WAV |
+			  OUT_CSW | OUT_DIFF | OUT_XREF;
+    if (!(m_outputs & files))
+	return;
+
+    QHash<QString,int> first;
+    for (int i = 0; i < results.count(); i++) {
+	const QString base = output_path(results[i].path, QString(), QString());
+	const QHash<QString,int>::const_iterator it = first.constFind(base);
+	if (it == first.constEnd()) {
+	    first.insert(base, i);
+	    continue;
+	}
+	results[i].errors += QString("Outputs would overwrite those of '%1'")
+			     .arg(results[it.value()].path);
+    }
+}
+
+/**
+ * @brief Load one cassette image and produce the requested outputs
+ *
+ * This is called concurrently from the worker threads and must
+ * only read the shared state of the batch.
+ *
+ * @param path path name of the cassette image
+ * @return Result for the image
+ */
+Cass80Batch::Result Cass80Batch::process(const QString& path) const
+{
+    Result res;
+    res.path = path;
+
+    if (m_split) {
+	// The jobs not used by the files decode the programs of the tape
+	const int workers = qMax(qMin(m_jobs, m_files.count()), 1);
+	Cass80Tape tape;
+	tape.set_jobs(m_jobs / workers);
+	QObject::connect(&tape, &Cass80Tape::Error, [&res](QString message) {
+	    res.errors += message;
+	});
+	QByteArray& buffer = g_member_buffer;
+	const bool member = CasZip::split(path);
+	if (member && !read_member(path, buffer, res))
+	    return res;
+	if (!(member ? tape.load(buffer) : tape.load(path))) {
+	    res.errors += QStringLiteral("No cassette blocks found");
+	    return res;
+	}
+	res.ok = true;
+	for (int i = 0; i < tape.count(); i++) {
+	    const QString tag = tape.count() > 1
+				? QString("-%1").arg(i + 1, 2, 10, QChar('0'))
+				: QString();
+	    produce(tape.program(i), path, tag, QStringList(), res);
+	}
+	return res;
+    }
+
+    Cass80Handler cas;
+    QObject::connect(&cas, &Cass80Handler::Error, [&res](QString message) {
+	res.errors += message;
+    });
+
+    QStringList text;
+    const QByteArray variant = listing_variant();
+    QByteArray& buffer = g_member_buffer;
+    const bool member = CasZip::split(path);
+    if (member && !read_member(path, buffer, res))
+	return res;
+    const bool patch = !member && m_base && path.endsWith(QLatin1String(".patch"), Qt::CaseInsensitive);
+    // Members of an archive have no own file to key the cache with,
+    // and the image of a patch depends on the base as well
+    const bool cacheable = !member && !patch;
+    const bool cached = cacheable && m_cache && m_cache->lookup(path, &cas, &text, variant);
+    if (patch) {
+	if (!load_patch(path, &cas, res))
+	    return res;
+    } else if (!cached && (!(member ? cas.load(buffer) : cas.load(path)) || cas.isEmpty())) {
+	res.errors += QStringLiteral("No cassette blocks found");
+	return res;
+    }
+
+    bool ok = true;
+    if ((m_outputs & OUT_DIFF) && m_base && !patch) {
+	const CasDiff diff(m_base, &cas);
+	res.diff = diff.report();
+	ok = write_file(output_path(path, QString(), QLatin1String("patch")), path, diff.patch(), res);
+    }
+
+    if (m_catalog)
+	m_catalog->add(path, &cas);
+    if (m_outputs & OUT_SIMILAR)
+	res.signature = CasSimilar::signature(&cas);
+
+    if (m_outputs & (OUT_SOFTLIST | OUT_VERIFY)) {
+	res.rom = CasSoftlist::rom(path, &cas);
+	res.has_rom = true;
+    }
+
+    const bool render = (m_outputs & OUT_LISTING) && text.isEmpty();
+    if (render)
+	text = listing(&cas);
+    if (cacheable && m_cache && (!cached || render))
+	m_cache->insert(path, &cas, text, variant);
+
+    res.ok = ok;
+    produce(&cas, path, QString(), text, res);
+    return res;
+}
+
+/**
+ * @brief Print where else in the catalog each of the images occurs
+ *
+ * Byte identical copies and copies which differ only in their lead-in
+ * are listed by name. For other images the number of blocks they share
+ * with the image is printed.
+ *
+ * @param results const reference to the results of all images
+ */
+void Cass80Batch::duplicates(const QVector<Result>& results) const
+{
+    QTextStream out(stdout);
+    foreach(const Result& res, results) {
+	if (!res.ok)
+	    continue;
+	QStringList order;
+	QHash<QString, int> shared;
+	foreach(const CasCatalog::Hit& hit, m_catalog->where(res.path)) {
+	    switch (hit.match) {
+	    case CasCatalog::MATCH_FILE:
+		out << res.path << ": same image as " << hit.path << '\n';
+		break;
+	    case CasCatalog::MATCH_PAYLOAD:
+		out << res.path << ": same program as " << hit.path << '\n';
+		break;
+	    case CasCatalog::MATCH_BLOCK:
+		if (!shared.contains(hit.path))
+		    order += hit.path;
+		shared[hit.path]++;
+		break;
+	    }
+	}
+	foreach(const QString& other, order)
+	    out << res.path << ": " << shared[other] << " block(s) also in " << other << '\n';
+    }
+}
+
+/**
+ * @brief Print the clusters of near duplicate programs
+ *
+ * Each cluster is printed as a numbered group, with the estimated
+ * similarity of every other member to the first one.
+ *
+ * @param results const reference to the results of all images
+ */
+void Cass80Batch::similar(const QVector<Result>& results) const
+{
+    CasSimilar index;
+    QVector<int> row;		// index of the image to its result
+    for (int i = 0; i < results.count(); i++)
+	if (index.add(results[i].path, results[i].signature) >= 0)
+	    row += i;
+
+    QTextStream out(stdout);
+    int group = 0;
+    foreach(const QVector<int>& cluster, index.clusters()) {
+	const CasSimilar::Signature& first = results[row[cluster.first()]].signature;
+	out << "Similar group " << ++group << ":\n";
+	foreach(int member, cluster) {
+	    const Result& res = results[row[member]];
+	    out << "    " << res.path;
+	    if (member != cluster.first())
+		out << QString(" (%1%)").arg(qRound(100.0 * CasSimilar::similarity(first, res.signature)));
+	    out << '\n';
+	}
+    }
+}
+
+/**
+ * @brief Write or verify the MAME software list of all images
+ *
+ * The images are added in the order of the files, so the list does
+ * not depend on which worker finished first.
+ *
+ * @param results const reference to the results of all files
+ * @return 1 if writing failed, or the number of failures when verifying
+ */
+int Cass80Batch::softlist(const QVector<Result>& results) const
+{
+    CasSoftlist list(m_softlist_name);
+    foreach(const Result& res, results)
+	if (res.has_rom)
+	    list.add(res.rom);
+
+    QFile file(m_softlist);
+    bool opened;
+    if (m_outputs & OUT_VERIFY) {
+	opened = file.open(QIODevice::ReadOnly);
+    } else if (m_softlist == QLatin1String("-")) {
+	opened = file.open(stdout, QIODevice::WriteOnly);
+    } else {
+	opened = file.open(QIODevice::WriteOnly);
+    }
+    if (!opened) {
+	qCritical("Could not open softlist '%s':\n%s", qPrintable(m_softlist),
+		  qPrintable(file.errorString()));
+	return 1;
+    }
+
+    if (m_outputs & OUT_VERIFY) {
+	QStringList report;
+	const int failed = list.verify(&file, report);
+	QTextStream out(stdout);
+	foreach(const QString& line, report)
+	    out << line << '\n';
+	return failed;
+    }
+
+    if (!list.write(&file)) {
+	qCritical("Writing softlist '%s' failed:\n%s", qPrintable(m_softlist),
+		  qPrintable(file.errorString()));
+	return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Render the BASIC source or Z80 disassembly of a program
+ * @param cas pointer to the Cass80Handler with the program
+ * @return QStringList with the lines of the listing
+ */
+QStringList Cass80Batch::listing(Cass80Handler* cas) const
+{
+    if (cas->basic())
+	return cas->source();
+
+    quint16 pc_min = 0xffff;
+    quint16 pc_max = 0x0000;
+    z80Dasm dasm(m_uppercase, m_defs, m_bdf);
+    const QByteArray memory = analyze(cas, &dasm, &pc_min, &pc_max);
+    return dasm.listing(memory, pc_min, pc_max);
+}
+
+/**
+ * @brief Render the cross reference index of a SYSTEM program
+ * @param cas pointer to the Cass80Handler with the program
+ * @return QStringList with one line per reference
+ */
+QStringList Cass80Batch::xref(Cass80Handler* cas) const
+{
+    quint16 pc_min = 0xffff;
+    quint16 pc_max = 0x0000;
+    z80Dasm dasm(m_uppercase, m_defs, m_bdf);
+    analyze(cas, &dasm, &pc_min, &pc_max);
+    return dasm.xref().report(m_uppercase);
+}
+
+/**
+ * @brief Find the code and the cross references of a SYSTEM program
+ * @param cas pointer to the Cass80Handler with the program
+ * @param dasm pointer to the z80Dasm to analyze the program with
+ * @param pc_min pointer to a quint16 receiving the lowest address
+ * @param pc_max pointer to a quint16 receiving the highest address
+ * @return QByteArray with the 64 KiB memory image
+ */
+QByteArray Cass80Batch::analyze(Cass80Handler* cas, z80Dasm* dasm, quint16* pc_min, quint16* pc_max) const
+{
+    const QByteArray memory = cas->memory(m_rom, pc_min, pc_max);
+    dasm->discover(memory, cas->entries(), *pc_min, *pc_max, static_cast<quint32>(m_rom.size()));
+    dasm->cross_reference(memory, *pc_min, *pc_max);
+    return memory;
+}
+
+/**
+ * @brief Return the options a cached listing must have been rendered with
+ */
+QByteArray Cass80Batch::listing_variant() const
+{
+    return QString("%1:%2").arg(m_uppercase).arg(m_defs_name).toUtf8();
+}
+
+/**
+ * @brief Produce the requested outputs for one decoded program
+ * @param cas pointer to the Cass80Handler with the program
+ * @param path path name of the cassette image
+ * @param tag string appended to the output base name
+ * @param listing the listing, if already rendered, or an empty list
+ * @param res reference to the Result to update
+ */
+void Cass80Batch::produce(Cass80Handler* cas, const QString& path, const QString& tag,
+			  const QStringList& listing, Result& res) const
+{
+    if (m_outputs & OUT_HASH) {
+	res.hashes += QString("%1 %2 %3%4")
+		      .arg(cas->crc32(), 8, 16, QChar('0'))
+		      .arg(QString::fromLatin1(cas->digest().toHex()))
+		      .arg(path)
+		      .arg(tag);
+    }
+
+    if (m_outputs & OUT_LISTING) {
+	QStringList text = listing.isEmpty() ? this->listing(cas) : listing;
+	text += QString();
+	res.ok &= write_file(output_path(path, tag, QLatin1String("lst")), path,
+			     text.join(QChar::LineFeed).toUtf8(), res);
+    }
+
+    if ((m_outputs & OUT_XREF) && !cas->basic()) {
+	QStringList text = xref(cas);
+	text += QString();
+	res.ok &= write_file(output_path(path, tag, QLatin1String("xref")), path,
+			     text.join(QChar::LineFeed).toUtf8(), res);
+    }
+
+    if (m_outputs & OUT_XML) {
+	CasXml xml;
+	xml.set_data(cas);
+	const QString out = output_path(path, tag, QLatin1String("xml"));
+	QFile file(out);
+	if (!writable(out, path, res)) {
+	    res.ok = false;
+	} else if (!file.open(QIODevice::WriteOnly)) {
+	    res.errors += QString("Cannot open '%1' for writing: %2")
+			  .arg(out)
+			  .arg(file.errorString());
+	    res.ok = false;
+	} else if (!xml.write(&file)) {
+	    res.errors += QString("Writing '%1' failed: %2")
+			  .arg(out)
+			  .arg(file.errorString());
+	    res.ok = false;
+	}
+    }
+
+    for (int i = 0; i < 2; i++) {
+	const Output audio = i ? OUT_CSW : OUT_WAV;
+	if (!(m_outputs & audio))
+	    continue;
+	const QString out = output_path(path, tag, QLatin1String(i ? "csw" : "wav"));
+	if (!writable(out, path, res)) {
+	    res.ok = false;
+	    continue;
+	}
+	CasWavEncoder enc;
+	QObject::connect(&enc, &CasWavEncoder::Error, [&res](QString message) {
+	    res.errors += message;
+	});
+	res.ok &= enc.encode(cas, out);
+    }
+
+    if (m_outputs & OUT_REPAIR) {
+	if (!cas->basic() && cas->has_lmoffset())
+	    cas->undo_lmoffset();
+	const QString out = output_path(path, tag, QLatin1String("out"));
+	res.ok &= writable(out, path, res) && cas->save(out);
+    }
+}
+
+QString Cass80Batch::output_path(const QString& path, const QString& tag, const QString& suffix) const
+{
+    QFileInfo info(path);
+    QString archive;
+    // Outputs for archive members go next to the archive
+    const QString dir = !m_output_dir.isEmpty() ? m_output_dir
+		      : CasZip::split(path, &archive) ? QFileInfo(archive).absolutePath()
+		      : info.absolutePath();
+    return QDir::cleanPath(QString("%1/%2%3.%4")
+			   .arg(dir)
+			   .arg(info.completeBaseName())
+			   .arg(tag)
+			   .arg(suffix));
+}
+
+/**
+ * @brief Check that the output @p out does not overwrite the input @p path
+ * @param out path name of the output file
+ * @param path path name of the input file
+ * @param res reference to the Result to add an error to
+ * @return true if @p out may be written, or false otherwise
+ */
+bool Cass80Batch::writable(const QString& out, const QString& path, Result& res) const
+{
+    if (QFileInfo(out).absoluteFilePath() != QFileInfo(path).absoluteFilePath())
+	return true;
+    res.errors += QString("Not overwriting the input '%1'").arg(path);
+    return false;
+}
+
+bool Cass80Batch::write_file(const QString& path, const QString& input, const QByteArray& data, Result& res) const
+{
+    if (!writable(path, input, res))
+	return false;
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+	res.errors += QString("Cannot open '%1' for writing: %2")
+		      .arg(path)
+		      .arg(file.errorString());
+	return false;
+    }
+    if (file.write(data) != data.size()) {
+	res.errors += QString("Writing '%1' failed: %2")
+		      .arg(path)
+		      .arg(file.errorString());
+	return false;
+    }
+    return true;
+}
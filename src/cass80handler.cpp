@@ -31,13 +31,25 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  ****************************************************************************/
-#include <zlib.h>	// for crc32()
+#include <cstring>
+#include <QBuffer>
 #include "basictoken.h"
 #include "constants.h"
 #include "cass80handler.h"
+#include "casbitalign.h"
+#include "cass80xml.h"
+#include "casscanner.h"
+#include "caswavdecoder.h"
+#include "caszip.h"
 
 static const QLatin1String g_virtual_tape_file("Colour Genie - Virtual Tape File");
 
+//! Address of the first BASIC line on a TRS-80 Model I with Level II BASIC
+static const quint16 g_trs80_basic_start = 0x42e9;
+
+//! Address of the first BASIC line on a Colour Genie
+static const quint16 g_cgenie_basic_start = 0x5801;
+
 /**
  * @brief offset loader machine code
  *
@@ -130,15 +142,23 @@ Cass80Handler::Cass80Handler(QObject *parent)
     , m_prefix(0)
     , m_csum(0)
     , m_basic(false)
+    , m_complete(false)
+    , m_consumed(0)
     , m_sha1(QCryptographicHash::Sha1)
-    , m_crc32(~0u)
-    , m_digest()
+    , m_digests()
     , m_source()
+    , m_source_valid(false)
+    , m_arena()
     , m_blocks()
     , m_total_size(0)
 {
 }
 
+Cass80Handler::~Cass80Handler()
+{
+    delete m_bas;
+}
+
 void Cass80Handler::reset()
 {
     m_machine = MACH_INVALID;
@@ -156,15 +176,33 @@ void Cass80Handler::reset()
     m_prefix = 0;
     m_csum = 0;
     m_basic = false;
+    m_complete = false;
+    m_consumed = 0;
 
     m_sha1.reset();
-    m_crc32 = ~0u;
-    m_digest.clear();
+    m_digests.clear();
     m_source.clear();
+    m_source_valid = false;
+    m_arena.clear();
     m_blocks.clear();
     m_total_size = 0;
 }
 
+/**
+ * @brief Make @p arena the payload storage of all blocks
+ *
+ * The arena is shared by the blocks, so it is handed to them only
+ * once it is complete; appending to it afterwards would detach it.
+ *
+ * @param arena QByteArray with the payloads of all blocks
+ */
+void Cass80Handler::set_arena(const QByteArray& arena)
+{
+    m_arena = arena;
+    for (int i = 0; i < m_blocks.count(); i++)
+	m_blocks[i].arena = m_arena;
+}
+
 bool Cass80Handler::isEmpty() const
 {
     return m_blocks.isEmpty();
@@ -178,6 +216,31 @@ bool Cass80Handler::isValid() const
     return true;
 }
 
+/**
+ * @brief Return true if the program was decoded up to its end
+ *
+ * A SYSTEM program is complete after its entry block, a BASIC
+ * program after the line with address 0000h.
+ *
+ * @return true if complete, false if the image was truncated
+ */
+bool Cass80Handler::complete() const
+{
+    return m_complete;
+}
+
+/**
+ * @brief Return how many bytes of the image the last load() decoded
+ *
+ * Trailing bytes after the end of the program are not counted.
+ *
+ * @return offset after the last byte decoded into the program
+ */
+qint64 Cass80Handler::consumed() const
+{
+    return m_consumed;
+}
+
 /**
  * @brief Return the machine type detected after loading an image
  * @return
@@ -229,12 +292,23 @@ quint16 Cass80Handler::blen() const
 
 QByteArray Cass80Handler::digest() const
 {
-    return m_digest;
+    return m_digests.payload;
 }
 
 quint32 Cass80Handler::crc32() const
 {
-    return m_crc32;
+    return m_digests.crc32;
+}
+
+/**
+ * @brief Return all digests of the image
+ * They are computed once while loading, and the block digests again
+ * when undo_lmoffset() changes the blocks.
+ * @return const reference to the CasDigests
+ */
+const CasDigests& Cass80Handler::digests() const
+{
+    return m_digests;
 }
 
 bool Cass80Handler::basic() const
@@ -242,61 +316,205 @@ bool Cass80Handler::basic() const
     return m_basic;
 }
 
+/**
+ * @brief Load a cassette image from the file @p filename
+ *
+ * The file is memory mapped, if possible, and decoded in place.
+ * If mapping fails the contents are read through the QIODevice.
+ *
+ * @param filename name of the file to load
+ * @return true on success, or false on error
+ */
 bool Cass80Handler::load(const QString& filename)
 {
     QFile input(filename);
     bool res = false;
     if (input.open(QIODevice::ReadOnly)) {
-        res = load(&input);
+	const qint64 size = input.size();
+	uchar* map = size > 0 ? input.map(0, size) : nullptr;
+	if (map) {
+	    res = load(map, size);
+	    input.unmap(map);
+	} else {
+	    res = load(&input);
+	}
         input.close();
     }
 
     return res;
 }
 
+/**
+ * @brief Load a cassette image from the QIODevice @p device
+ * @param device pointer to a QIODevice opened for reading
+ * @return true on success, or false on error
+ */
 bool Cass80Handler::load(QIODevice* device)
 {
+    const QByteArray riff = device->peek(12);
+    if (CasWavDecoder::is_wav(reinterpret_cast<const uchar *>(riff.constData()), riff.size())) {
+	// Stream the recording instead of reading it all
+	CasWavDecoder wav;
+	connect(&wav, SIGNAL(Info(QString)), SIGNAL(Info(QString)));
+	connect(&wav, SIGNAL(Error(QString)), SIGNAL(Error(QString)));
+	if (!wav.decode(device))
+	    return false;
+	return load(wav.cas());
+    }
+    const QByteArray data = device->readAll();
+    return load(data);
+}
+
+/**
+ * @brief Load a cassette image from the QByteArray @p data
+ * @param data const reference to the image bytes
+ * @return true on success, or false on error
+ */
+bool Cass80Handler::load(const QByteArray& data)
+{
+    return load(reinterpret_cast<const uchar *>(data.constData()), data.size());
+}
+
+/**
+ * @brief Decode a cassette image from a contiguous span of memory
+ *
+ * The decoder_status_e state machine runs directly over the bytes
+ * at @p data, which may be a memory mapped file or a buffer.
+ * Block payloads are appended to one arena reserved for the whole
+ * image, and the image SHA1 is fed with contiguous runs instead
+ * of single bytes.
+ *
+ * A WAV recording is decoded to a .cas image first; the file digests
+ * then describe the decoded image. An image whose sync byte is found
+ * only at some bit offset is realigned first. A cassette XML
+ * description is read with CasXml instead of being decoded. Of a ZIP
+ * archive the first cassette image is loaded. A plain text BASIC
+ * listing is tokenized into a Colour Genie BASIC image.
+ *
+ * @param data pointer to the first byte of the image
+ * @param size number of bytes in the image
+ * @return true on success, or false on error
+ */
+bool Cass80Handler::load(const uchar* data, qint64 size)
+{
+    if (CasWavDecoder::is_wav(data, size)) {
+	CasWavDecoder wav;
+	connect(&wav, SIGNAL(Info(QString)), SIGNAL(Info(QString)));
+	connect(&wav, SIGNAL(Error(QString)), SIGNAL(Error(QString)));
+	if (!wav.decode(data, size))
+	    return false;
+	return load(wav.cas());
+    }
+
+    if (CasZip::is_zip(data, size)) {
+	CasZip zip;
+	if (!zip.open(data, size)) {
+	    emit Error(zip.error_string());
+	    return false;
+	}
+	const QVector<int> members = zip.cassettes();
+	if (members.isEmpty()) {
+	    emit Error(tr("The ZIP archive contains no cassette images."));
+	    return false;
+	}
+	QByteArray buffer;
+	QString error;
+	if (!zip.read(members.first(), buffer, &error)) {
+	    emit Error(error);
+	    return false;
+	}
+	emit Info(tr("Loading '%1', member 1 of %2 in the archive.")
+		  .arg(zip.member(members.first()).name)
+		  .arg(members.count()));
+	return load(buffer);
+    }
+
+    if (CasXml::is_xml(data, size)) {
+	CasXml xml;
+	connect(&xml, SIGNAL(Info(QString)), SIGNAL(Info(QString)));
+	connect(&xml, SIGNAL(Error(QString)), SIGNAL(Error(QString)));
+	QByteArray text = QByteArray::fromRawData(reinterpret_cast<const char *>(data),
+						  static_cast<int>(size));
+	QBuffer buffer(&text);
+	buffer.open(QIODevice::ReadOnly);
+	if (!xml.read(&buffer))
+	    return false;
+	set_data(&xml);
+	return true;
+    }
+
+    if (BasicToken::is_listing(data, size)) {
+	const QString text = QString::fromLatin1(reinterpret_cast<const char *>(data),
+						 static_cast<int>(size));
+	reset();
+	m_machine = MACH_EG2000;
+	return set_source(text.split(QLatin1Char('\n')));
+    }
+
+    const bool virtual_tape = size >= g_virtual_tape_file.size() &&
+	0 == memcmp(data, g_virtual_tape_file.data(), static_cast<size_t>(g_virtual_tape_file.size()));
+    if (!virtual_tape) {
+	// Images shifted by some bits are realigned first
+	const CasBitSync bits = CasBitAlign::find(data, size);
+	if (bits.phase > 0) {
+	    emit Info(tr("Realigning the image by %1 bits at offset %2.")
+		      .arg(bits.phase)
+		      .arg(bits.offs));
+	    return load(CasBitAlign::realign(data, size, bits));
+	}
+    }
+
     Cass80Block block;
     decoder_status_e status;
-    QByteArray data = device->peek(device->size());
     QByteArray buff;
+    const uchar* bp;
+    qint64 offs = 0;
+    qint64 first = 0;
+    qint64 sha1_first = 0;
+    qint64 sha1_last = 0;
     int count, pos;
     uchar ch;
-    uchar *bp;
+
+    // Append a range of bytes to the image SHA1, merging adjacent ranges
+    auto sha1_add = [&](qint64 from, qint64 len) {
+	if (from != sha1_last) {
+	    if (sha1_last > sha1_first)
+		m_sha1.addData(reinterpret_cast<const char *>(data + sha1_first),
+			       static_cast<int>(sha1_last - sha1_first));
+	    sha1_first = from;
+	}
+	sha1_last = from + len;
+    };
 
     reset();
-    // Use zlib's crc32
-    m_crc32 = ::crc32(static_cast<uLong>(0),
-		      reinterpret_cast<const Bytef *>(data.constData()),
-		      static_cast<uLong>(data.size()));
+    // The payloads can never be larger than the image itself
+    m_arena.reserve(static_cast<int>(size));
+    // CRC32, SHA1 and MD5 of the file in one pass
+    m_digests.hash_file(data, size);
 
-    int start = data.indexOf(CAS_TRS80_SYNC);
-    if (data.indexOf(CAS_CGENIE_SYNC) < start)
-	start = data.indexOf(CAS_CGENIE_SYNC);
+    // Find the first sync byte and the lead-in in front of it
+    const CasLeadInList leadins = CasScanner::scan(data, size, 0, 1);
 
-    if (QString::fromLatin1(data).startsWith(g_virtual_tape_file)) {
-        device->seek(32);
+    if (virtual_tape) {
+        offs = 32;
         status = ST_COMMENT;
 	m_machine = MACH_EG2000;
-    } else if (start >= 0) {
-        int count = start;
-        for (pos = 0; pos < count; pos++)
-            if (0x00 != data[pos])
-                break;
-	if (static_cast<uchar>(data[start]) == CAS_CGENIE_SYNC || pos < start) {
+    } else if (!leadins.isEmpty()) {
+	const CasLeadIn& lead = leadins.first();
+	if (lead.sync_byte == CAS_CGENIE_SYNC || lead.start > 0 || lead.fill != CAS_SILENCE) {
             /* probably Colour Genie SYSTEM or BASIC including an 0xA5 token */
-            device->seek(0);
+            offs = 0;
             status = ST_NUL;
 	    m_machine = MACH_EG2000;
         } else {
             /* TRS-80 silence header + sync byte */
-            device->seek(count);
+            offs = lead.sync;
             status = ST_SILENCE;
 	    m_machine = MACH_TRS80;
         }
     } else {
         /* read from the beginning */
-        device->seek(0);
+        offs = 0;
 	status = ST_NUL;
 	m_machine = MACH_EG2000;
     }
@@ -305,9 +523,8 @@ bool Cass80Handler::load(QIODevice* device)
     count = 0;
     buff.clear();
 
-    while (!device->atEnd()) {
-	QByteArray ba = device->read(1);
-	ch = static_cast<uchar>(ba[0]);
+    while (offs < size) {
+	ch = data[offs++];
         switch (status) {
         case ST_INVALID:
             return false;
@@ -357,7 +574,7 @@ bool Cass80Handler::load(QIODevice* device)
                 break;
 
             default:
-                buff += QChar::fromLatin1(ch);
+		buff += static_cast<char>(ch);
             }
             break;
 
@@ -386,32 +603,29 @@ bool Cass80Handler::load(QIODevice* device)
 		break;
             case CAS_TRS80_SYNC:
 		m_sync = ch;
-		m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+		sha1_add(offs - 1, 1);
                 status = ST_HEADER;
-                pos = 0;
-                count = 8;
                 break;
             case CAS_CGENIE_SYNC:
 		m_sync = ch;
-		m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+		sha1_add(offs - 1, 1);
                 status = ST_HEADER;
-                pos = 0;
-                count = 8;
                 break;
             default:
                 qCritical("NUL: unexpected %d (0x%x)", ch, ch);
                 break;
             }
-            buff.clear();
             break;
 
         case ST_HEADER:
-            buff += ch;
-            pos++;
-            count--;
-            if (count)
-                break;
-            bp = reinterpret_cast<uchar *>(buff.data());
+	    // The header is 8 bytes; a truncated header ends decoding
+	    first = offs - 1;
+	    if (size - first < 8) {
+		offs = size;
+		break;
+	    }
+	    bp = data + first;
+	    offs = first + 8;
 	    if (m_verbose > 1) {
 		emit Info(tr("HEADER: %1 %2 %3 %4 %5 %6 %7 %8")
 			.arg(bp[0], 2, 16, QChar(0))
@@ -427,44 +641,44 @@ bool Cass80Handler::load(QIODevice* device)
 	    }
             /* look for TRS-80 or Colour Genie SYSTEM tape format */
             if (bp[0] == CAS_SYSTEM_HEADER && bp[7] == CAS_SYSTEM_DATA) {
-		m_filename = QString::fromLatin1(buff.mid(1, 6));
+		m_filename = QString::fromLatin1(reinterpret_cast<const char *>(bp + 1), 6);
                 if (m_verbose) {
 		    emit Info(tr("SYSTEM tape: '%1'").arg(m_filename));
 		    qDebug("SYSTEM tape: '%s'", qPrintable(m_filename));
                 }
                 status = ST_SYSTEM_COUNT;
-		m_sha1.addData(buff, 8);
-		m_prefix = buff[0];
+		sha1_add(first, 8);
+		m_prefix = bp[0];
 		m_basic = false;
             } else if (bp[0] == CAS_TRS80_BASIC_HEADER &&
                        bp[1] == CAS_TRS80_BASIC_HEADER &&
                        bp[2] == CAS_TRS80_BASIC_HEADER) {
-		m_filename = QString::fromLatin1(buff.constData() + 3, 1);
+		m_filename = QString::fromLatin1(reinterpret_cast<const char *>(bp + 3), 1);
                 if (m_verbose) {
 		    emit Info(tr("TRS-80 BASIC tape: '%1'").arg(m_filename));
 		    qDebug("TRS-80 BASIC tape: '%s'", qPrintable(m_filename));
                 }
-                device->seek(device->pos() - 4);
+		offs -= 4;
                 status = ST_BASIC_ADDR_LSB;
-		m_sha1.addData(buff, 1);
+		sha1_add(first, 1);
 		m_prefix = 0;
 		m_basic = true;
             } else {
-		m_filename = QString::fromLatin1(buff.constData(), 1);
+		m_filename = QString::fromLatin1(reinterpret_cast<const char *>(bp), 1);
                 if (m_verbose) {
 		    emit Info(tr("Colour Genie BASIC tape: '%1'").arg(m_filename));
 		    qDebug("Colour Genie BASIC tape: '%s'", qPrintable(m_filename));
                 }
-                device->seek(device->pos() - 7);
+		offs -= 7;
                 status = ST_BASIC_ADDR_LSB;
-		m_sha1.addData(buff, 1);
+		sha1_add(first, 1);
 		m_prefix = 0;
 		m_basic = true;
             }
             break;
 
         case ST_SYSTEM_BLOCKTYPE:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
             switch (ch) {
             case CAS_SYSTEM_DATA:
                 status = ST_SYSTEM_COUNT;
@@ -482,7 +696,7 @@ bool Cass80Handler::load(QIODevice* device)
             break;
 
         case ST_SYSTEM_COUNT:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
             count = ch;
             if (0 == count)
                 count = 256;
@@ -491,14 +705,14 @@ bool Cass80Handler::load(QIODevice* device)
             break;
 
         case ST_SYSTEM_ADDR_LSB:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
 	    m_addr = ch;
 	    m_csum = ch;
             status = ST_SYSTEM_ADDR_MSB;
             break;
 
         case ST_SYSTEM_ADDR_MSB:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
 	    m_addr = m_addr + 256 * ch;
 	    m_csum = m_csum + ch;
             status = ST_SYSTEM_DATA;
@@ -513,24 +727,29 @@ bool Cass80Handler::load(QIODevice* device)
             block.type = BT_SYSTEM;
 	    block.addr = m_addr;
 	    block.size = m_size;
-	    block.data.fill(0x00, 1024);
-            pos = 0;
             break;
 
         case ST_SYSTEM_DATA:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
-            block.data[pos] = ch;
-            if (++pos == 1024)
-                pos = 1023;
-	    m_csum = m_csum + ch;
-            if (0 == --count) {
-                status = ST_SYSTEM_CSUM;
-		block.data.resize(pos);
+	    // Consume the whole payload at once; a truncated block is dropped
+	    first = offs - 1;
+	    if (size - first < count) {
+		sha1_add(first, size - first);
+		offs = size;
+		break;
 	    }
+	    sha1_add(first, count);
+	    for (bp = data + first; bp < data + first + count; bp++)
+		m_csum = m_csum + *bp;
+	    block.offs = m_arena.size();
+	    block.len = count;
+	    m_arena.append(reinterpret_cast<const char *>(data + first), count);
+	    offs = first + count;
+	    count = 0;
+	    status = ST_SYSTEM_CSUM;
             break;
 
         case ST_SYSTEM_CSUM:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
 	    if (ch != m_csum) {
 		emit Error(QString("SYSTEM_CSUM: block #%1 checksum error (found:0%2 calc:0x%3)")
 			   .arg(m_blocks.count())
@@ -547,14 +766,20 @@ bool Cass80Handler::load(QIODevice* device)
             break;
 
         case ST_SYSTEM_ENTRY_LSB:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
 	    m_entry = ch;
             status = ST_SYSTEM_ENTRY_MSB;
             break;
 
         case ST_SYSTEM_ENTRY_MSB:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
 	    m_entry = m_entry + 256 * ch;
+	    if (BT_RAW == block.type) {
+		// An entry block following an entry block carries 1 KiB of zeroes
+		block.offs = m_arena.size();
+		block.len = 1024;
+		m_arena.append(QByteArray(1024, 0x00));
+	    }
             block.type = BT_ENTRY;
 	    block.addr = m_entry;
             block.size = 0;
@@ -567,19 +792,19 @@ bool Cass80Handler::load(QIODevice* device)
 		       m_entry, m_entry);
             }
             status = ST_AFTER_ENTRY;
+	    m_complete = true;
             block.type = BT_RAW;
             block.size = 0;
-            block.data.fill(0, 1024);
             break;
 
         case ST_BASIC_ADDR_LSB:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
 	    m_addr = ch;
             status = ST_BASIC_ADDR_MSB;
             break;
 
         case ST_BASIC_ADDR_MSB:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
 	    m_addr = m_addr + 256 * ch;
 	    if (0 == m_addr) {
                 if (m_verbose > 1) {
@@ -588,9 +813,7 @@ bool Cass80Handler::load(QIODevice* device)
 			       .arg(pos, 4, 16, QChar('0')));
                 }
                 status = ST_IGNORE;
-                block.type = BT_RAW;
-                block.size = 0;
-                block.data.fill(0, 1024);
+		m_complete = true;
             } else {
                 pos = 0;
                 status = ST_BASIC_LINE_LSB;
@@ -598,21 +821,19 @@ bool Cass80Handler::load(QIODevice* device)
             break;
 
         case ST_BASIC_LINE_LSB:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
 	    m_line = ch;
             status = ST_BASIC_LINE_MSB;
             break;
 
         case ST_BASIC_LINE_MSB:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+	    sha1_add(offs - 1, 1);
 	    m_line = m_line + 256 * ch;
             status = ST_BASIC_DATA;
             pos = 0;
             block.type = BT_BASIC;
 	    block.line = m_line;
 	    block.addr = m_addr;
-            block.size = 1024;
-            block.data.fill(0, 1024);
             if (m_verbose > 1) {
 		emit Info(tr("BASIC line: #%1 at %2h")
 			   .arg(m_line)
@@ -622,33 +843,38 @@ bool Cass80Handler::load(QIODevice* device)
             break;
 
         case ST_BASIC_DATA:
-	    m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
-            block.data[pos] = ch;
-            if (++pos == 1024)
-                pos = 1023;
-	    if (0x00 == ch) {
-		m_size = pos;
-		block.size = m_size;
-		block.data.resize(m_size);
-		m_source += QString("%1 %2")
-			  .arg(m_line)
-			  .arg(m_bas->detokenize(block.data, block.size));
-		m_total_size += block.size;
-		m_blocks += block;
-                status = ST_BASIC_ADDR_LSB;
-            }
+	    // The line ends with a NUL byte; a truncated line is dropped
+	    first = offs - 1;
+	    bp = static_cast<const uchar *>(memchr(data + first, 0x00, static_cast<size_t>(size - first)));
+	    if (!bp) {
+		sha1_add(first, size - first);
+		offs = size;
+		break;
+	    }
+	    offs = bp + 1 - data;
+	    sha1_add(first, offs - first);
+	    // Lines are limited to 1023 bytes, including the NUL
+	    pos = static_cast<int>(qMin<qint64>(offs - first, 1023));
+	    m_size = static_cast<quint16>(pos);
+	    block.size = m_size;
+	    block.offs = m_arena.size();
+	    block.len = pos;
+	    m_arena.append(reinterpret_cast<const char *>(data + first), pos);
+	    m_total_size += block.size;
+	    m_blocks += block;
+	    status = ST_BASIC_ADDR_LSB;
             break;
 
         case ST_AFTER_ENTRY:
             if (ch == CAS_SYSTEM_DATA) {
 		// Another data block after the system entry
-		m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+		sha1_add(offs - 1, 1);
                 status = ST_SYSTEM_COUNT;
                 break;
             }
             if (ch == CAS_SYSTEM_ENTRY) {
 		// Another entry block after the system entry
-		m_sha1.addData(reinterpret_cast<const char *>(&ch), 1);
+		sha1_add(offs - 1, 1);
                 status = ST_SYSTEM_ENTRY_LSB;
                 break;
             }
@@ -656,18 +882,21 @@ bool Cass80Handler::load(QIODevice* device)
             /* FALLTHROUGH */
 
         case ST_IGNORE:
-	    // Do not append ch to image SHA1
-            if (0 == (block.size % 1024)) {
-                block.data.resize(block.size + 1024);
-            }
-            block.data[block.size] = ch;
-            block.size += 1;
+	    // Do not append the trailing bytes to the image SHA1
+	    offs = size;
+	    break;
         }
     }
-    m_digest = m_sha1.result();
+    if (sha1_last > sha1_first)
+	m_sha1.addData(reinterpret_cast<const char *>(data + sha1_first),
+		       static_cast<int>(sha1_last - sha1_first));
+    m_consumed = sha1_last;
+    m_digests.payload = m_sha1.result();
+    set_arena(m_arena);
+    m_digests.hash_blocks(m_blocks);
     emit Info(tr("Loaded %1 blocks (%2 bytes).").arg(m_blocks.count()).arg(m_total_size));
-    emit Info(tr("SHA1 of data: %1.").arg(m_digest.toHex().constData()));
-    qDebug("Loaded %d blocks. SHA1 = %s", m_blocks.count(), m_digest.toHex().constData());
+    emit Info(tr("SHA1 of data: %1.").arg(m_digests.payload.toHex().constData()));
+    qDebug("Loaded %d blocks. SHA1 = %s", m_blocks.count(), m_digests.payload.toHex().constData());
     return true;
 }
 
@@ -675,7 +904,7 @@ bool Cass80Handler::has_lmoffset()
 {
     QByteArray mover(reinterpret_cast<const char *>(g_mover), sizeof(g_mover));
     for (int i = 0; i < m_blocks.count(); i++) {
-	const uchar* bp = reinterpret_cast<const uchar *>(m_blocks[i].data.constData());
+	const uchar* bp = m_blocks[i].bytes();
 	if (m_blocks[i].size != 15)
 	    continue;
 	if (bp[0] == mover[0] || bp[1] == mover[1] || bp[4] == mover[4] ||
@@ -690,20 +919,19 @@ bool Cass80Handler::undo_lmoffset()
 {
     QByteArray memory(64*1024, 0x00);
     QByteArray mover(reinterpret_cast<const char *>(g_mover), sizeof(g_mover));
-    Cass80Block block;
 
     for (int i = 0; i < m_blocks.count(); i++) {
-	Cass80Block* cb = &m_blocks[i];
-        const uchar* bp = reinterpret_cast<const uchar *>(m_blocks[i].data.constData());
-	memory.replace(cb->addr, cb->size, cb->data);
+	const Cass80Block& cb = m_blocks[i];
+	const uchar* bp = cb.bytes();
+	memory.replace(cb.addr, cb.size, cb.data());
 
-	if (m_blocks[i].size != 15)
+	if (cb.size != 15)
             continue;
 
 	if (bp[0] == mover[0] || bp[1] == mover[1] || bp[4] == mover[4] ||
             bp[7] == mover[7] || bp[10] == mover[10] || bp[11] == mover[11] || bp[12] == mover[12]) {
-	    emit Info(tr("Found MOVER at address %1h").arg(cb->addr, 4, 16, QChar('0')));
-	    qDebug("Found MOVER at address %xh", cb->addr);
+	    emit Info(tr("Found MOVER at address %1h").arg(cb.addr, 4, 16, QChar('0')));
+	    qDebug("Found MOVER at address %xh", cb.addr);
 	    quint16 src = bp[2] + (256u * bp[3]);
 	    quint16 dst = bp[5] + (256u * bp[6]);
 	    quint16 size = bp[8] + (256u * bp[9]);
@@ -720,118 +948,358 @@ bool Cass80Handler::undo_lmoffset()
 		    memory[src+i] = 0;
             }
 
-	    // Remove blocks in source range
+	    // Keep all blocks but those in the source range, the entry blocks and the mover
+	    CasBlockList blocks;
 	    for (int j = 0; j < m_blocks.count(); j++) {
-		Cass80Block* cc = &m_blocks[j];
-		if (BT_SYSTEM == cc->type &&
-			cc->addr >= src &&
-			cc->addr + cc->size <= src + size) {
-		    m_blocks.takeAt(j);
-		    --j;
-		}
-		if (BT_ENTRY == cc->type) {
-		    m_blocks.takeAt(j);
-		    --j;
-		}
-		if (cb == cc) {
-		    m_blocks.takeAt(j);
-		    --j;
-		}
+		const Cass80Block& cc = m_blocks[j];
+		if (BT_SYSTEM == cc.type &&
+			cc.addr >= src &&
+			cc.addr + cc.size <= src + size)
+		    continue;
+		if (BT_ENTRY == cc.type)
+		    continue;
+		if (j == i)
+		    continue;
+		blocks += cc;
 	    }
+	    m_blocks = blocks;
 
+	    // Append the moved blocks' payloads to a copy of the arena
+	    QByteArray arena = m_arena;
 	    for (quint16 i = 0; i < size; i += m_blen, dst += m_blen) {
 		Cass80Block block;
 		quint8 bcnt = static_cast<quint8>((size - i) > m_blen ? m_blen : size - i);
-		block.data = memory.mid(dst, bcnt ? bcnt : 256);
+		const QByteArray data = memory.mid(dst, bcnt ? bcnt : 256);
 		quint8 csum;
 		csum = dst % 256;
 		csum += dst / 256;
-		foreach(char ch, block.data)
+		foreach(char ch, data)
 		    csum += static_cast<uchar>(ch);
                 block.type = BT_SYSTEM;
                 block.csum = csum;
                 block.addr = dst;
                 block.line = 0;
                 block.size = bcnt;
+		block.offs = arena.size();
+		block.len = data.size();
+		arena += data;
                 m_blocks += block;
             }
 	    Cass80Block block;
             block.type = BT_ENTRY;
             block.addr = entry;
             m_blocks += block;
+	    set_arena(arena);
+	    m_digests.hash_blocks(m_blocks);
             return true;
         }
     }
     return true;
 }
 
-bool Cass80Handler::save(const QString& filename)
+/**
+ * @brief Return the bytes of the image following the sync byte
+ *
+ * This is the SYSTEM header with the file name, all data blocks and
+ * the entry block, as they are recorded on tape for both machines.
+ * For BASIC images it is the header with the one letter file name,
+ * the lines with their link and number, and the 0000h end link.
+ *
+ * @return QByteArray with the bytes
+ */
+QByteArray Cass80Handler::payload() const
 {
-    QFile output(filename);
-    if (!output.open(QIODevice::WriteOnly)) {
-        qCritical("Cannot open '%s' for writing", qPrintable(filename));
-        return false;
+    QByteArray data;
+    if (m_basic) {
+	const char name = m_filename.isEmpty() ? ' ' : m_filename.at(0).toLatin1();
+	data.reserve(static_cast<int>(6 + m_total_size + 4 * m_blocks.count()));
+	if (MACH_TRS80 == m_machine)
+	    data += QByteArray(3, static_cast<char>(CAS_TRS80_BASIC_HEADER));
+	data += name;
+	foreach(const Cass80Block& block, m_blocks) {
+	    if (BT_BASIC != block.type)
+		continue;
+	    data += static_cast<char>(block.addr % 256);
+	    data += static_cast<char>(block.addr / 256);
+	    data += static_cast<char>(block.line % 256);
+	    data += static_cast<char>(block.line / 256);
+	    data += block.data();
+	}
+	data += QByteArray(2, 0x00);
+	return data;
     }
 
-    QByteArray header;
     QByteArray fname(6, 0x20);
+    fname.replace(0, qMin(6, m_filename.length()),
+		  m_filename.left(6).toUpper().toLatin1());
+    data.reserve(static_cast<int>(8 + m_total_size + 6 * m_blocks.count()));
+    data += static_cast<char>(CAS_SYSTEM_HEADER);
+    data += fname;
+    foreach(const Cass80Block& block, m_blocks) {
+	if (BT_SYSTEM == block.type) {
+	    data += static_cast<char>(CAS_SYSTEM_DATA);
+	    data += static_cast<char>(block.size % 256);
+	    data += static_cast<char>(block.addr % 256);
+	    data += static_cast<char>(block.addr / 256);
+	    data += block.data();
+	    data += static_cast<char>(block.csum);
+	} else if (BT_ENTRY == block.type) {
+	    data += static_cast<char>(CAS_SYSTEM_ENTRY);
+	    data += static_cast<char>(block.addr % 256);
+	    data += static_cast<char>(block.addr / 256);
+	}
+    }
+    return data;
+}
+
+/**
+ * @brief Return the lead-in and sync byte written in front of the payload
+ * @return QByteArray with the lead-in, or an empty one for an invalid machine
+ */
+QByteArray Cass80Handler::leadin() const
+{
+    QByteArray header;
     switch (m_machine) {
     case MACH_EG2000:
 	header += static_cast<char>(CAS_CGENIE_SYNC);
-	header += static_cast<char>(CAS_SYSTEM_HEADER);
-	fname.replace(0, qMin(6, m_filename.length()),
-		      m_filename.toUpper().toLatin1());
-	header += fname;
-	output.write(header);
-	foreach(const Cass80Block& block, m_blocks) {
-	    if (BT_SYSTEM == block.type) {
-		QByteArray data;
-		data += static_cast<char>(CAS_SYSTEM_DATA);
-		data += block.size % 256;
-		data += block.addr % 256;
-		data += block.addr / 256;
-		data += block.data;
-		data += block.csum;
-		output.write(data);
-	    } else if (BT_ENTRY == block.type) {
-		QByteArray data;
-		data += static_cast<char>(CAS_SYSTEM_ENTRY);
-		data += block.addr % 256;
-		data += block.addr / 256;
-		output.write(data);
-	    }
-	}
 	break;
     case MACH_TRS80:
 	header += QByteArray(256, CAS_SILENCE);
 	header += static_cast<char>(CAS_TRS80_SYNC);
-	header += static_cast<char>(CAS_SYSTEM_HEADER);
-	header += m_filename.left(6).toUpper();
-	output.write(header);
-	foreach(const Cass80Block& block, m_blocks) {
-	    if (BT_SYSTEM == block.type) {
-		QByteArray data;
-		data += static_cast<char>(CAS_SYSTEM_DATA);
-		data += block.size % 256;
-		data += block.addr % 256;
-		data += block.addr / 256;
-		data += block.data;
-		data += block.csum;
-		output.write(data);
-	    } else if (BT_ENTRY == block.type) {
-		QByteArray data;
-		data += static_cast<char>(CAS_SYSTEM_ENTRY);
-		data += block.addr % 256;
-		data += block.addr / 256;
-		output.write(data);
-	    }
-	}
 	break;
-
     default:
+	break;
+    }
+    return header;
+}
+
+bool Cass80Handler::save(const QString& filename)
+{
+    const QByteArray header = leadin();
+    if (header.isEmpty()) {
 	emit Error(tr("Invalid machine - none of EG2000 or TRS80 were detected."));
 	return false;
     }
+
+    QFile output(filename);
+    if (!output.open(QIODevice::WriteOnly)) {
+        qCritical("Cannot open '%s' for writing", qPrintable(filename));
+        return false;
+    }
+    output.write(header);
+    output.write(payload());
+    return true;
+}
+
+/**
+ * @brief Take the image from the cassette XML description @p xml
+ *
+ * The blocks share the arena the XML reader decoded into. The file
+ * digests describe the .cas image which save() writes for them.
+ *
+ * @param xml pointer to the CasXml read from a description
+ */
+void Cass80Handler::set_data(const CasXml* xml)
+{
+    reset();
+    m_machine = xml->machine();
+    m_basic = xml->basic();
+    m_hdr_name = xml->hdr_name();
+    m_hdr_author = xml->hdr_author();
+    m_hdr_copyright = xml->hdr_copyright();
+    m_hdr_description = xml->hdr_description();
+    m_sync = xml->sync();
+    m_prefix = xml->prefix();
+    m_filename = xml->filename();
+    m_blocks = xml->blocks();
+    m_digests = xml->digests();
+    if (!m_digests.has_blocks(m_blocks.count()))
+	m_digests.hash_blocks(m_blocks);
+    if (!m_blocks.isEmpty())
+	m_arena = m_blocks.first().arena;
+
+    foreach(const Cass80Block& b, m_blocks) {
+	if (BT_ENTRY == b.type) {
+	    m_entry = b.addr;
+	    m_complete = true;
+	    continue;
+	}
+	m_addr = b.addr;
+	m_line = b.line;
+	m_size = b.size;
+	m_csum = b.csum;
+	m_total_size += b.size;
+    }
+    if (m_basic)
+	m_complete = !m_blocks.isEmpty();
+
+    hash_image();
+    emit Info(tr("Loaded %1 blocks (%2 bytes).").arg(m_blocks.count()).arg(m_total_size));
+}
+
+/**
+ * @brief Tokenize the BASIC program @p source into the image
+ *
+ * Each line starts with its line number, followed by one space and the
+ * text as source() returns it. Empty lines are skipped, and the lines
+ * are kept in their order. The first line goes where the first line of
+ * the current program was, or to the start of BASIC of the machine.
+ * The Colour Genie keywords are tokenized only for MACH_EG2000, which
+ * is assumed if no machine was detected.
+ *
+ * @param source list of lines
+ * @return true on success, or false for a line without a valid number
+ */
+bool Cass80Handler::set_source(const QStringList& source)
+{
+    if (MACH_INVALID == m_machine)
+	m_machine = MACH_EG2000;
+    const bool cgenie = MACH_EG2000 == m_machine;
+    quint32 addr = cgenie ? g_cgenie_basic_start : g_trs80_basic_start;
+    if (m_basic && !m_blocks.isEmpty())
+	addr = m_blocks.first().addr - 4u - m_blocks.first().size;
+
+    QByteArray arena;
+    CasBlockList blocks;
+    foreach(QString text, source) {
+	while (text.endsWith(QLatin1Char('\r')))
+	    text.chop(1);
+	if (text.trimmed().isEmpty())
+	    continue;
+
+	int pos = 0;
+	while (pos < text.size() && text.at(pos).isSpace())
+	    pos++;
+	const int first = pos;
+	while (pos < text.size() && text.at(pos).isDigit())
+	    pos++;
+	bool ok;
+	const uint line = text.mid(first, pos - first).toUInt(&ok);
+	if (!ok || line > 65529) {
+	    emit Error(tr("BASIC line without a valid line number: '%1'").arg(text));
+	    return false;
+	}
+	if (pos < text.size() && text.at(pos) == QLatin1Char(' '))
+	    pos++;
+
+	const QByteArray tokens = m_bas->tokenize(text.mid(pos), cgenie);
+	Cass80Block block;
+	block.type = BT_BASIC;
+	block.line = static_cast<quint16>(line);
+	block.size = static_cast<quint16>(tokens.size());
+	block.offs = arena.size();
+	block.len = tokens.size();
+	addr += 4u + block.size;
+	if (addr > 0xffff) {
+	    emit Error(tr("BASIC program does not fit into memory at line %1.").arg(line));
+	    return false;
+	}
+	block.addr = static_cast<quint16>(addr);
+	arena += tokens;
+	blocks += block;
+    }
+
+    m_blocks = blocks;
+    m_source.clear();
+    m_source_valid = false;
+    m_total_size = 0;
+    set_arena(arena);
+    foreach(const Cass80Block& b, m_blocks)
+	m_total_size += b.size;
+    m_sync = cgenie ? CAS_CGENIE_SYNC : CAS_TRS80_SYNC;
+    m_prefix = 0;
+    m_entry = 0;
+    m_basic = true;
+    m_complete = !m_blocks.isEmpty();
+    m_digests.clear();
+    m_digests.hash_blocks(m_blocks);
+    hash_image();
+    emit Info(tr("Tokenized %1 BASIC lines (%2 bytes).").arg(m_blocks.count()).arg(m_total_size));
+    return true;
+}
+
+/**
+ * @brief Compute the file and payload digests of the image save() writes
+ */
+void Cass80Handler::hash_image()
+{
+    const QByteArray data = payload();
+    if (!data.isEmpty()) {
+	const QByteArray image = leadin() + data;
+	m_digests.hash_file(reinterpret_cast<const uchar *>(image.constData()), image.size());
+	m_digests.payload = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    }
+}
+
+/**
+ * @brief Write the decoded state of the image to @p stream
+ *
+ * This is everything load() produces: the header fields, the block
+ * table with its arena and the digests. The BASIC source is not
+ * stored; it is detokenized again when it is needed.
+ *
+ * @param stream reference to the QDataStream to write to
+ */
+void Cass80Handler::store(QDataStream& stream) const
+{
+    stream << static_cast<qint32>(m_machine) << m_sync;
+    stream << m_hdr_name << m_hdr_author << m_hdr_copyright << m_hdr_description;
+    stream << m_filename << m_addr << m_line << m_entry << m_size;
+    stream << m_prefix << m_csum << m_basic << m_complete << m_total_size;
+    stream << m_arena;
+
+    stream << static_cast<qint32>(m_blocks.count());
+    foreach(const Cass80Block& b, m_blocks) {
+	stream << static_cast<qint32>(b.type) << b.csum << b.addr << b.size << b.line;
+	stream << static_cast<qint32>(b.offs) << static_cast<qint32>(b.len);
+    }
+    m_digests.store(stream);
+}
+
+/**
+ * @brief Restore the decoded state written by store() from @p stream
+ *
+ * No decoding or hashing is done. On error the handler is left empty.
+ *
+ * @param stream reference to the QDataStream to read from
+ * @return true on success, or false if the stream was short or corrupt
+ */
+bool Cass80Handler::restore(QDataStream& stream)
+{
+    qint32 machine, count;
+
+    reset();
+    stream >> machine >> m_sync;
+    stream >> m_hdr_name >> m_hdr_author >> m_hdr_copyright >> m_hdr_description;
+    stream >> m_filename >> m_addr >> m_line >> m_entry >> m_size;
+    stream >> m_prefix >> m_csum >> m_basic >> m_complete >> m_total_size;
+    stream >> m_arena;
+    stream >> count;
+    if (stream.status() != QDataStream::Ok || count < 0) {
+	reset();
+	return false;
+    }
+    m_machine = static_cast<Cass80Machine>(machine);
+
+    m_blocks.reserve(count);
+    for (int i = 0; i < count; i++) {
+	Cass80Block b;
+	qint32 type, offs, len;
+	stream >> type >> b.csum >> b.addr >> b.size >> b.line >> offs >> len;
+	if (offs < 0 || len < 0 || offs > m_arena.size() - len)
+	    stream.setStatus(QDataStream::ReadCorruptData);
+	if (stream.status() != QDataStream::Ok)
+	    break;
+	b.type = static_cast<Cass80BlockType>(type);
+	b.offs = offs;
+	b.len = len;
+	m_blocks += b;
+    }
+    if (stream.status() != QDataStream::Ok || !m_digests.restore(stream)) {
+	reset();
+	return false;
+    }
+    set_arena(m_arena);
     return true;
 }
 
@@ -840,21 +1308,112 @@ int Cass80Handler::count() const
     return m_blocks.count();
 }
 
-CasBlockList Cass80Handler::blocks() const
+const CasBlockList& Cass80Handler::blocks() const
 {
     return m_blocks;
 }
 
-Cass80Block Cass80Handler::block(int index) const
+const Cass80Block& Cass80Handler::block(int index) const
 {
-    return m_blocks.value(index);
+    static const Cass80Block invalid;
+    if (index < 0 || index >= m_blocks.count())
+	return invalid;
+    return m_blocks[index];
 }
 
+/**
+ * @brief Return the detokenized BASIC source
+ *
+ * The lines are detokenized on the first call and kept until the
+ * blocks change, so that decoding and hashing an image never pays
+ * for them.
+ *
+ * @return QStringList with one line per BASIC block
+ */
 QStringList Cass80Handler::source() const
 {
+    if (!m_source_valid) {
+	m_source = source(0, m_blocks.count());
+	m_source_valid = true;
+    }
     return m_source;
 }
 
+/**
+ * @brief Return the detokenized BASIC source of some blocks
+ *
+ * Only the BT_BASIC blocks in the range are detokenized, unless
+ * source() already did so for all of them.
+ *
+ * @param first index of the first block
+ * @param count number of blocks
+ * @return QStringList with one line per BASIC block in the range
+ */
+QStringList Cass80Handler::source(int first, int count) const
+{
+    QStringList lines;
+    first = qBound(0, first, m_blocks.count());
+    count = qBound(0, count, m_blocks.count() - first);
+    if (m_source_valid && m_source.count() == m_blocks.count())
+	return m_source.mid(first, count);
+
+    lines.reserve(count);
+    for (int i = first; i < first + count; i++) {
+	const Cass80Block& b = m_blocks[i];
+	if (BT_BASIC == b.type)
+	    lines += QString("%1 %2")
+		     .arg(b.line)
+		     .arg(m_bas->detokenize(b.bytes(), b.size));
+    }
+    return lines;
+}
+
+/**
+ * @brief Return the entry addresses of a SYSTEM program
+ * @return QVector with the address of each BT_ENTRY block
+ */
+QVector<quint32> Cass80Handler::entries() const
+{
+    QVector<quint32> result;
+    foreach(const Cass80Block& b, m_blocks) {
+	if (BT_ENTRY == b.type)
+	    result += b.addr;
+    }
+    return result;
+}
+
+/**
+ * @brief Return the 64 KiB memory image of the SYSTEM blocks
+ *
+ * The memory is initialized with @p rom, if given, and then the
+ * payload of every BT_SYSTEM block is copied to its address.
+ *
+ * @param rom optional contents of the memory starting at 0000h
+ * @param pc_min optional pointer to store the lowest block address
+ * @param pc_max optional pointer to store the end of the highest block
+ * @return QByteArray with 64 KiB of memory
+ */
+QByteArray Cass80Handler::memory(const QByteArray& rom, quint16* pc_min, quint16* pc_max) const
+{
+    QByteArray memory(64*1024, 0x00);
+    memory.replace(0, qMin(rom.size(), memory.size()), rom.left(memory.size()));
+    quint16 min = 0xffff;
+    quint16 max = 0x0000;
+    foreach(const Cass80Block& b, m_blocks) {
+	if (b.type == BT_SYSTEM) {
+	    memory.replace(b.addr, b.size, b.data());
+	    min = qMin<quint16>(min, b.addr);
+	    max = qMax<quint16>(max, b.addr + b.size);
+	}
+    }
+    memory.resize(64*1024);
+    if (pc_min)
+	*pc_min = min;
+    if (pc_max)
+	*pc_max = max;
+    return memory;
+}
+
 bool Cass80Handler::set_blen(quint16 blen)
 {
     if (blen > 256) {
@@ -40,6 +40,8 @@
 #include "ui_cass80main.h"
 #include "cass80handler.h"
 #include "cass80xml.h"
+#include "cascache.h"
+#include "caswavencoder.h"
 
 #include "aboutdlg.h"
 #include "casinfodlg.h"
@@ -76,6 +78,7 @@ Cass80Main::Cass80Main(QWidget *parent)
     , m_fontsize(1.0)
     , m_internal_ttf(false)
     , m_uppercase(true)
+    , m_cache(new CasCache(CasCache::default_filename()))
 {
     ui->setupUi(this);
 
@@ -114,6 +117,7 @@ Cass80Main::~Cass80Main()
     QSettings s;
     s.setValue(key_splitter_state, ui->splitter->saveState());
     s.setValue(key_window_geometry, saveGeometry());
+    delete m_cache;
     delete ui;
 }
 
@@ -152,7 +156,7 @@ bool Cass80Main::load()
     QString directory = s.value(QLatin1String("directory")).toString();
     dlg.setFileMode(QFileDialog::ExistingFile);
     dlg.setDirectory(directory);
-    dlg.setNameFilter(tr("Cassette (*.cas)"));
+    dlg.setNameFilter(tr("Cassette (*.cas *.wav *.xml *.zip *.bas)"));
 
     if (QDialog::Accepted != dlg.exec())
 	return false;
@@ -165,57 +169,64 @@ bool Cass80Main::load()
     if (filename.isEmpty())
 	return false;
 
-    if (!m_cas->load(filename))
-	return false;
+#if USE_GENERATED_DEFS
+    const QString defs = QString("%1/%2")
+			 .arg(g_mysrcdir)
+			 .arg("cgenie-new.xml");
+#else
+    const QString defs = QString("%1/%2")
+			 .arg(resources)
+			 .arg("cgenie-dasm.xml");
+#endif
 
-    if (!m_cas->basic()) {
-	QFileInfo info(filename);
-	m_filepath = QDir::cleanPath(QString("%1/%2.%3")
-		     .arg(info.canonicalPath())
-		     .arg(info.baseName())
-		     .arg(QStringLiteral("out")));
+    // An unchanged image is restored from the cache with its listing
+    QStringList listing;
+    const QByteArray variant = QString("%1:%2").arg(m_uppercase).arg(defs).toUtf8();
+    const bool cached = m_cache->lookup(filename, m_cas, &listing, variant);
+    if (!cached && !m_cas->load(filename))
+	return false;
 
-	if (m_cas->has_lmoffset()) {
-	    Info(tr("Found LMOFFSET loader"));
-	}
+    // Recordings are saved as audio again, next to the recording
+    QFileInfo info(filename);
+    const QString suffix = info.suffix().toLower();
+    const bool recording = suffix == QLatin1String("wav") || suffix == QLatin1String("csw");
+    m_filepath = QDir::cleanPath(QString("%1/%2.%3")
+		 .arg(info.canonicalPath())
+		 .arg(info.baseName())
+		 .arg(recording ? QString("out.%1").arg(suffix) : QStringLiteral("out")));
+
+    if (!m_cas->basic() && m_cas->has_lmoffset()) {
+	Info(tr("Found LMOFFSET loader"));
     }
 
-    if (m_cas->basic()) {
-	set_listing(m_cas->source());
-    } else {
-	QByteArray memory(64*1024, 0x00);
-	QFile rom(QLatin1String(":/resources/cgenie.rom"));
-	if (rom.open(QIODevice::ReadOnly)) {
-	    QByteArray data = rom.readAll();
-	    memory.replace(0, data.size(), data);
-	    rom.close();
+    const bool render = listing.isEmpty();
+    if (render && m_cas->basic()) {
+	listing = m_cas->source();
+    } else if (render) {
+	QByteArray rom;
+	QFile file(QLatin1String(":/resources/cgenie.rom"));
+	if (file.open(QIODevice::ReadOnly)) {
+	    rom = file.readAll();
+	    file.close();
 	}
 	quint16 pc_min = 0xffff;
 	quint16 pc_max = 0x0000;
-	for (int i = 0; i < m_cas->count(); i++) {
-	    Cass80Block b = m_cas->block(i);
-	    if (b.type == BT_SYSTEM) {
-		memory.replace(b.addr, b.size, b.data);
-		pc_min = qMin<quint16>(pc_min, b.addr);
-		pc_max = qMax<quint16>(pc_max, b.addr + b.size);
-	    }
-	}
+	QByteArray memory = m_cas->memory(rom, &pc_min, &pc_max);
 
-#if USE_GENERATED_DEFS
-	z80Defs z80defs(QString("%1/%2")
-			.arg(g_mysrcdir)
-			.arg("cgenie-new.xml"));
-#else
-	z80Defs z80defs(QString("%1/%2")
-			.arg(resources)
-			.arg("cgenie-dasm.xml"));
-#endif
+	z80Defs z80defs(defs);
 	z80Dasm z80dasm(m_uppercase, &z80defs, m_bdf1);
 
+	z80dasm.discover(memory, m_cas->entries(), pc_min, pc_max, static_cast<quint32>(rom.size()));
 	pc_min = 0; // Always disassemble ROM as well
+	z80dasm.cross_reference(memory, pc_min, pc_max);
 
-	QStringList listing = z80dasm.listing(memory, pc_min, pc_max);
-	set_listing(listing);
+	listing = z80dasm.listing(memory, pc_min, pc_max);
+    }
+    set_listing(listing);
+
+    if (!cached || render) {
+	m_cache->insert(filename, m_cas, listing, variant);
+	m_cache->flush();
     }
 
 #if DEBUG_XML
@@ -232,8 +243,14 @@ bool Cass80Main::load()
 
 bool Cass80Main::save()
 {
-    if (m_cas->basic())
-	return false;
+    // Recordings are saved in the format they were loaded from,
+    // e.g. game.wav as game.out.wav
+    const QString suffix = QFileInfo(m_filepath).suffix().toLower();
+    if (suffix == QLatin1String("wav") || suffix == QLatin1String("csw")) {
+	CasWavEncoder enc;
+	connect(&enc, SIGNAL(Error(QString)), SLOT(Error(QString)));
+	return enc.encode(m_cas, m_filepath);
+    }
 
     m_cas->save(m_filepath);
     return true;
@@ -0,0 +1,374 @@
+/****************************************************************************
+ *
+ * Cass80 tool - tape images with multiple programs
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <QFile>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include "cass80handler.h"
+#include "cass80tape.h"
+#include "casscanner.h"
+#include "caswavdecoder.h"
+
+/**
+ * @brief Decode one program range of a tape in a pool thread
+ */
+class Cass80TapeWorker : public QRunnable
+{
+public:
+    Cass80TapeWorker(Cass80Handler* cas, const uchar* data, qint64 size)
+	: m_cas(cas)
+	, m_data(data)
+	, m_size(size)
+    {}
+
+    void run() override
+    {
+	m_cas->load(m_data, m_size);
+    }
+
+private:
+    Cass80Handler* m_cas;
+    const uchar* m_data;
+    qint64 m_size;
+};
+
+Cass80Tape::Cass80Tape(QObject* parent)
+    : QObject(parent)
+    , m_jobs(QThread::idealThreadCount())
+    , m_min_leadin(32)
+    , m_programs()
+    , m_offsets()
+{
+    if (m_jobs < 1)
+	m_jobs = 1;
+}
+
+Cass80Tape::~Cass80Tape()
+{
+    clear();
+}
+
+void Cass80Tape::clear()
+{
+    qDeleteAll(m_programs);
+    m_programs.clear();
+    m_offsets.clear();
+}
+
+bool Cass80Tape::isEmpty() const
+{
+    return m_programs.isEmpty();
+}
+
+int Cass80Tape::count() const
+{
+    return m_programs.count();
+}
+
+QList<Cass80Handler*> Cass80Tape::programs() const
+{
+    return m_programs;
+}
+
+Cass80Handler* Cass80Tape::program(int index) const
+{
+    return m_programs.value(index);
+}
+
+/**
+ * @brief Return the offset of a program in the tape image
+ * @param index program number
+ * @return offset of the program's lead-in, or -1 if @p index is invalid
+ */
+qint64 Cass80Tape::offset(int index) const
+{
+    if (index < 0 || index >= m_programs.count())
+	return -1;
+    return m_offsets[index];
+}
+
+/**
+ * @brief Return the size of a program's range in the tape image
+ * @param index program number
+ * @return number of bytes up to the next program, or -1 if @p index is invalid
+ */
+qint64 Cass80Tape::size(int index) const
+{
+    if (index < 0 || index >= m_programs.count())
+	return -1;
+    return m_offsets[index + 1] - m_offsets[index];
+}
+
+int Cass80Tape::jobs() const
+{
+    return m_jobs;
+}
+
+qint64 Cass80Tape::min_leadin() const
+{
+    return m_min_leadin;
+}
+
+void Cass80Tape::set_jobs(int jobs)
+{
+    m_jobs = jobs < 1 ? 1 : jobs;
+}
+
+void Cass80Tape::set_min_leadin(qint64 min_leadin)
+{
+    m_min_leadin = min_leadin;
+}
+
+bool Cass80Tape::load(const QString& filename)
+{
+    QFile input(filename);
+    bool res = false;
+    if (input.open(QIODevice::ReadOnly)) {
+	const qint64 size = input.size();
+	uchar* map = size > 0 ? input.map(0, size) : nullptr;
+	if (map) {
+	    res = load(map, size);
+	    input.unmap(map);
+	} else {
+	    res = load(input.readAll());
+	}
+	input.close();
+    }
+    return res;
+}
+
+bool Cass80Tape::load(const QByteArray& data)
+{
+    return load(reinterpret_cast<const uchar *>(data.constData()), data.size());
+}
+
+/**
+ * @brief Split a tape image into programs and decode them in parallel
+ *
+ * Each program range is decoded by its own Cass80Handler. If a
+ * program ends before it is complete, the boundary after it may be a
+ * false positive inside its data. The program decoded across the
+ * boundary replaces both if the next range is no complete program by
+ * itself, or if it is complete and uses bytes past the boundary. A
+ * truncated program followed by a valid one keeps both. Ranges
+ * without any blocks are dropped.
+ *
+ * @param data pointer to the tape image
+ * @param size number of bytes in the image
+ * @return true if at least one program was found
+ */
+bool Cass80Tape::load(const uchar* data, qint64 size)
+{
+    if (CasWavDecoder::is_wav(data, size)) {
+	CasWavDecoder wav;
+	connect(&wav, SIGNAL(Info(QString)), SIGNAL(Info(QString)));
+	connect(&wav, SIGNAL(Error(QString)), SIGNAL(Error(QString)));
+	if (!wav.decode(data, size))
+	    return false;
+	return load(wav.cas());
+    }
+
+    clear();
+    m_offsets = boundaries(data, size, m_min_leadin);
+    m_offsets += size;
+    for (int i = 0; i + 1 < m_offsets.count(); i++)
+	m_programs += new Cass80Handler();
+    decode(data, 0, m_programs.count());
+
+    int i = 0;
+    while (i + 1 < m_programs.count()) {
+	Cass80Handler* merged = m_programs[i]->complete() ? nullptr : merge(data, i);
+	if (!merged) {
+	    i++;
+	    continue;
+	}
+	delete m_programs[i];
+	m_programs[i] = merged;
+	delete m_programs.takeAt(i + 1);
+	m_offsets.remove(i + 1);
+    }
+
+    for (i = m_programs.count() - 1; i >= 0; i--) {
+	if (m_programs[i]->isEmpty()) {
+	    delete m_programs.takeAt(i);
+	    m_offsets.remove(i);
+	}
+    }
+    if (m_programs.isEmpty())
+	m_offsets.clear();
+
+    emit Info(tr("Found %1 programs on the tape.").arg(m_programs.count()));
+    return !m_programs.isEmpty();
+}
+
+/**
+ * @brief Decode the incomplete program @p index across the next boundary
+ *
+ * The messages of the merged program are emitted only if it is used.
+ *
+ * @param data pointer to the tape image
+ * @param index program number
+ * @return new Cass80Handler with the merged program, if the boundary
+ * after the program is a false positive, or nullptr otherwise
+ */
+Cass80Handler* Cass80Tape::merge(const uchar* data, int index)
+{
+    Cass80Handler* merged = new Cass80Handler();
+    Log log;
+    const QVector<QMetaObject::Connection> connections = collect(merged, &log);
+    const qint64 offs = m_offsets[index];
+    merged->load(data + offs, m_offsets[index + 2] - offs);
+    foreach(const QMetaObject::Connection& connection, connections)
+	disconnect(connection);
+
+    // If both decode, merge only if the program uses the bytes past the boundary
+    if (m_programs[index + 1]->complete() &&
+	!(merged->complete() && offs + merged->consumed() > m_offsets[index + 1])) {
+	delete merged;
+	return nullptr;
+    }
+    deliver(log);
+    return merged;
+}
+
+/**
+ * @brief Collect the messages of @p cas in @p log
+ * @param cas pointer to the Cass80Handler
+ * @param log pointer to the Log to append to
+ * @return connections to disconnect once @p cas is done
+ */
+QVector<QMetaObject::Connection> Cass80Tape::collect(Cass80Handler* cas, Log* log) const
+{
+    QVector<QMetaObject::Connection> connections;
+    connections += connect(cas, &Cass80Handler::Info, [log](QString message) {
+	*log += qMakePair(false, message);
+    });
+    connections += connect(cas, &Cass80Handler::Error, [log](QString message) {
+	*log += qMakePair(true, message);
+    });
+    return connections;
+}
+
+/**
+ * @brief Emit the messages collected in @p log in their order
+ * @param log const reference to the Log
+ */
+void Cass80Tape::deliver(const Log& log)
+{
+    foreach(const auto& message, log) {
+	if (message.first)
+	    emit Error(message.second);
+	else
+	    emit Info(message.second);
+    }
+}
+
+/**
+ * @brief Decode the programs @p first up to, but excluding, @p last
+ *
+ * The handlers report from the pool threads, where queued signals are
+ * never delivered while waiting for the pool. Their messages are
+ * collected per program and emitted in the order of the programs
+ * once all are decoded.
+ *
+ * @param data pointer to the tape image
+ * @param first first program number
+ * @param last program number after the last one to decode
+ */
+void Cass80Tape::decode(const uchar* data, int first, int last)
+{
+    QVector<Log> logs(last - first);
+    QVector<QMetaObject::Connection> connections;
+    for (int i = first; i < last; i++)
+	connections += collect(m_programs[i], &logs[i - first]);
+
+    if (last - first == 1 || m_jobs == 1) {
+	for (int i = first; i < last; i++)
+	    m_programs[i]->load(data + m_offsets[i], m_offsets[i + 1] - m_offsets[i]);
+    } else {
+	QThreadPool pool;
+	pool.setMaxThreadCount(m_jobs);
+	for (int i = first; i < last; i++)
+	    pool.start(new Cass80TapeWorker(m_programs[i], data + m_offsets[i],
+					    m_offsets[i + 1] - m_offsets[i]));
+	pool.waitForDone();
+    }
+
+    foreach(const QMetaObject::Connection& connection, connections)
+	disconnect(connection);
+    foreach(const Log& log, logs)
+	deliver(log);
+}
+
+/**
+ * @brief Return the offsets where programs start on a tape image
+ *
+ * The first program always starts at offset 0. Further programs start
+ * at a lead-in of at least @p min_leadin bytes whose sync byte is
+ * followed by a header in one of the known formats: a SYSTEM header,
+ * a TRS-80 BASIC header, or a Colour Genie BASIC name after a prelude.
+ *
+ * @param data pointer to the tape image
+ * @param size number of bytes in the image
+ * @param min_leadin minimum length of the lead-in
+ * @return list of start offsets in ascending order
+ */
+QVector<qint64> Cass80Tape::boundaries(const uchar* data, qint64 size, qint64 min_leadin)
+{
+    QVector<qint64> offsets;
+    offsets += 0;
+    if (min_leadin < 1)
+	min_leadin = 1;
+
+    const CasLeadInList leadins = CasScanner::scan(data, size, min_leadin);
+    foreach(const CasLeadIn& lead, leadins) {
+	if (lead.start <= offsets.last())
+	    continue;
+	const uchar* hdr = data + lead.sync + 1;
+	if (size - (lead.sync + 1) < 8)
+	    continue;
+	if (hdr[0] == CAS_SYSTEM_HEADER && hdr[7] == CAS_SYSTEM_DATA) {
+	    offsets += lead.start;
+	} else if (lead.sync_byte == CAS_TRS80_SYNC &&
+		   hdr[0] == CAS_TRS80_BASIC_HEADER &&
+		   hdr[1] == CAS_TRS80_BASIC_HEADER &&
+		   hdr[2] == CAS_TRS80_BASIC_HEADER) {
+	    offsets += lead.start;
+	} else if (lead.sync_byte == CAS_CGENIE_SYNC &&
+		   lead.fill == CAS_CGENIE_PRELUDE) {
+	    offsets += lead.start;
+	}
+    }
+    return offsets;
+}
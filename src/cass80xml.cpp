@@ -31,13 +31,21 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  ****************************************************************************/
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QXmlStreamReader>
 #include "cass80handler.h"
 #include "cass80xml.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define	CAS_XML_SSE2	1
+#endif
+
 static const QLatin1String cassette_dtd(
 "<!DOCTYPE cassette [\n"
 "   <!ATTLIST cassette sha1 CDATA #REQUIRED>\n"
-"   <!ELEMENT cassette (machine, format, name?, author?, copyright?, description?, sync, prefix?, blocks, image?, decoded?)>\n"
+"   <!ELEMENT cassette (machine, format, name?, author?, copyright?, description?, sync, prefix?, filename?, blocks, image?, decoded?)>\n"
 "           <!ELEMENT machine (trs80|eg2000)>\n"
 "           <!ELEMENT format (basic|system)>\n"
 "           <!ELEMENT name (#PCDATA)>\n"
@@ -46,6 +54,7 @@ static const QLatin1String cassette_dtd(
 "           <!ELEMENT description (#PCDATA)>\n"
 "           <!ELEMENT sync (#PCDATA)>\n"
 "           <!ELEMENT prefix (#PCDATA)>\n"
+"           <!ELEMENT filename (#PCDATA)>\n"
 "           <!ELEMENT blocks (block*)>\n"
 "                   <!ATTLIST blocks count CDATA #REQUIRED>\n"
 "                   <!ELEMENT block (#PCDATA)>\n"
@@ -63,10 +72,236 @@ static const QLatin1String cassette_dtd(
 "]>\n");
 
 
+static const char g_hex_digits[] = "0123456789abcdef";
+static const int g_chunk = 64 * 1024;
+
+#if CAS_XML_SSE2
+/** @brief Map 16 nibbles to the ASCII digits '0'-'9' and 'a'-'f' */
+static inline __m128i hex_digits(__m128i nibbles)
+{
+    const __m128i digits = _mm_add_epi8(nibbles, _mm_set1_epi8('0'));
+    const __m128i alpha = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+    return _mm_add_epi8(digits, _mm_and_si128(alpha, _mm_set1_epi8('a' - '0' - 10)));
+}
+#endif
+
+/**
+ * @brief Hex encode @p len bytes from @p src to @p dst, 16 bytes at a time
+ * @return pointer past the last digit written
+ */
+static char* hex_encode(char* dst, const uchar* src, int len)
+{
+    int i = 0;
+#if CAS_XML_SSE2
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    for (; i + 16 <= len; i += 16) {
+	const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+	const __m128i hi = hex_digits(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+	const __m128i lo = hex_digits(_mm_and_si128(v, mask));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+#endif
+    for (; i < len; i++) {
+	dst[2 * i + 0] = g_hex_digits[src[i] >> 4];
+	dst[2 * i + 1] = g_hex_digits[src[i] & 15];
+    }
+    return dst + 2 * len;
+}
+
+/**
+ * @brief Escape @p str the way QDomDocument writes text and attributes
+ *
+ * '<' and '&' are always escaped, '>' only after "]]", and carriage
+ * returns as character references. Attribute values also have their
+ * quotes, tabs and newlines escaped.
+ *
+ * @param str text to escape
+ * @param attribute true for an attribute value
+ * @return escaped text
+ */
+static QString escape(const QString& str, bool attribute)
+{
+    QString res;
+    res.reserve(str.size());
+    for (int i = 0; i < str.size(); i++) {
+	const QChar ch = str.at(i);
+	switch (ch.unicode()) {
+	case '<':
+	    res += QLatin1String("&lt;");
+	    break;
+	case '&':
+	    res += QLatin1String("&amp;");
+	    break;
+	case '>':
+	    if (i >= 2 && str.at(i - 1) == QChar(']') && str.at(i - 2) == QChar(']'))
+		res += QLatin1String("&gt;");
+	    else
+		res += ch;
+	    break;
+	case '"':
+	    res += attribute ? QLatin1String("&quot;") : QLatin1String("\"");
+	    break;
+	case '\t':
+	    res += attribute ? QLatin1String("&#x9;") : QLatin1String("\t");
+	    break;
+	case '\n':
+	    res += attribute ? QLatin1String("&#xa;") : QLatin1String("\n");
+	    break;
+	case '\r':
+	    res += QLatin1String("&#xd;");
+	    break;
+	default:
+	    res += ch;
+	}
+    }
+    return res;
+}
+
+/**
+ * @brief Decode the hex digits in @p text and append the bytes to @p dst
+ *
+ * The text of an element may arrive in several pieces, so a pending
+ * high nibble is carried over in @p nibble (-1 for none). Whitespace
+ * is skipped.
+ *
+ * @param dst reference to the QByteArray to append to
+ * @param text hex digits
+ * @param nibble reference to the pending high nibble
+ * @return true on success, or false on a character which is no hex digit
+ */
+static bool hex_decode(QByteArray& dst, const QStringRef& text, int& nibble)
+{
+    const QChar* src = text.constData();
+    const int len = text.size();
+    int size = dst.size();
+    dst.resize(size + (len + 1) / 2);
+    uchar* out = reinterpret_cast<uchar *>(dst.data());
+    for (int i = 0; i < len; i++) {
+	const ushort ch = src[i].unicode();
+	int value;
+	if (ch >= '0' && ch <= '9') {
+	    value = ch - '0';
+	} else if (ch >= 'a' && ch <= 'f') {
+	    value = ch - 'a' + 10;
+	} else if (ch >= 'A' && ch <= 'F') {
+	    value = ch - 'A' + 10;
+	} else if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+	    continue;
+	} else {
+	    dst.resize(size);
+	    return false;
+	}
+	if (nibble < 0) {
+	    nibble = value;
+	} else {
+	    out[size++] = static_cast<uchar>(16 * nibble + value);
+	    nibble = -1;
+	}
+    }
+    dst.resize(size);
+    return true;
+}
+
+/**
+ * @brief Buffered UTF-8 output of the XML text to a QIODevice
+ *
+ * The buffer is written out whenever it grows past g_chunk bytes,
+ * so memory use does not depend on the size of the image.
+ */
+class CasXmlOutput
+{
+public:
+    explicit CasXmlOutput(QIODevice* device)
+	: m_device(device)
+	, m_buff()
+	, m_ok(true)
+    {
+	m_buff.reserve(2 * g_chunk);
+    }
+
+    void put(const char* str)
+    {
+	m_buff += str;
+	drain();
+    }
+
+    void indent(int depth)
+    {
+	m_buff += QByteArray(4 * depth, ' ');
+    }
+
+    void attribute(const char* name, const QString& value)
+    {
+	m_buff += ' ';
+	m_buff += name;
+	m_buff += "=\"";
+	m_buff += escape(value, true).toUtf8();
+	m_buff += '"';
+    }
+
+    /** @brief Write a text only element on its own line */
+    void element(int depth, const char* name, const QString& text)
+    {
+	indent(depth);
+	m_buff += '<';
+	m_buff += name;
+	m_buff += '>';
+	m_buff += escape(text, false).toUtf8();
+	m_buff += "</";
+	m_buff += name;
+	m_buff += ">\n";
+	drain();
+    }
+
+    void hex(const uchar* src, int len)
+    {
+	while (len > 0) {
+	    const int n = qMin(len, g_chunk / 2);
+	    const int size = m_buff.size();
+	    m_buff.resize(size + 2 * n);
+	    hex_encode(m_buff.data() + size, src, n);
+	    src += n;
+	    len -= n;
+	    drain();
+	}
+    }
+
+    bool flush()
+    {
+	if (m_ok && !m_buff.isEmpty())
+	    m_ok = m_device->write(m_buff) == m_buff.size();
+	m_buff.resize(0);
+	return m_ok;
+    }
+
+private:
+    void drain()
+    {
+	if (m_buff.size() >= g_chunk)
+	    flush();
+    }
+
+    QIODevice* m_device;
+    QByteArray m_buff;
+    bool m_ok;
+};
+
 CasXml::CasXml(QObject* parent)
     : QObject(parent)
+    , m_sha1_digest()
+    , m_machine(MACH_INVALID)
+    , m_basic(false)
+    , m_hdr_name()
+    , m_hdr_author()
+    , m_hdr_copyright()
+    , m_hdr_description()
+    , m_sync(0)
+    , m_prefix(0)
+    , m_filename()
+    , m_blocks()
+    , m_digests()
 {
-
 }
 
 QByteArray CasXml::sha1_digest() const
@@ -124,10 +359,39 @@ CasBlockList CasXml::blocks() const
     return m_blocks;
 }
 
+const CasDigests& CasXml::digests() const
+{
+    return m_digests;
+}
+
+/**
+ * @brief Return true if the @p data looks like a cassette XML description
+ * @param data pointer to the first bytes of a file
+ * @param size number of bytes available
+ * @return true if it starts with an XML declaration or the cassette doctype
+ */
+bool CasXml::is_xml(const uchar* data, qint64 size)
+{
+    qint64 offs = 0;
+    if (size >= 3 && data[0] == 0xef && data[1] == 0xbb && data[2] == 0xbf)
+	offs = 3;
+    while (offs < size && (data[offs] == ' ' || data[offs] == '\t' ||
+			   data[offs] == '\n' || data[offs] == '\r'))
+	offs++;
+    const QByteArray head = QByteArray::fromRawData(reinterpret_cast<const char *>(data) + offs,
+						    static_cast<int>(qMin<qint64>(size - offs, 32)));
+    return head.startsWith("<?xml") ||
+	    head.startsWith("<!DOCTYPE cassette") ||
+	    head.startsWith("<cassette");
+}
+
 QString CasXml::toXml() const
 {
-    QDomDocument doc = cas_document();
-    return doc.toString(4);
+    QByteArray xml;
+    QBuffer buffer(&xml);
+    buffer.open(QIODevice::WriteOnly);
+    write(&buffer);
+    return QString::fromUtf8(xml);
 }
 
 void CasXml::set_data(const Cass80Handler* h)
@@ -144,6 +408,7 @@ void CasXml::set_data(const Cass80Handler* h)
     set_prefix(h->prefix());
     set_filename(h->filename());
     set_blocks(h->blocks());
+    set_digests(h->digests());
 }
 
 void CasXml::set_sha1_digest(const QByteArray& digest)
@@ -231,14 +496,102 @@ void CasXml::set_blocks(const CasBlockList& blocks)
     if (blocks == m_blocks)
 	return;
     m_blocks = blocks;
+    // The block digests have to be computed again for these blocks
+    m_digests.blocks.clear();
+    m_digests.image.clear();
     emit blocks_changed(m_blocks);
 }
 
-QDomElement CasXml::block_element(QDomDocument& doc, int index) const
+/**
+ * @brief Set the digests of the image
+ * If they contain the block digests, the XML export uses them
+ * instead of hashing the blocks.
+ * @param digests const reference to the CasDigests
+ */
+void CasXml::set_digests(const CasDigests& digests)
+{
+    m_digests = digests;
+}
+
+/**
+ * @brief Write the XML description of the image to @p device
+ *
+ * The text is produced while it is written: nothing but a bounded
+ * output buffer is held in memory, and the payloads are hex encoded
+ * straight from the blocks. The layout is that of QDomDocument's
+ * toString(4), with the attributes in a fixed order.
+ *
+ * @param device pointer to a QIODevice opened for writing
+ * @return true on success, or false if writing failed
+ */
+bool CasXml::write(QIODevice* device) const
+{
+    CasXmlOutput out(device);
+    QString str;
+
+    out.put("<!DOCTYPE cassette>\n<cassette>\n");
+
+    switch (m_machine) {
+    case MACH_INVALID:
+	 str = QStringLiteral("invalid");
+	break;
+    case MACH_TRS80:
+	 str = QStringLiteral("trs80");
+	break;
+    case MACH_EG2000:
+	 str = QStringLiteral("eg2000");
+	break;
+    }
+    out.element(1, "machine", str);
+    out.element(1, "format", m_basic ? QStringLiteral("basic") : QStringLiteral("system"));
+    out.element(1, "name", m_hdr_name);
+    out.element(1, "author", m_hdr_author);
+    out.element(1, "copyright", m_hdr_copyright);
+    out.element(1, "description", m_hdr_description);
+    out.element(1, "sync", QString("0x%1").arg(m_sync, 2, 16, QChar('0')));
+    out.element(1, "prefix", QString("0x%1").arg(m_prefix, 2, 16, QChar('0')));
+    // The tape header bytes may be anything, including NUL
+    out.element(1, "filename", QString::fromLatin1(m_filename.toLatin1().toHex()));
+
+    CasDigests digests = m_digests;
+    if (!digests.has_blocks(m_blocks.count()))
+	digests.hash_blocks(m_blocks);
+
+    out.indent(1);
+    out.put("<blocks");
+    out.attribute("count", QString::number(m_blocks.count()));
+    if (m_blocks.isEmpty()) {
+	out.put("/>\n");
+    } else {
+	out.put(">\n");
+	for (int i = 0; i < m_blocks.count(); i++)
+	    write_block(out, i, digests.blocks[i]);
+	out.indent(1);
+	out.put("</blocks>\n");
+    }
+
+    int image_size = 0;
+    foreach(const Cass80Block& b, m_blocks)
+	image_size += b.len;
+    out.indent(1);
+    out.put("<image");
+    out.attribute("size", QString::number(image_size));
+    out.attribute("sha1", QString::fromLatin1(digests.image.toHex()));
+    out.put(">");
+    foreach(const Cass80Block& b, m_blocks)
+	out.hex(b.bytes(), b.len);
+    out.put("</image>\n");
+
+    out.put("</cassette>\n");
+    return out.flush();
+}
+
+void CasXml::write_block(CasXmlOutput& out, int index, const QByteArray& sha1) const
 {
     const Cass80Block& b = m_blocks[index];
-    QDomElement block = doc.createElement(QLatin1String("block"));
-    block.setAttribute(QLatin1String("number"), index);
+    out.indent(2);
+    out.put("<block");
+    out.attribute("number", QString::number(index));
 
     QString str = QLatin1String("invalid");
     switch (b.type) {
@@ -257,107 +610,232 @@ QDomElement CasXml::block_element(QDomDocument& doc, int index) const
 	str = QStringLiteral("raw");
 	break;
     }
-    block.setAttribute(QLatin1String("type"), str);
-    block.setAttribute(QLatin1String("address"), QString("0x%1").arg(b.addr, 4, 16, QChar('0')));
-    if (b.type == BT_ENTRY)
-	return block;
+    out.attribute("type", str);
+    out.attribute("address", QString("0x%1").arg(b.addr, 4, 16, QChar('0')));
+    if (b.type == BT_ENTRY) {
+	out.put("/>\n");
+	return;
+    }
 
-    block.setAttribute(QLatin1String("size"), QString("0x%1").arg(b.size, 4, 16, QChar('0')));
+    out.attribute("size", QString("0x%1").arg(b.size, 4, 16, QChar('0')));
     if (m_basic)
-	block.setAttribute(QLatin1String("line"), b.line);
-    block.setAttribute(QLatin1String("csum"), QString("0x%1").arg(b.csum, 2, 16, QChar('0')));
-
-    QByteArray hash = QCryptographicHash::hash(b.data, QCryptographicHash::Sha1);
-    block.setAttribute(QLatin1String("sha1"), QString::fromLatin1(hash.toHex()));
-    QDomText txt = doc.createTextNode(QString::fromLatin1(b.data.toHex()));
-    block.appendChild(txt);
-
-    return block;
+	out.attribute("line", QString::number(b.line));
+    out.attribute("csum", QString("0x%1").arg(b.csum, 2, 16, QChar('0')));
+    out.attribute("sha1", QString::fromLatin1(sha1.toHex()));
+    out.put(">");
+    out.hex(b.bytes(), b.len);
+    out.put("</block>\n");
 }
 
-QDomDocument CasXml::cas_document() const
+/**
+ * @brief Read a cassette XML description from @p device
+ *
+ * The hex text of the blocks is decoded straight into one arena shared
+ * by all blocks. The SHA1 of every block and the SHA1 and size of the
+ * image are checked against their attributes while parsing; the hex
+ * text of the image itself is skipped, since it is the concatenation
+ * of the blocks. Entry blocks are written without payload and get the
+ * payload of the block before them back, as the handler decodes them.
+ *
+ * @param device pointer to a QIODevice opened for reading
+ * @return true on success, or false on error
+ */
+bool CasXml::read(QIODevice* device)
 {
-    QDomDocument doc(QLatin1String("cassette"));
-    QDomNode root = doc.createElement(QLatin1String("cassette"));
-    QDomText txt;
-    QString str;
+    QXmlStreamReader xml(device);
+    CasBlockList blocks;
+    CasDigests digests;
+    QByteArray arena;
+    QByteArray image_sha1;
+    qint64 image_size = -1;
+    Cass80Machine machine = MACH_INVALID;
+    bool basic = false;
+    QString hdr_name, hdr_author, hdr_copyright, hdr_description;
+    QString filename;
+    uint sync = 0, prefix = 0;
+    bool ok = true;
+
+    if (!xml.readNextStartElement() || xml.name() != QLatin1String("cassette")) {
+	emit Error(tr("Not a cassette XML description."));
+	return false;
+    }
 
-    QDomElement machine = doc.createElement(QLatin1String("machine"));
-    switch (m_machine) {
-    case MACH_INVALID:
-	 str = QStringLiteral("invalid");
-	break;
-    case MACH_TRS80:
-	 str = QStringLiteral("trs80");
-	break;
-    case MACH_EG2000:
-	 str = QStringLiteral("eg2000");
-	break;
+    while (ok && xml.readNextStartElement()) {
+	const QString name = xml.name().toString();
+	if (name == QLatin1String("machine")) {
+	    const QString str = xml.readElementText();
+	    if (str == QLatin1String("trs80"))
+		machine = MACH_TRS80;
+	    else if (str == QLatin1String("eg2000"))
+		machine = MACH_EG2000;
+	} else if (name == QLatin1String("format")) {
+	    basic = xml.readElementText() == QLatin1String("basic");
+	} else if (name == QLatin1String("name")) {
+	    hdr_name = xml.readElementText();
+	} else if (name == QLatin1String("author")) {
+	    hdr_author = xml.readElementText();
+	} else if (name == QLatin1String("copyright")) {
+	    hdr_copyright = xml.readElementText();
+	} else if (name == QLatin1String("description")) {
+	    hdr_description = xml.readElementText();
+	} else if (name == QLatin1String("sync")) {
+	    sync = xml.readElementText().toUInt(nullptr, 0);
+	} else if (name == QLatin1String("prefix")) {
+	    prefix = xml.readElementText().toUInt(nullptr, 0);
+	} else if (name == QLatin1String("filename")) {
+	    filename = QString::fromLatin1(QByteArray::fromHex(xml.readElementText().toLatin1()));
+	} else if (name == QLatin1String("blocks")) {
+	    const int count = xml.attributes().value(QLatin1String("count")).toInt();
+	    blocks.reserve(count);
+	    digests.blocks.reserve(count);
+	    while (ok && xml.readNextStartElement()) {
+		if (xml.name() == QLatin1String("block"))
+		    ok = read_block(xml, arena, blocks, digests.blocks);
+		else
+		    xml.skipCurrentElement();
+	    }
+	} else if (name == QLatin1String("image")) {
+	    const QXmlStreamAttributes attr = xml.attributes();
+	    image_size = attr.value(QLatin1String("size")).toLongLong();
+	    image_sha1 = QByteArray::fromHex(attr.value(QLatin1String("sha1")).toLatin1());
+	    xml.skipCurrentElement();
+	} else {
+	    xml.skipCurrentElement();
+	}
     }
-    txt = doc.createTextNode(str);
-    machine.appendChild(txt);
-    root.appendChild(machine);
 
-    QDomElement format = doc.createElement(QLatin1String("format"));
-    if (m_basic) {
-	str = QStringLiteral("basic");
-    } else {
-	str = QStringLiteral("system");
+    if (xml.hasError()) {
+	emit Error(tr("XML error in line %1, column %2: %3")
+		   .arg(xml.lineNumber())
+		   .arg(xml.columnNumber())
+		   .arg(xml.errorString()));
+	return false;
     }
-    txt = doc.createTextNode(str);
-    format.appendChild(txt);
-    root.appendChild(format);
-
-    QDomElement name = doc.createElement(QLatin1String("name"));
-    txt = doc.createTextNode(m_hdr_name);
-    name.appendChild(txt);
-    root.appendChild(name);
-
-    QDomElement author = doc.createElement(QLatin1String("author"));
-    txt = doc.createTextNode(m_hdr_author);
-    author.appendChild(txt);
-    root.appendChild(author);
-
-    QDomElement copyright = doc.createElement(QLatin1String("copyright"));
-    txt = doc.createTextNode(m_hdr_copyright);
-    copyright.appendChild(txt);
-    root.appendChild(copyright);
-
-    QDomElement description = doc.createElement(QLatin1String("description"));
-    txt = doc.createTextNode(m_hdr_description);
-    description.appendChild(txt);
-    root.appendChild(description);
-
-    QDomElement sync = doc.createElement(QLatin1String("sync"));
-    txt = doc.createTextNode(QString("0x%1").arg(m_sync, 2, 16, QChar('0')));
-    sync.appendChild(txt);
-    root.appendChild(sync);
-
-    QDomElement prefix = doc.createElement(QLatin1String("prefix"));
-    txt = doc.createTextNode(QString("0x%1").arg(m_prefix, 2, 16, QChar('0')));
-    prefix.appendChild(txt);
-    root.appendChild(prefix);
-
-    QDomElement blocks = doc.createElement(QLatin1String("blocks"));
-    blocks.setAttribute(QLatin1String("count"), m_blocks.count());
-
-    QByteArray image_data;
-    for (int i = 0; i < m_blocks.count(); i++) {
-	blocks.appendChild(block_element(doc, i));
-	image_data += m_blocks[i].data;
+    if (!ok)
+	return false;
+
+    // The image is the concatenation of the block payloads, including
+    // those entry blocks share with the block before them
+    QCryptographicHash h_image(QCryptographicHash::Sha1);
+    digests.image_size = 0;
+    foreach(const Cass80Block& b, blocks) {
+	h_image.addData(arena.constData() + b.offs, b.len);
+	digests.image_size += b.len;
+    }
+    digests.image = h_image.result();
+    if (image_size >= 0 && image_size != digests.image_size) {
+	emit Error(tr("Image size mismatch (found:%1 calc:%2).")
+		   .arg(image_size)
+		   .arg(digests.image_size));
+	return false;
+    }
+    if (!image_sha1.isEmpty() && image_sha1 != digests.image) {
+	emit Error(tr("Image SHA1 mismatch (found:%1 calc:%2).")
+		   .arg(QString::fromLatin1(image_sha1.toHex()))
+		   .arg(QString::fromLatin1(digests.image.toHex())));
+	return false;
     }
 
-    root.appendChild(blocks);
+    for (int i = 0; i < blocks.count(); i++)
+	blocks[i].arena = arena;
+
+    set_machine(machine);
+    set_basic(basic);
+    set_hdr_name(hdr_name);
+    set_hdr_author(hdr_author);
+    set_hdr_copyright(hdr_copyright);
+    set_hdr_description(hdr_description);
+    set_sync(static_cast<quint8>(sync));
+    set_prefix(static_cast<quint8>(prefix));
+    set_filename(filename);
+    set_blocks(blocks);
+    set_digests(digests);
+    emit Info(tr("Read %1 blocks (%2 bytes).").arg(blocks.count()).arg(arena.size()));
+    return true;
+}
 
-    QDomElement image = doc.createElement(QLatin1String("image"));
-    image.setAttribute(QLatin1String("size"), image_data.size());
-    QByteArray hash = QCryptographicHash::hash(image_data, QCryptographicHash::Sha1);
-    image.setAttribute(QLatin1String("sha1"), QString::fromLatin1(hash.toHex()));
-    txt = doc.createTextNode(QString::fromLatin1(image_data.toHex()));
-    image.appendChild(txt);
+/**
+ * @brief Read one block element, decoding its hex text into @p arena
+ * @param xml reference to the QXmlStreamReader positioned at the block
+ * @param arena reference to the arena to append the payload to
+ * @param blocks reference to the list of blocks to append to
+ * @param sha1 reference to the list of block digests to append to
+ * @return true on success, or false on error
+ */
+bool CasXml::read_block(QXmlStreamReader& xml, QByteArray& arena, CasBlockList& blocks,
+			QVector<QByteArray>& sha1)
+{
+    const QXmlStreamAttributes attr = xml.attributes();
+    const int number = attr.value(QLatin1String("number")).toInt();
+    const QStringRef type = attr.value(QLatin1String("type"));
+    Cass80Block b;
+
+    if (type == QLatin1String("basic"))
+	b.type = BT_BASIC;
+    else if (type == QLatin1String("system"))
+	b.type = BT_SYSTEM;
+    else if (type == QLatin1String("entry"))
+	b.type = BT_ENTRY;
+    else if (type == QLatin1String("raw"))
+	b.type = BT_RAW;
+    b.addr = static_cast<quint16>(attr.value(QLatin1String("address")).toString().toUInt(nullptr, 0));
+    b.size = static_cast<quint16>(attr.value(QLatin1String("size")).toString().toUInt(nullptr, 0));
+    b.line = static_cast<quint16>(attr.value(QLatin1String("line")).toUInt());
+    b.csum = static_cast<uchar>(attr.value(QLatin1String("csum")).toString().toUInt(nullptr, 0));
+    const QByteArray expected = QByteArray::fromHex(attr.value(QLatin1String("sha1")).toLatin1());
+
+    b.offs = arena.size();
+    int nibble = -1;
+    while (!xml.atEnd()) {
+	const QXmlStreamReader::TokenType token = xml.readNext();
+	if (token == QXmlStreamReader::EndElement)
+	    break;
+	if (token == QXmlStreamReader::StartElement) {
+	    xml.skipCurrentElement();
+	} else if (token == QXmlStreamReader::Characters &&
+		   !hex_decode(arena, xml.text(), nibble)) {
+	    emit Error(tr("Block #%1 contains invalid hex data.").arg(number));
+	    return false;
+	}
+    }
+    if (nibble >= 0) {
+	emit Error(tr("Block #%1 has an odd number of hex digits.").arg(number));
+	return false;
+    }
 
-    root.appendChild(image);
+    b.len = arena.size() - b.offs;
+
+    // Rebuild the payload of an entry block the way the handler leaves it:
+    // it keeps the payload and checksum of the block before it, and an
+    // entry block following an entry block carries 1 KiB of zeroes
+    if (b.type == BT_ENTRY && !blocks.isEmpty()) {
+	const Cass80Block& prev = blocks.last();
+	b.csum = prev.csum;
+	if (prev.type == BT_ENTRY) {
+	    b.offs = arena.size();
+	    b.len = 1024;
+	    arena.append(QByteArray(1024, 0x00));
+	} else {
+	    b.offs = prev.offs;
+	    b.len = prev.len;
+	}
+    }
 
-    doc.appendChild(root);
-    return doc;
+    if (b.type == BT_ENTRY) {
+	sha1 += QByteArray();
+    } else {
+	QCryptographicHash h_block(QCryptographicHash::Sha1);
+	h_block.addData(arena.constData() + b.offs, b.len);
+	const QByteArray digest = h_block.result();
+	if (!expected.isEmpty() && expected != digest) {
+	    emit Error(tr("Block #%1 SHA1 mismatch (found:%2 calc:%3).")
+		       .arg(number)
+		       .arg(QString::fromLatin1(expected.toHex()))
+		       .arg(QString::fromLatin1(digest.toHex())));
+	    return false;
+	}
+	sha1 += digest;
+    }
+    blocks += b;
+    return true;
 }
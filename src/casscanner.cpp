@@ -0,0 +1,275 @@
+/****************************************************************************
+ *
+ * Cass80 tool - cassette lead-in and sync scanner
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <QtAlgorithms>
+#include "casscanner.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define	CAS_SCAN_SSE2	1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define	CAS_SCAN_AVX2	1
+#endif
+
+/**
+ * @brief Scanner state carried from one 32 byte chunk to the next
+ *
+ * The chunk kernels only classify bytes into bit masks. Everything
+ * else is done on the masks, so the SIMD and scalar variants share
+ * the code that turns sync bits into CasLeadIn entries.
+ */
+class CasScanState
+{
+public:
+    CasScanState(const uchar* data, qint64 min_run, int max_count, CasLeadInList& list)
+	: m_data(data)
+	, m_min_run(min_run)
+	, m_max_count(max_count)
+	, m_last_other(-1)
+	, m_last_prelude(-1)
+	, m_list(list)
+    {}
+
+    /**
+     * @brief Process the masks for the 32 bytes starting at @p base
+     * @param base offset of the first byte of the chunk
+     * @param sync bit mask of CAS_TRS80_SYNC and CAS_CGENIE_SYNC bytes
+     * @param other bit mask of bytes which are neither silence nor prelude
+     * @param prelude bit mask of CAS_CGENIE_PRELUDE bytes
+     * @return false if max_count lead-ins were found, true otherwise
+     */
+    inline bool chunk(qint64 base, quint32 sync, quint32 other, quint32 prelude)
+    {
+	while (sync) {
+	    const int bit = qCountTrailingZeroBits(sync);
+	    const quint32 below = (1u << bit) - 1;
+	    const qint64 last_other = (other & below) ? base + highest(other & below) : m_last_other;
+	    const qint64 last_prelude = (prelude & below) ? base + highest(prelude & below) : m_last_prelude;
+	    CasLeadIn lead;
+	    lead.start = last_other + 1;
+	    lead.sync = base + bit;
+	    if (lead.length() >= m_min_run || 0 == lead.start) {
+		lead.sync_byte = m_data[lead.sync];
+		lead.fill = last_prelude >= lead.start ? CAS_CGENIE_PRELUDE : CAS_SILENCE;
+		m_list += lead;
+		if (m_max_count > 0 && m_list.count() >= m_max_count)
+		    return false;
+	    }
+	    sync &= sync - 1;
+	}
+	if (other)
+	    m_last_other = base + highest(other);
+	if (prelude)
+	    m_last_prelude = base + highest(prelude);
+	return true;
+    }
+
+private:
+    static inline int highest(quint32 mask)
+    {
+	return 31 - qCountLeadingZeroBits(mask);
+    }
+
+    const uchar* m_data;
+    qint64 m_min_run;
+    int m_max_count;
+    qint64 m_last_other;
+    qint64 m_last_prelude;
+    CasLeadInList& m_list;
+};
+
+/**
+ * @brief Classify up to 32 bytes one at a time
+ * @param data pointer to the bytes
+ * @param count number of bytes (1 ... 32)
+ * @param sync returns the mask of sync bytes
+ * @param other returns the mask of non lead-in bytes
+ * @param prelude returns the mask of prelude bytes
+ */
+static inline void masks_scalar(const uchar* data, int count, quint32& sync, quint32& other, quint32& prelude)
+{
+    sync = other = prelude = 0;
+    for (int i = 0; i < count; i++) {
+	const quint32 bit = 1u << i;
+	switch (data[i]) {
+	case CAS_SILENCE:
+	    break;
+	case CAS_CGENIE_PRELUDE:
+	    prelude |= bit;
+	    break;
+	case CAS_TRS80_SYNC:
+	case CAS_CGENIE_SYNC:
+	    sync |= bit;
+	    other |= bit;
+	    break;
+	default:
+	    other |= bit;
+	}
+    }
+}
+
+#if !CAS_SCAN_SSE2
+static qint64 scan_scalar(const uchar* data, qint64 size, CasScanState& state)
+{
+    quint32 sync, other, prelude;
+    qint64 offs;
+    for (offs = 0; offs + 32 <= size; offs += 32) {
+	masks_scalar(data + offs, 32, sync, other, prelude);
+	if (!state.chunk(offs, sync, other, prelude))
+	    return size;
+    }
+    return offs;
+}
+#endif
+
+#if CAS_SCAN_SSE2
+static quint32 movemask_sse2(__m128i v0, __m128i v1)
+{
+    return static_cast<quint32>(_mm_movemask_epi8(v0) & 0xffff) |
+	(static_cast<quint32>(_mm_movemask_epi8(v1) & 0xffff) << 16);
+}
+
+static qint64 scan_sse2(const uchar* data, qint64 size, CasScanState& state)
+{
+    const __m128i silence = _mm_set1_epi8(static_cast<char>(CAS_SILENCE));
+    const __m128i prelude = _mm_set1_epi8(static_cast<char>(CAS_CGENIE_PRELUDE));
+    const __m128i trs80 = _mm_set1_epi8(static_cast<char>(CAS_TRS80_SYNC));
+    const __m128i cgenie = _mm_set1_epi8(static_cast<char>(CAS_CGENIE_SYNC));
+    qint64 offs;
+    for (offs = 0; offs + 32 <= size; offs += 32) {
+	const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offs));
+	const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offs + 16));
+	const __m128i p0 = _mm_cmpeq_epi8(v0, prelude);
+	const __m128i p1 = _mm_cmpeq_epi8(v1, prelude);
+	const __m128i f0 = _mm_or_si128(p0, _mm_cmpeq_epi8(v0, silence));
+	const __m128i f1 = _mm_or_si128(p1, _mm_cmpeq_epi8(v1, silence));
+	const __m128i s0 = _mm_or_si128(_mm_cmpeq_epi8(v0, trs80), _mm_cmpeq_epi8(v0, cgenie));
+	const __m128i s1 = _mm_or_si128(_mm_cmpeq_epi8(v1, trs80), _mm_cmpeq_epi8(v1, cgenie));
+	const quint32 m_sync = movemask_sse2(s0, s1);
+	const quint32 m_other = ~movemask_sse2(f0, f1);
+	const quint32 m_prelude = movemask_sse2(p0, p1);
+	if (!state.chunk(offs, m_sync, m_other, m_prelude))
+	    return size;
+    }
+    return offs;
+}
+#endif
+
+#if CAS_SCAN_AVX2
+__attribute__((target("avx2")))
+static qint64 scan_avx2(const uchar* data, qint64 size, CasScanState& state)
+{
+    const __m256i silence = _mm256_set1_epi8(static_cast<char>(CAS_SILENCE));
+    const __m256i prelude = _mm256_set1_epi8(static_cast<char>(CAS_CGENIE_PRELUDE));
+    const __m256i trs80 = _mm256_set1_epi8(static_cast<char>(CAS_TRS80_SYNC));
+    const __m256i cgenie = _mm256_set1_epi8(static_cast<char>(CAS_CGENIE_SYNC));
+    qint64 offs;
+    for (offs = 0; offs + 32 <= size; offs += 32) {
+	const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + offs));
+	const __m256i p = _mm256_cmpeq_epi8(v, prelude);
+	const __m256i f = _mm256_or_si256(p, _mm256_cmpeq_epi8(v, silence));
+	const __m256i s = _mm256_or_si256(_mm256_cmpeq_epi8(v, trs80), _mm256_cmpeq_epi8(v, cgenie));
+	const quint32 m_sync = static_cast<quint32>(_mm256_movemask_epi8(s));
+	const quint32 m_other = ~static_cast<quint32>(_mm256_movemask_epi8(f));
+	const quint32 m_prelude = static_cast<quint32>(_mm256_movemask_epi8(p));
+	if (!state.chunk(offs, m_sync, m_other, m_prelude))
+	    return size;
+    }
+    return offs;
+}
+
+static bool has_avx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+/**
+ * @brief Return the name of the instruction set used by scan()
+ * @return "avx2", "sse2", or "scalar"
+ */
+const char* CasScanner::isa()
+{
+#if CAS_SCAN_AVX2
+    if (has_avx2())
+	return "avx2";
+#endif
+#if CAS_SCAN_SSE2
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+/**
+ * @brief Find all lead-ins followed by a sync byte in a single pass
+ *
+ * Every CAS_TRS80_SYNC or CAS_CGENIE_SYNC byte preceded by at least
+ * @p min_run bytes of CAS_SILENCE and/or CAS_CGENIE_PRELUDE is
+ * reported. A sync byte preceded only by lead-in bytes back to the
+ * start of @p data is always reported, even with a shorter run.
+ *
+ * @param data pointer to the cassette image bytes
+ * @param size number of bytes
+ * @param min_run minimum length of the lead-in run
+ * @param max_count stop after this many lead-ins; -1 for no limit
+ * @return list of CasLeadIn entries in ascending order
+ */
+CasLeadInList CasScanner::scan(const uchar* data, qint64 size, qint64 min_run, int max_count)
+{
+    CasLeadInList list;
+    CasScanState state(data, min_run, max_count, list);
+    qint64 offs;
+
+#if CAS_SCAN_AVX2
+    if (has_avx2()) {
+	offs = scan_avx2(data, size, state);
+    } else
+#endif
+#if CAS_SCAN_SSE2
+    offs = scan_sse2(data, size, state);
+#else
+    offs = scan_scalar(data, size, state);
+#endif
+
+    if (offs < size) {
+	quint32 sync, other, prelude;
+	masks_scalar(data + offs, static_cast<int>(size - offs), sync, other, prelude);
+	state.chunk(offs, sync, other, prelude);
+    }
+    return list;
+}
@@ -0,0 +1,252 @@
+/****************************************************************************
+ *
+ * Cass80 tool - near duplicate detection
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <algorithm>
+#include <cstring>
+#include "cassimilar.h"
+#include "cass80handler.h"
+
+//! Limit of the comparisons of one image with the others in a bucket
+static const int g_max_compare = 64;
+
+/**
+ * @brief Mix the bits of @p x (splitmix64 finalizer)
+ */
+static inline quint64 mix64(quint64 x)
+{
+    x ^= x >> 30;
+    x *= Q_UINT64_C(0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x *= Q_UINT64_C(0x94d049bb133111eb);
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * @brief Return the multipliers and addends of the SIGNATURE hash functions
+ *
+ * Function i maps the mixed shingle x to the upper 32 bits of
+ * a[i] * x + b[i]. The constants are derived from a fixed seed, so
+ * signatures stay comparable between runs.
+ */
+static const quint64* coefficients()
+{
+    static const struct Table {
+	quint64 ab[2 * CasSimilar::SIGNATURE];
+	Table() {
+	    quint64 seed = Q_UINT64_C(0x43617373383053ff);
+	    for (int i = 0; i < 2 * CasSimilar::SIGNATURE; i++) {
+		seed += Q_UINT64_C(0x9e3779b97f4a7c15);
+		ab[i] = mix64(seed) | 1;
+	    }
+	}
+    } table;
+    return table.ab;
+}
+
+CasSimilar::CasSimilar(double threshold)
+    : m_threshold(threshold)
+    , m_names()
+    , m_signatures()
+    , m_buckets()
+{
+}
+
+/**
+ * @brief Return the signature of the program in @p cas
+ *
+ * For SYSTEM images it is the signature of the loaded address range of
+ * the memory image, for BASIC programs that of the source text with the
+ * line numbers removed, so that a renumbered program is still similar.
+ *
+ * @param cas pointer to the Cass80Handler
+ * @return the signature, or an empty one if there is nothing to compare
+ */
+CasSimilar::Signature CasSimilar::signature(const Cass80Handler* cas)
+{
+    if (cas->basic()) {
+	QByteArray text;
+	foreach(const QString& line, cas->source()) {
+	    const int space = line.indexOf(QChar(' '));
+	    text += line.mid(space + 1).toLatin1();
+	    text += '\n';
+	}
+	return signature(text);
+    }
+    quint16 min, max;
+    const QByteArray memory = cas->memory(QByteArray(), &min, &max);
+    if (min >= max)
+	return Signature();
+    return signature(memory.mid(min, max - min));
+}
+
+/**
+ * @brief Return the MinHash signature of the shingles of @p data
+ * @param data bytes to shingle
+ * @return the signature, or an empty one if @p data is shorter than a shingle
+ */
+CasSimilar::Signature CasSimilar::signature(const QByteArray& data)
+{
+    if (data.size() < SHINGLE)
+	return Signature();
+
+    // The set of shingles; runs of equal bytes collapse into one
+    const uchar* p = reinterpret_cast<const uchar *>(data.constData());
+    const int n = data.size() - SHINGLE + 1;
+    QVector<quint64> shingles(n);
+    for (int i = 0; i < n; i++) {
+	quint64 x;
+	memcpy(&x, p + i, sizeof(x));
+	shingles[i] = mix64(x);
+    }
+    std::sort(shingles.begin(), shingles.end());
+    shingles.erase(std::unique(shingles.begin(), shingles.end()), shingles.end());
+
+    const quint64* a = coefficients();
+    const quint64* b = a + SIGNATURE;
+    quint32 mins[SIGNATURE];
+    std::fill(mins, mins + SIGNATURE, 0xffffffffu);
+    foreach(quint64 x, shingles) {
+	for (int i = 0; i < SIGNATURE; i++) {
+	    const quint32 h = static_cast<quint32>((a[i] * x + b[i]) >> 32);
+	    mins[i] = qMin(mins[i], h);
+	}
+    }
+    Signature sig(SIGNATURE);
+    std::copy(mins, mins + SIGNATURE, sig.begin());
+    return sig;
+}
+
+/**
+ * @brief Estimate the similarity of the programs of two signatures
+ * @return fraction of equal minimum hashes, 0.0 to 1.0
+ */
+double CasSimilar::similarity(const Signature& a, const Signature& b)
+{
+    if (a.count() != SIGNATURE || b.count() != SIGNATURE)
+	return 0.0;
+    int equal = 0;
+    for (int i = 0; i < SIGNATURE; i++)
+	equal += a[i] == b[i];
+    return static_cast<double>(equal) / SIGNATURE;
+}
+
+int CasSimilar::count() const
+{
+    return m_names.count();
+}
+
+QString CasSimilar::name(int index) const
+{
+    return m_names.value(index);
+}
+
+/**
+ * @brief Add the signature @p sig of the image @p name to the index
+ * @param name name of the image
+ * @param sig its signature
+ * @return index of the image, or -1 if the signature is empty
+ */
+int CasSimilar::add(const QString& name, const Signature& sig)
+{
+    if (sig.count() != SIGNATURE)
+	return -1;
+    const int index = m_names.count();
+    m_names += name;
+    m_signatures += sig;
+    for (int band = 0; band < BANDS; band++) {
+	quint64 key = mix64(static_cast<quint64>(band) + 1);
+	for (int row = 0; row < ROWS; row++)
+	    key = mix64(key ^ sig[band * ROWS + row]);
+	m_buckets[key] += index;
+    }
+    return index;
+}
+
+/**
+ * @brief Group the images into clusters of near duplicates
+ *
+ * Images sharing a bucket are compared, and those whose similarity is
+ * at least the threshold are joined. Similarity is not transitive, so
+ * a cluster may hold images which are similar only through others.
+ *
+ * @return list of clusters of two or more images, each in index order
+ */
+QVector<QVector<int> > CasSimilar::clusters() const
+{
+    QVector<int> parent(m_names.count());
+    for (int i = 0; i < parent.count(); i++)
+	parent[i] = i;
+
+    foreach(const QVector<int>& bucket, m_buckets) {
+	for (int i = 1; i < bucket.count(); i++) {
+	    const int a = bucket[i];
+	    for (int j = qMax(0, i - g_max_compare); j < i; j++) {
+		const int b = bucket[j];
+		if (find(parent, a) == find(parent, b))
+		    continue;
+		if (similarity(m_signatures[a], m_signatures[b]) >= m_threshold)
+		    parent[find(parent, a)] = find(parent, b);
+	    }
+	}
+    }
+
+    QHash<int, int> cluster;
+    QVector<QVector<int> > groups;
+    for (int i = 0; i < parent.count(); i++) {
+	const int root = find(parent, i);
+	if (!cluster.contains(root)) {
+	    cluster.insert(root, groups.count());
+	    groups += QVector<int>();
+	}
+	groups[cluster[root]] += i;
+    }
+
+    QVector<QVector<int> > result;
+    foreach(const QVector<int>& group, groups)
+	if (group.count() > 1)
+	    result += group;
+    return result;
+}
+
+/**
+ * @brief Return the root of the set of @p index, halving the path to it
+ */
+int CasSimilar::find(QVector<int>& parent, int index)
+{
+    while (parent[index] != index) {
+	parent[index] = parent[parent[index]];
+	index = parent[index];
+    }
+    return index;
+}
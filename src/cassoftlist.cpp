@@ -0,0 +1,280 @@
+/****************************************************************************
+ *
+ * Cass80 tool - MAME software list generator and verifier
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <QFileInfo>
+#include <QMap>
+#include <QSet>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+#include "cassoftlist.h"
+#include "cass80handler.h"
+
+CasSoftlist::CasSoftlist(const QString& name)
+    : m_name(name)
+    , m_roms()
+    , m_duplicates()
+    , m_index()
+{
+}
+
+/**
+ * @brief Describe the image @p path loaded into @p cas
+ * @param path path name of the image
+ * @param cas pointer to the Cass80Handler with the image
+ * @return Rom with the digests of the file
+ */
+CasSoftlist::Rom CasSoftlist::rom(const QString& path, const Cass80Handler* cas)
+{
+    Rom rom;
+    rom.path = path;
+    rom.machine = cas->machine();
+    rom.size = cas->digests().size;
+    rom.crc32 = cas->crc32();
+    rom.sha1 = cas->digests().sha1;
+
+    rom.description = cas->hdr_name().trimmed();
+    if (rom.description.isEmpty())
+	rom.description = cas->filename().trimmed();
+    if (rom.description.isEmpty())
+	rom.description = QFileInfo(path).completeBaseName();
+    rom.publisher = cas->hdr_author().trimmed();
+    if (rom.publisher.isEmpty())
+	rom.publisher = QStringLiteral("<unknown>");
+    return rom;
+}
+
+QString CasSoftlist::name() const
+{
+    return m_name;
+}
+
+/**
+ * @brief Return the number of distinct images
+ */
+int CasSoftlist::count() const
+{
+    return m_roms.count();
+}
+
+/**
+ * @brief Add an image; copies of an image already in the list are grouped with it
+ * @param rom const reference to the Rom to add
+ */
+void CasSoftlist::add(const Rom& rom)
+{
+    auto it = m_index.constFind(rom.sha1);
+    if (it != m_index.constEnd()) {
+	m_duplicates[it.value()] += rom.path;
+	return;
+    }
+    m_index.insert(rom.sha1, m_roms.count());
+    m_roms += rom;
+    m_duplicates += QStringList();
+}
+
+/**
+ * @brief Write the list as MAME softlist XML to @p device
+ *
+ * The entries are sorted by their short names. Copies of an image are
+ * noted in a comment of its software entry.
+ *
+ * @param device pointer to a QIODevice opened for writing
+ * @return true on success, or false on error
+ */
+bool CasSoftlist::write(QIODevice* device) const
+{
+    QSet<QString> used;
+    QMap<QString, int> order;
+    for (int i = 0; i < m_roms.count(); i++)
+	order.insert(short_name(m_roms[i], used), i);
+
+    QString description = m_name;
+    if (m_name == QLatin1String("cgenie_cass"))
+	description = QStringLiteral("EACA Colour Genie cassettes");
+    else if (m_name == QLatin1String("trs80_cass"))
+	description = QStringLiteral("TRS-80 cassettes");
+
+    QXmlStreamWriter xml(device);
+    xml.setAutoFormatting(true);
+    xml.setAutoFormattingIndent(-1);
+    xml.writeStartDocument();
+    xml.writeDTD(QLatin1String("<!DOCTYPE softwarelist SYSTEM \"softwarelist.dtd\">"));
+    xml.writeStartElement(QLatin1String("softwarelist"));
+    xml.writeAttribute(QLatin1String("name"), m_name);
+    xml.writeAttribute(QLatin1String("description"), description);
+
+    for (auto it = order.constBegin(); it != order.constEnd(); ++it) {
+	const Rom& rom = m_roms[it.value()];
+	xml.writeStartElement(QLatin1String("software"));
+	xml.writeAttribute(QLatin1String("name"), it.key());
+	foreach(QString path, m_duplicates[it.value()])
+	    xml.writeComment(QString(" also %1 ").arg(path.replace(QLatin1String("--"), QLatin1String("- -"))));
+	xml.writeTextElement(QLatin1String("description"), rom.description);
+	xml.writeTextElement(QLatin1String("year"), QLatin1String("19??"));
+	xml.writeTextElement(QLatin1String("publisher"), rom.publisher);
+
+	xml.writeStartElement(QLatin1String("part"));
+	xml.writeAttribute(QLatin1String("name"), QLatin1String("cass1"));
+	xml.writeAttribute(QLatin1String("interface"), m_name);
+	xml.writeStartElement(QLatin1String("dataarea"));
+	xml.writeAttribute(QLatin1String("name"), QLatin1String("cass"));
+	xml.writeAttribute(QLatin1String("size"), QString::number(rom.size));
+	xml.writeEmptyElement(QLatin1String("rom"));
+	xml.writeAttribute(QLatin1String("name"), QFileInfo(rom.path).fileName());
+	xml.writeAttribute(QLatin1String("size"), QString::number(rom.size));
+	xml.writeAttribute(QLatin1String("crc"), QString("%1").arg(rom.crc32, 8, 16, QChar('0')));
+	xml.writeAttribute(QLatin1String("sha1"), QString::fromLatin1(rom.sha1.toHex()));
+	xml.writeEndElement();	// dataarea
+	xml.writeEndElement();	// part
+	xml.writeEndElement();	// software
+    }
+
+    xml.writeEndElement();	// softwarelist
+    xml.writeEndDocument();
+    return !xml.hasError();
+}
+
+/**
+ * @brief Verify the MAME softlist XML read from @p device against the list
+ *
+ * Every rom of the softlist is looked up by its SHA1. Roms which are
+ * not in the archive, or whose size or CRC32 differ, are failures.
+ * Images of the archive which the softlist does not mention are
+ * reported as unlisted.
+ *
+ * @param device pointer to a QIODevice opened for reading
+ * @param report reference to a QStringList receiving one line per finding
+ * @return number of failures
+ */
+int CasSoftlist::verify(QIODevice* device, QStringList& report) const
+{
+    QXmlStreamReader xml(device);
+    QVector<bool> listed(m_roms.count(), false);
+    QString software;
+    int roms = 0;
+    int failed = 0;
+
+    while (!xml.atEnd()) {
+	if (xml.readNext() != QXmlStreamReader::StartElement)
+	    continue;
+	const QXmlStreamAttributes attr = xml.attributes();
+	if (xml.name() == QLatin1String("software")) {
+	    software = attr.value(QLatin1String("name")).toString();
+	    continue;
+	}
+	if (xml.name() != QLatin1String("rom") || !attr.hasAttribute(QLatin1String("sha1")))
+	    continue;
+
+	const QString name = attr.value(QLatin1String("name")).toString();
+	const QByteArray sha1 = QByteArray::fromHex(attr.value(QLatin1String("sha1")).toLatin1());
+	roms++;
+	auto it = m_index.constFind(sha1);
+	if (it == m_index.constEnd()) {
+	    report += QString("missing %1: %2 sha1 %3")
+		      .arg(software)
+		      .arg(name)
+		      .arg(QString::fromLatin1(sha1.toHex()));
+	    failed++;
+	    continue;
+	}
+
+	const Rom& rom = m_roms[it.value()];
+	listed[it.value()] = true;
+	const qint64 size = attr.value(QLatin1String("size")).toLongLong();
+	const quint32 crc32 = attr.value(QLatin1String("crc")).toUInt(nullptr, 16);
+	if (size != rom.size || crc32 != rom.crc32) {
+	    report += QString("mismatch %1: %2 size %3 crc %4, %5 has size %6 crc %7")
+		      .arg(software)
+		      .arg(name)
+		      .arg(size)
+		      .arg(crc32, 8, 16, QChar('0'))
+		      .arg(rom.path)
+		      .arg(rom.size)
+		      .arg(rom.crc32, 8, 16, QChar('0'));
+	    failed++;
+	}
+    }
+
+    if (xml.hasError()) {
+	report += QString("error in line %1: %2")
+		  .arg(xml.lineNumber())
+		  .arg(xml.errorString());
+	failed++;
+    }
+
+    int unlisted = 0;
+    for (int i = 0; i < m_roms.count(); i++) {
+	if (listed[i])
+	    continue;
+	report += QString("unlisted %1 sha1 %2")
+		  .arg(m_roms[i].path)
+		  .arg(QString::fromLatin1(m_roms[i].sha1.toHex()));
+	unlisted++;
+    }
+
+    report += QString("%1 roms in the softlist, %2 failed, %3 images unlisted")
+	      .arg(roms)
+	      .arg(failed)
+	      .arg(unlisted);
+    return failed;
+}
+
+/**
+ * @brief Make a unique MAME short name for @p rom
+ *
+ * Short names are the lower case letters and digits of the file name,
+ * at most 16 characters. Clashes get a number appended.
+ *
+ * @param rom const reference to the Rom
+ * @param used reference to the set of names used so far
+ * @return the short name
+ */
+QString CasSoftlist::short_name(const Rom& rom, QSet<QString>& used) const
+{
+    QString base;
+    foreach(const QChar ch, QFileInfo(rom.path).completeBaseName().toLower()) {
+	if ((ch >= QChar('a') && ch <= QChar('z')) || (ch >= QChar('0') && ch <= QChar('9')))
+	    base += ch;
+    }
+    if (base.isEmpty())
+	base = QStringLiteral("cass");
+    base.truncate(16);
+
+    QString name = base;
+    for (int n = 2; used.contains(name); n++) {
+	const QString number = QString::number(n);
+	name = base.left(16 - number.length()) + number;
+    }
+    used.insert(name);
+    return name;
+}
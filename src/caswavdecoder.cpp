@@ -0,0 +1,648 @@
+/****************************************************************************
+ *
+ * Cass80 tool - cassette audio (WAV) decoder
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <algorithm>
+#include <QBuffer>
+#include <QFile>
+#include <QtEndian>
+#include "caswavdecoder.h"
+#include "util.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define	CAS_WAV_SSE2	1
+#endif
+
+/** @brief number of sample frames read and processed at once */
+static const int chunk_frames = 16384;
+
+/** @brief number of intervals used to find the short/long threshold */
+static const int train_count = 64;
+
+/** @brief lowest hysteresis of the Schmitt trigger (16 bit scale) */
+static const int min_hysteresis = 256;
+
+CasWavDecoder::CasWavDecoder(QObject* parent)
+    : QObject(parent)
+    , m_rate(0)
+    , m_channels(0)
+    , m_bits(0)
+    , m_frame_size(0)
+    , m_raw()
+    , m_filt()
+    , m_center(0)
+    , m_env(0)
+    , m_high(false)
+    , m_pos(0)
+    , m_last_edge(-1)
+    , m_last_fall(-1)
+    , m_train()
+    , m_trained(false)
+    , m_short(0)
+    , m_long(0)
+    , m_gap(0)
+    , m_shift()
+    , m_pending(false)
+    , m_encoding(ENC_NONE)
+    , m_framer(FR_PAIRS)
+    , m_nbits(0)
+    , m_byte(0)
+    , m_program()
+    , m_cas()
+    , m_programs(0)
+{
+}
+
+/**
+ * @brief Return true if @p data starts with a RIFF WAVE header
+ * @param data pointer to the first byte of the file
+ * @param size number of bytes in the file
+ * @return true if it is a WAV file
+ */
+bool CasWavDecoder::is_wav(const uchar* data, qint64 size)
+{
+    return size >= 12 &&
+	    0 == memcmp(data, "RIFF", 4) &&
+	    0 == memcmp(data + 8, "WAVE", 4);
+}
+
+bool CasWavDecoder::decode(const QString& filename)
+{
+    QFile input(filename);
+    if (!input.open(QIODevice::ReadOnly)) {
+	emit Error(tr("Cannot open '%1' for reading.").arg(filename));
+	return false;
+    }
+    return decode(&input);
+}
+
+bool CasWavDecoder::decode(const uchar* data, qint64 size)
+{
+    QByteArray raw = QByteArray::fromRawData(reinterpret_cast<const char *>(data),
+					     static_cast<int>(size));
+    QBuffer buffer(&raw);
+    buffer.open(QIODevice::ReadOnly);
+    return decode(&buffer);
+}
+
+/**
+ * @brief Decode a WAV file from @p device
+ *
+ * The chunks of the RIFF file are read in sequence up to the "data"
+ * chunk, which is then streamed in chunks of chunk_frames samples.
+ *
+ * @param device pointer to the QIODevice to read from
+ * @return true if at least one program was decoded
+ */
+bool CasWavDecoder::decode(QIODevice* device)
+{
+    reset();
+
+    const QByteArray riff = device->read(12);
+    if (!is_wav(reinterpret_cast<const uchar *>(riff.constData()), riff.size())) {
+	emit Error(tr("Not a RIFF WAVE file."));
+	return false;
+    }
+
+    bool have_fmt = false;
+    for (;;) {
+	const QByteArray hdr = device->read(8);
+	if (hdr.size() < 8) {
+	    emit Error(tr("No data chunk in the WAV file."));
+	    return false;
+	}
+	const quint8* hp = reinterpret_cast<const quint8 *>(hdr.constData());
+	const qint64 len = util::rd32(hp + 4);
+	const qint64 padded = len + (len & 1);
+
+	if (hdr.startsWith("fmt ")) {
+	    if (!format(device->read(padded)))
+		return false;
+	    have_fmt = true;
+	    continue;
+	}
+
+	if (hdr.startsWith("data")) {
+	    if (!have_fmt) {
+		emit Error(tr("The data chunk comes before the fmt chunk."));
+		return false;
+	    }
+	    if (!stream(device, len))
+		return false;
+	    break;
+	}
+
+	// Skip any other chunk
+	if (device->isSequential()) {
+	    for (qint64 left = padded; left > 0; ) {
+		const qint64 skipped = device->read(qMin<qint64>(left, 65536)).size();
+		if (skipped <= 0)
+		    break;
+		left -= skipped;
+	    }
+	} else {
+	    device->seek(device->pos() + padded);
+	}
+    }
+
+    tail();
+    end_program();
+    emit Info(tr("Decoded %1 programs (%2 bytes) from %3 samples at %4 Hz.")
+	      .arg(m_programs)
+	      .arg(m_cas.size())
+	      .arg(m_pos)
+	      .arg(m_rate));
+    if (!m_programs) {
+	emit Error(tr("No program found in the recording."));
+	return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Return the decoded programs as a .cas image
+ * @return const reference to the QByteArray
+ */
+const QByteArray& CasWavDecoder::cas() const
+{
+    return m_cas;
+}
+
+int CasWavDecoder::programs() const
+{
+    return m_programs;
+}
+
+quint32 CasWavDecoder::rate() const
+{
+    return m_rate;
+}
+
+void CasWavDecoder::reset()
+{
+    m_rate = 0;
+    m_channels = 0;
+    m_bits = 0;
+    m_frame_size = 0;
+    m_raw.fill(0, chunk_frames + 2);
+    m_filt.fill(0, chunk_frames);
+    m_center = 0;
+    m_env = 0;
+    m_high = false;
+    m_pos = 0;
+    m_last_edge = -1;
+    m_last_fall = -1;
+    m_train.clear();
+    m_trained = false;
+    m_short = 0;
+    m_long = 0;
+    m_gap = 0;
+    m_shift[FR_PAIRS] = 0;
+    m_shift[FR_SINGLE] = 0;
+    m_pending = false;
+    m_encoding = ENC_NONE;
+    m_nbits = 0;
+    m_byte = 0;
+    m_program.clear();
+    m_cas.clear();
+    m_programs = 0;
+}
+
+/**
+ * @brief Parse the contents of the "fmt " chunk
+ * @param fmt the chunk's data
+ * @return true if the format is supported
+ */
+bool CasWavDecoder::format(const QByteArray& fmt)
+{
+    if (fmt.size() < 16) {
+	emit Error(tr("The fmt chunk is too short."));
+	return false;
+    }
+    const quint8* fp = reinterpret_cast<const quint8 *>(fmt.constData());
+    const quint32 tag = util::rd16(fp + 0);
+    m_channels = static_cast<int>(util::rd16(fp + 2));
+    m_rate = util::rd32(fp + 4);
+    m_bits = static_cast<int>(util::rd16(fp + 14));
+    m_frame_size = m_channels * m_bits / 8;
+
+    // Plain PCM or WAVE_FORMAT_EXTENSIBLE
+    if ((tag != 0x0001 && tag != 0xfffe) ||
+	(m_bits != 8 && m_bits != 16) ||
+	m_channels < 1 || m_rate < 4000) {
+	emit Error(tr("Unsupported WAV format: tag %1, %2 channels, %3 bits, %4 Hz.")
+		   .arg(tag)
+		   .arg(m_channels)
+		   .arg(m_bits)
+		   .arg(m_rate));
+	return false;
+    }
+
+    // No encoding has intervals as long as 20ms
+    m_gap = static_cast<int>(m_rate / 50);
+    return true;
+}
+
+/**
+ * @brief Read and process the samples of the "data" chunk
+ * @param device pointer to the QIODevice positioned at the samples
+ * @param size size of the data chunk; 0 or too large reads to the end
+ * @return true on success
+ */
+bool CasWavDecoder::stream(QIODevice* device, qint64 size)
+{
+    QByteArray buffer(chunk_frames * m_frame_size, 0x00);
+    qint64 left = size > 0 ? size : Q_INT64_C(0x7fffffffffffffff);
+
+    while (left >= m_frame_size) {
+	const qint64 want = qMin<qint64>(left, buffer.size());
+	qint64 got = 0;
+	while (got < want) {
+	    const qint64 n = device->read(buffer.data() + got, want - got);
+	    if (n <= 0)
+		break;
+	    got += n;
+	}
+	const int frames = static_cast<int>(got / m_frame_size);
+	if (frames <= 0)
+	    break;
+	convert(reinterpret_cast<const uchar *>(buffer.constData()), frames);
+	filter(frames);
+	trigger(frames);
+	m_pos += frames;
+	left -= got;
+	if (got < want)
+	    break;
+    }
+    return true;
+}
+
+/**
+ * @brief Convert the first channel of @p frames PCM frames to 16 bit
+ * The samples are stored behind the two samples of history the filter
+ * keeps from the previous chunk.
+ * @param pcm pointer to the PCM frames
+ * @param frames number of frames
+ */
+void CasWavDecoder::convert(const uchar* pcm, int frames)
+{
+    qint16* dst = m_raw.data() + 2;
+
+    if (8 == m_bits) {
+	const int step = m_channels;
+	for (int i = 0; i < frames; i++)
+	    dst[i] = static_cast<qint16>((pcm[i * step] - 128) << 8);
+    } else if (1 == m_channels) {
+	const qint16* src = reinterpret_cast<const qint16 *>(pcm);
+	for (int i = 0; i < frames; i++)
+	    dst[i] = qFromLittleEndian(src[i]);
+    } else {
+	const int step = m_channels;
+	const qint16* src = reinterpret_cast<const qint16 *>(pcm);
+	for (int i = 0; i < frames; i++)
+	    dst[i] = qFromLittleEndian(src[i * step]);
+    }
+}
+
+/**
+ * @brief Low-pass filter the samples and track offset and amplitude
+ *
+ * The [1 2 1] kernel removes the worst of the hiss without shifting
+ * edges by more than one sample. The loops have no dependencies
+ * between iterations, so the compiler turns them into vector code.
+ *
+ * @param frames number of samples
+ */
+void CasWavDecoder::filter(int frames)
+{
+    qint16* raw = m_raw.data();
+    qint16* filt = m_filt.data();
+    int lo = 32767;
+    int hi = -32768;
+
+    for (int i = 0; i < frames; i++)
+	filt[i] = static_cast<qint16>((raw[i] + 2 * raw[i + 1] + raw[i + 2]) >> 2);
+    // Keep the last two samples as history for the next chunk
+    raw[0] = raw[frames];
+    raw[1] = raw[frames + 1];
+    for (int i = 0; i < frames; i++) {
+	lo = qMin<int>(lo, filt[i]);
+	hi = qMax<int>(hi, filt[i]);
+    }
+
+    // The middle of the range, not the mean: pulses have no 50% duty cycle
+    const int middle = (lo + hi) / 2;
+    m_center += (middle - m_center) / 2;
+    const int peak = qMax(hi - m_center, m_center - lo);
+    m_env = qMax(peak, m_env - m_env / 8);
+}
+
+/**
+ * @brief Run the samples through the Schmitt trigger
+ *
+ * The samples above the upper and below the lower level are turned
+ * into bit masks, 32 samples at a time. The trigger then only walks
+ * the set bits, so its cost depends on the number of edges.
+ *
+ * @param frames number of samples
+ */
+void CasWavDecoder::trigger(int frames)
+{
+    const int hyst = qMax(min_hysteresis, m_env / 3);
+    const qint16 upper = static_cast<qint16>(qBound(-32768, m_center + hyst, 32767));
+    const qint16 lower = static_cast<qint16>(qBound(-32768, m_center - hyst, 32767));
+    const qint16* filt = m_filt.constData();
+
+    for (int base = 0; base < frames; base += 32) {
+	const int n = qMin(32, frames - base);
+	quint32 above = 0;
+	quint32 below = 0;
+#if CAS_WAV_SSE2
+	if (32 == n) {
+	    const __m128i up = _mm_set1_epi16(upper);
+	    const __m128i lw = _mm_set1_epi16(lower);
+	    for (int k = 0; k < 32; k += 16) {
+		const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(filt + base + k));
+		const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(filt + base + k + 8));
+		const __m128i ga = _mm_packs_epi16(_mm_cmpgt_epi16(a, up), _mm_cmpgt_epi16(b, up));
+		const __m128i la = _mm_packs_epi16(_mm_cmplt_epi16(a, lw), _mm_cmplt_epi16(b, lw));
+		above |= static_cast<quint32>(_mm_movemask_epi8(ga)) << k;
+		below |= static_cast<quint32>(_mm_movemask_epi8(la)) << k;
+	    }
+	} else
+#endif
+	{
+	    for (int k = 0; k < n; k++) {
+		above |= static_cast<quint32>(filt[base + k] > upper) << k;
+		below |= static_cast<quint32>(filt[base + k] < lower) << k;
+	    }
+	}
+
+	for (;;) {
+	    int b;
+	    if (m_high) {
+		if (!below)
+		    break;
+		b = qCountTrailingZeroBits(below);
+		m_high = false;
+		m_last_fall = m_pos + base + b;
+	    } else {
+		if (!above)
+		    break;
+		b = qCountTrailingZeroBits(above);
+		m_high = true;
+		edge(m_pos + base + b);
+	    }
+	    const quint32 keep = ~((2u << b) - 1u);
+	    above &= keep;
+	    below &= keep;
+	}
+    }
+}
+
+/**
+ * @brief Handle a rising edge of the Schmitt trigger at @p pos
+ * @param pos sample number of the edge
+ */
+void CasWavDecoder::edge(qint64 pos)
+{
+    // Noise can trigger an edge inside a cycle; ignore edges far too early
+    if (m_trained && m_last_edge >= 0 && pos - m_last_edge < m_short * 0.6)
+	return;
+    if (m_last_edge >= 0)
+	interval(static_cast<int>(qMin<qint64>(pos - m_last_edge, 0x7fffffff)));
+    m_last_edge = pos;
+}
+
+/**
+ * @brief Classify the distance between two rising edges
+ *
+ * The first train_count intervals after a gap decide the initial
+ * short and long lengths; after that both follow the signal.
+ *
+ * @param len distance in samples
+ */
+void CasWavDecoder::interval(int len)
+{
+    if (len > m_gap) {
+	tail();
+	end_program();
+	return;
+    }
+
+    if (!m_trained) {
+	m_train += len;
+	if (m_train.count() < train_count)
+	    return;
+	train();
+	const QVector<int> replay = m_train;
+	m_train.clear();
+	foreach(int l, replay)
+	    interval(l);
+	return;
+    }
+
+    classify(len);
+}
+
+/**
+ * @brief Classify an interval as short or long and follow both lengths
+ * @param len distance in samples
+ */
+void CasWavDecoder::classify(int len)
+{
+    const bool is_short = len < (m_short + m_long) / 2;
+    if (is_short)
+	m_short += (len - m_short) / 16;
+    else
+	m_long += (len - m_long) / 16;
+    symbol(is_short);
+}
+
+/**
+ * @brief Finish the last cycle before a gap
+ * There is no rising edge after it, so its length is estimated
+ * as twice the time the signal stayed high.
+ */
+void CasWavDecoder::tail()
+{
+    if (!m_trained || m_last_edge < 0 || m_last_fall <= m_last_edge)
+	return;
+    const qint64 len = 2 * (m_last_fall - m_last_edge);
+    if (len <= m_gap)
+	classify(static_cast<int>(len));
+}
+
+/**
+ * @brief Find the short and long interval lengths from the training set
+ *
+ * If the intervals form two clusters, their 10th and 90th percentiles
+ * are the short and long lengths. A lead-in of only 0 bits, such as the
+ * TRS-80's, has just long intervals, and the short ones are half of that.
+ */
+void CasWavDecoder::train()
+{
+    QVector<int> sorted = m_train;
+    std::sort(sorted.begin(), sorted.end());
+    const int p10 = sorted[sorted.count() / 10];
+    const int p50 = sorted[sorted.count() / 2];
+    const int p90 = sorted[sorted.count() * 9 / 10];
+
+    if (p90 * 10 > p10 * 14) {
+	m_short = p10;
+	m_long = p90;
+    } else {
+	m_long = p50;
+	m_short = p50 / 2.0;
+    }
+    m_gap = qMax(static_cast<int>(m_long * 4), 8);
+    m_trained = true;
+}
+
+/**
+ * @brief Feed a short or long symbol to the framers
+ * @param is_short true for a short, false for a long interval
+ */
+void CasWavDecoder::symbol(bool is_short)
+{
+    if (ENC_NONE == m_encoding || FR_SINGLE == m_framer)
+	bit(FR_SINGLE, is_short ? 1 : 0);
+
+    if (ENC_NONE != m_encoding && FR_PAIRS != m_framer)
+	return;
+
+    if (is_short) {
+	if (m_pending) {
+	    m_pending = false;
+	    bit(FR_PAIRS, 1);
+	} else {
+	    m_pending = true;
+	}
+    } else {
+	// A single short before a long is out of step; drop it
+	m_pending = false;
+	bit(FR_PAIRS, 0);
+    }
+}
+
+/**
+ * @brief Shift a bit into the framer's register or the current byte
+ * @param framer the framer which produced the bit
+ * @param b bit value
+ */
+void CasWavDecoder::bit(Framer framer, int b)
+{
+    if (ENC_NONE == m_encoding) {
+	const quint16 sr = static_cast<quint16>((m_shift[framer] << 1) | b);
+	m_shift[framer] = sr;
+	if (FR_PAIRS == framer) {
+	    if (sr == ((CAS_SILENCE << 8) | CAS_TRS80_SYNC))
+		lock(ENC_TRS80_500, framer);
+	    else if (sr == ((CAS_CGENIE_PRELUDE << 8) | CAS_CGENIE_SYNC))
+		lock(ENC_CGENIE, framer);
+	} else if (sr == 0x557f) {
+	    // TRS-80 1500 baud lead-in 0x55 and sync 0x7f
+	    lock(ENC_TRS80_1500, framer);
+	}
+	return;
+    }
+
+    m_byte = static_cast<quint8>((m_byte << 1) | b);
+    if (++m_nbits == 8) {
+	m_program += static_cast<char>(m_byte);
+	m_nbits = 0;
+	m_byte = 0;
+    }
+}
+
+/**
+ * @brief Start a program after its sync was found
+ *
+ * The program gets the lead-in and sync the state machine expects
+ * for its machine; 1500 baud tapes use the same bytes as 500 baud.
+ *
+ * @param enc encoding of the program
+ * @param framer framer which found the sync
+ */
+void CasWavDecoder::lock(Encoding enc, Framer framer)
+{
+    m_encoding = enc;
+    m_framer = framer;
+    m_nbits = 0;
+    m_byte = 0;
+    m_program.clear();
+    if (ENC_CGENIE == enc) {
+	m_program += static_cast<char>(CAS_CGENIE_SYNC);
+    } else {
+	m_program += QByteArray(256, CAS_SILENCE);
+	m_program += static_cast<char>(CAS_TRS80_SYNC);
+    }
+
+    const double secs = m_rate ? static_cast<double>(m_last_edge) / m_rate : 0.0;
+    switch (enc) {
+    case ENC_TRS80_500:
+	emit Info(tr("TRS-80 500 baud sync at %1s.").arg(secs, 0, 'f', 2));
+	break;
+    case ENC_TRS80_1500:
+	emit Info(tr("TRS-80 1500 baud sync at %1s.").arg(secs, 0, 'f', 2));
+	break;
+    case ENC_CGENIE:
+	emit Info(tr("Colour Genie sync at %1s.").arg(secs, 0, 'f', 2));
+	break;
+    case ENC_NONE:
+	break;
+    }
+}
+
+/**
+ * @brief End the current program at a gap or the end of the recording
+ * The next program needs a new lead-in, so training starts over.
+ */
+void CasWavDecoder::end_program()
+{
+    const int leadin = ENC_CGENIE == m_encoding ? 1 : 257;
+    if (ENC_NONE != m_encoding && m_program.size() > leadin) {
+	m_cas += m_program;
+	m_programs++;
+    }
+    m_program.clear();
+    m_encoding = ENC_NONE;
+    m_shift[FR_PAIRS] = 0;
+    m_shift[FR_SINGLE] = 0;
+    m_pending = false;
+    m_nbits = 0;
+    m_byte = 0;
+    m_train.clear();
+    m_trained = false;
+    m_gap = static_cast<int>(m_rate / 50);
+}
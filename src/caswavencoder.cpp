@@ -0,0 +1,401 @@
+/****************************************************************************
+ *
+ * Cass80 tool - cassette audio (WAV and CSW) encoder
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <cmath>
+#include <QFile>
+#include <QFileInfo>
+#include "cass80handler.h"
+#include "caswavencoder.h"
+#include "util.h"
+
+/** @brief size of the output buffer */
+static const int buffer_size = 64 * 1024;
+
+/** @brief peak amplitude of the 16 bit PCM samples */
+static const int amplitude = 0x6000;
+
+/** @brief silence before the lead-in and after the program */
+static const double lead_silence = 0.5;
+static const double tail_silence = 1.0;
+
+CasWavEncoder::CasWavEncoder(QObject* parent)
+    : QObject(parent)
+    , m_rate(44100)
+    , m_encoding(CasWavDecoder::ENC_NONE)
+    , m_format(FMT_WAV)
+    , m_device(nullptr)
+    , m_ok(true)
+    , m_pcm()
+    , m_pulses()
+    , m_pcm_offs()
+    , m_pulse_offs()
+    , m_pending(0)
+    , m_buffer()
+{
+}
+
+quint32 CasWavEncoder::rate() const
+{
+    return m_rate;
+}
+
+void CasWavEncoder::set_rate(quint32 rate)
+{
+    if (rate == m_rate)
+	return;
+    m_rate = rate;
+    // The tables have to be computed again
+    m_encoding = CasWavDecoder::ENC_NONE;
+}
+
+/**
+ * @brief Return the output format for the suffix of @p filename
+ * @param filename name of the output file
+ * @return FMT_CSW for *.csw, otherwise FMT_WAV
+ */
+CasWavEncoder::Format CasWavEncoder::format(const QString& filename)
+{
+    const QString suffix = QFileInfo(filename).suffix().toLower();
+    return suffix == QLatin1String("csw") ? FMT_CSW : FMT_WAV;
+}
+
+/**
+ * @brief Encode the image in @p cas to the file @p filename
+ *
+ * Colour Genie images are written in its own format, TRS-80 images
+ * at 500 baud. The format is chosen by the suffix of the file name.
+ *
+ * @param cas pointer to the Cass80Handler with the image
+ * @param filename name of the WAV or CSW file to write
+ * @return true on success, or false on error
+ */
+bool CasWavEncoder::encode(const Cass80Handler* cas, const QString& filename)
+{
+    CasWavDecoder::Encoding enc;
+    switch (cas->machine()) {
+    case MACH_EG2000:
+	enc = CasWavDecoder::ENC_CGENIE;
+	break;
+    case MACH_TRS80:
+	enc = CasWavDecoder::ENC_TRS80_500;
+	break;
+    default:
+	emit Error(tr("Invalid machine - none of EG2000 or TRS80 were detected."));
+	return false;
+    }
+
+    const QByteArray payload = cas->payload();
+    if (payload.isEmpty()) {
+	emit Error(tr("The image has nothing that can be encoded."));
+	return false;
+    }
+
+    QFile output(filename);
+    if (!output.open(QIODevice::WriteOnly)) {
+	emit Error(tr("Cannot open '%1' for writing.").arg(filename));
+	return false;
+    }
+    return encode(payload, enc, &output, format(filename));
+}
+
+/**
+ * @brief Encode the bytes following the sync byte to @p device
+ *
+ * The lead-in and sync of the encoding are written in front of
+ * @p payload, and one NUL byte after it, so that the last bit of
+ * the payload is followed by an edge.
+ *
+ * @param payload bytes following the sync byte
+ * @param enc the encoding to use
+ * @param device pointer to the QIODevice to write to
+ * @param fmt FMT_WAV or FMT_CSW
+ * @return true on success, or false on error
+ */
+bool CasWavEncoder::encode(const QByteArray& payload, CasWavDecoder::Encoding enc,
+			   QIODevice* device, Format fmt)
+{
+    QByteArray lead;
+    switch (enc) {
+    case CasWavDecoder::ENC_CGENIE:
+	lead = QByteArray(255, static_cast<char>(CAS_CGENIE_PRELUDE));
+	lead += static_cast<char>(CAS_CGENIE_SYNC);
+	break;
+    case CasWavDecoder::ENC_TRS80_500:
+	lead = QByteArray(256, static_cast<char>(CAS_SILENCE));
+	lead += static_cast<char>(CAS_TRS80_SYNC);
+	break;
+    case CasWavDecoder::ENC_TRS80_1500:
+	lead = QByteArray(256, 0x55);
+	lead += static_cast<char>(0x7f);
+	break;
+    case CasWavDecoder::ENC_NONE:
+	emit Error(tr("No encoding selected."));
+	return false;
+    }
+    const QByteArray bytes = lead + payload + QByteArray(1, CAS_SILENCE);
+
+    if (enc != m_encoding)
+	tables(enc);
+    m_format = fmt;
+    m_device = device;
+    m_ok = true;
+    m_pending = 0;
+    m_buffer.reserve(buffer_size + 4096);
+    m_buffer.resize(0);
+
+    const qint64 lead_samples = qRound64(lead_silence * m_rate);
+    const qint64 tail_samples = qRound64(tail_silence * m_rate);
+
+    if (FMT_WAV == fmt) {
+	// The data size is known from the tables
+	qint64 size = 2 * (lead_samples + tail_samples);
+	foreach(char ch, bytes) {
+	    const quint8 b = static_cast<quint8>(ch);
+	    size += m_pcm_offs[b + 1] - m_pcm_offs[b];
+	}
+	const quint32 data_size = static_cast<quint32>(size);
+	quint8 hdr[44];
+	memcpy(hdr + 0, "RIFF", 4);
+	util::wr32(hdr + 4, 36 + data_size);
+	memcpy(hdr + 8, "WAVEfmt ", 8);
+	util::wr32(hdr + 16, 16);
+	util::wr16(hdr + 20, 1);		// PCM
+	util::wr16(hdr + 22, 1);		// mono
+	util::wr32(hdr + 24, m_rate);
+	util::wr32(hdr + 28, m_rate * 2);	// bytes per second
+	util::wr16(hdr + 32, 2);		// block align
+	util::wr16(hdr + 34, 16);		// bits per sample
+	memcpy(hdr + 36, "data", 4);
+	util::wr32(hdr + 40, data_size);
+	m_buffer.append(reinterpret_cast<const char *>(hdr), sizeof(hdr));
+    } else {
+	quint8 hdr[32];
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr + 0, "Compressed Square Wave\x1a", 23);
+	hdr[23] = 1;				// major version
+	hdr[24] = 1;				// minor version
+	util::wr16(hdr + 25, m_rate);
+	hdr[27] = 1;				// RLE compression
+	hdr[28] = 0;				// initial polarity low
+	m_buffer.append(reinterpret_cast<const char *>(hdr), sizeof(hdr));
+    }
+
+    put_silence(lead_samples);
+    foreach(char ch, bytes)
+	put_byte(static_cast<quint8>(ch));
+    put_silence(tail_samples);
+    if (FMT_CSW == fmt && m_pending > 0) {
+	// The final low pulse
+	put_pulse(m_pending);
+	m_pending = 0;
+    }
+    flush();
+
+    if (!m_ok)
+	emit Error(tr("Writing the audio failed: %1").arg(device->errorString()));
+    m_device = nullptr;
+    return m_ok;
+}
+
+/**
+ * @brief Describe the waveform of one bit as segments of constant level
+ * @param b bit value
+ * @param segs reference to the vector to append to
+ */
+void CasWavEncoder::bit_segments(int b, QVector<Segment>& segs) const
+{
+    switch (m_encoding) {
+    case CasWavDecoder::ENC_CGENIE:
+	// 1200 baud; 1 = two cycles of 2400 Hz, 0 = one cycle of 1200 Hz
+	if (b) {
+	    for (int i = 0; i < 2; i++) {
+		segs += Segment{+1, 1.0 / 4800};
+		segs += Segment{-1, 1.0 / 4800};
+	    }
+	} else {
+	    segs += Segment{+1, 1.0 / 2400};
+	    segs += Segment{-1, 1.0 / 2400};
+	}
+	break;
+
+    case CasWavDecoder::ENC_TRS80_500:
+	// 2 ms bit cells starting with a clock pulse; a 1 has a data pulse in the middle
+	for (int i = 0; i < (b ? 2 : 1); i++) {
+	    const double cell = b ? 1.0e-3 : 2.0e-3;
+	    segs += Segment{+1, 125.0e-6};
+	    segs += Segment{-1, 125.0e-6};
+	    segs += Segment{0, cell - 250.0e-6};
+	}
+	break;
+
+    case CasWavDecoder::ENC_TRS80_1500:
+	// One cycle per bit; 1 = 2000 Hz, 0 = 1000 Hz
+	segs += Segment{+1, b ? 0.25e-3 : 0.5e-3};
+	segs += Segment{-1, b ? 0.25e-3 : 0.5e-3};
+	break;
+
+    case CasWavDecoder::ENC_NONE:
+	break;
+    }
+}
+
+/**
+ * @brief Compute the PCM and CSW tables of all byte values for @p enc
+ *
+ * Segment boundaries are rounded to samples from the start of the byte,
+ * so rounding errors do not add up within a byte. For CSW the silence
+ * counts as low level and merges with the low half of a pulse.
+ *
+ * @param enc the encoding
+ */
+void CasWavEncoder::tables(CasWavDecoder::Encoding enc)
+{
+    m_encoding = enc;
+    m_pcm.clear();
+    m_pulses.clear();
+
+    QVector<Segment> segs;
+    for (int v = 0; v < 256; v++) {
+	m_pcm_offs[v] = m_pcm.size();
+	m_pulse_offs[v] = m_pulses.count();
+
+	segs.clear();
+	for (int bit = 7; bit >= 0; bit--)
+	    bit_segments((v >> bit) & 1, segs);
+
+	double t = 0.0;
+	qint64 start = 0;
+	int level = 0;
+	quint32 pulse = 0;
+	foreach(const Segment& seg, segs) {
+	    t += seg.secs;
+	    const qint64 end = qRound64(t * m_rate);
+	    const int len = static_cast<int>(end - start);
+	    start = end;
+
+	    const quint16 sample = static_cast<quint16>(seg.level * amplitude);
+	    for (int i = 0; i < len; i++) {
+		m_pcm += static_cast<char>(sample & 0xff);
+		m_pcm += static_cast<char>(sample >> 8);
+	    }
+
+	    const int csw_level = seg.level > 0 ? 1 : -1;
+	    if (csw_level != level && pulse > 0) {
+		m_pulses += pulse;
+		pulse = 0;
+	    }
+	    level = csw_level;
+	    pulse += static_cast<quint32>(len);
+	}
+	if (pulse > 0)
+	    m_pulses += pulse;
+    }
+    m_pcm_offs[256] = m_pcm.size();
+    m_pulse_offs[256] = m_pulses.count();
+}
+
+/**
+ * @brief Append the waveform of @p byte to the output buffer
+ *
+ * Every byte starts with a high and ends with a low pulse. For CSW
+ * the final low pulse is held back, because silence may follow and
+ * extend it.
+ *
+ * @param byte the byte value
+ */
+void CasWavEncoder::put_byte(quint8 byte)
+{
+    if (FMT_WAV == m_format) {
+	m_buffer.append(m_pcm.constData() + m_pcm_offs[byte],
+			m_pcm_offs[byte + 1] - m_pcm_offs[byte]);
+    } else {
+	const quint32* pulses = m_pulses.constData() + m_pulse_offs[byte];
+	const int count = m_pulse_offs[byte + 1] - m_pulse_offs[byte];
+	if (m_pending > 0)
+	    put_pulse(m_pending);
+	for (int i = 0; i < count - 1; i++)
+	    put_pulse(pulses[i]);
+	m_pending = pulses[count - 1];
+    }
+    if (m_buffer.size() >= buffer_size)
+	flush();
+}
+
+/**
+ * @brief Append @p samples of silence to the output buffer
+ * @param samples number of samples
+ */
+void CasWavEncoder::put_silence(qint64 samples)
+{
+    if (FMT_CSW == m_format) {
+	m_pending += static_cast<quint32>(samples);
+	return;
+    }
+    while (samples > 0) {
+	const int len = static_cast<int>(qMin<qint64>(samples, buffer_size / 2));
+	m_buffer.append(QByteArray(2 * len, 0x00));
+	samples -= len;
+	if (m_buffer.size() >= buffer_size)
+	    flush();
+    }
+}
+
+/**
+ * @brief Append one CSW pulse of @p len samples
+ * Pulses longer than 255 samples are written as 0 and a 32 bit length.
+ * @param len pulse length in samples
+ */
+void CasWavEncoder::put_pulse(quint32 len)
+{
+    if (len > 0 && len < 256) {
+	m_buffer += static_cast<char>(len);
+	return;
+    }
+    quint8 ext[5];
+    ext[0] = 0;
+    util::wr32(ext + 1, len);
+    m_buffer.append(reinterpret_cast<const char *>(ext), sizeof(ext));
+}
+
+/**
+ * @brief Write the output buffer to the device
+ */
+void CasWavEncoder::flush()
+{
+    if (m_buffer.isEmpty())
+	return;
+    if (m_device->write(m_buffer) != m_buffer.size())
+	m_ok = false;
+    // Keeps the reserved capacity
+    m_buffer.resize(0);
+}
@@ -0,0 +1,334 @@
+/****************************************************************************
+ *
+ * Cass80 tool - ZIP archive reader
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <cstring>
+#include <zlib.h>
+#include "caszip.h"
+#include "util.h"
+
+enum {
+    ZIP_LOCAL_SIG	= 0x04034b50,	//!< local file header
+    ZIP_CENTRAL_SIG	= 0x02014b50,	//!< central directory file header
+    ZIP_END_SIG		= 0x06054b50,	//!< end of central directory record
+    ZIP_LOCAL_SIZE	= 30,		//!< size of a local file header without name and extra
+    ZIP_CENTRAL_SIZE	= 46,		//!< size of a central directory header without name, extra and comment
+    ZIP_END_SIZE	= 22,		//!< size of the end record without comment
+    ZIP_STORED		= 0,
+    ZIP_DEFLATED	= 8,
+    ZIP_FLAG_ENCRYPTED	= (1 << 0),
+    ZIP_FLAG_UTF8	= (1 << 11)
+};
+
+CasZip::CasZip()
+    : m_file()
+    , m_map(nullptr)
+    , m_data(nullptr)
+    , m_size(0)
+    , m_error()
+    , m_members()
+    , m_index()
+{
+}
+
+CasZip::~CasZip()
+{
+    close();
+}
+
+/**
+ * @brief Return true if @p data starts with a ZIP local file header
+ */
+bool CasZip::is_zip(const uchar* data, qint64 size)
+{
+    return size >= ZIP_LOCAL_SIZE && util::rd32(data) == ZIP_LOCAL_SIG;
+}
+
+/**
+ * @brief Split a member path like "dir/set.zip/name.cas" into its parts
+ * @param path path name which may refer to a member of an archive
+ * @param archive optional pointer to a QString receiving the archive path
+ * @param member optional pointer to a QString receiving the member name
+ * @return true if @p path refers to a member of a ZIP archive
+ */
+bool CasZip::split(const QString& path, QString* archive, QString* member)
+{
+    const int pos = path.indexOf(QLatin1String(".zip/"), 0, Qt::CaseInsensitive);
+    if (pos < 0)
+	return false;
+    if (archive)
+	*archive = path.left(pos + 4);
+    if (member)
+	*member = path.mid(pos + 5);
+    return true;
+}
+
+/**
+ * @brief Open and index the archive @p filename
+ * @param filename name of the ZIP file
+ * @return true on success, or false on error
+ */
+bool CasZip::open(const QString& filename)
+{
+    close();
+    m_file.setFileName(filename);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+	m_error = m_file.errorString();
+	return false;
+    }
+    const qint64 size = m_file.size();
+    m_map = size > 0 ? m_file.map(0, size) : nullptr;
+    if (!m_map) {
+	m_error = QString("Cannot map '%1': %2").arg(filename).arg(m_file.errorString());
+	m_file.close();
+	return false;
+    }
+    return open(m_map, size);
+}
+
+/**
+ * @brief Index the archive at @p data
+ *
+ * The end of central directory record is searched backwards from the
+ * end, skipping an archive comment of up to 64 KiB. The memory must
+ * stay valid until close().
+ *
+ * @param data pointer to the first byte of the archive
+ * @param size number of bytes in the archive
+ * @return true on success, or false on error
+ */
+bool CasZip::open(const uchar* data, qint64 size)
+{
+    m_data = data;
+    m_size = size;
+    m_members.clear();
+    m_index.clear();
+
+    qint64 end = size - ZIP_END_SIZE;
+    const qint64 stop = qMax<qint64>(0, end - 65535);
+    while (end >= stop && util::rd32(data + end) != ZIP_END_SIG)
+	end--;
+    if (end < stop) {
+	m_error = QStringLiteral("No ZIP end of central directory record");
+	return false;
+    }
+
+    const int entries = static_cast<int>(util::rd16(data + end + 10));
+    const qint64 cd_size = util::rd32(data + end + 12);
+    const qint64 cd_offs = util::rd32(data + end + 16);
+    if (cd_offs == 0xffffffff || entries == 0xffff) {
+	m_error = QStringLiteral("ZIP64 archives are not supported");
+	return false;
+    }
+    if (cd_offs + cd_size > end) {
+	m_error = QStringLiteral("ZIP central directory is out of range");
+	return false;
+    }
+
+    m_members.reserve(entries);
+    qint64 pos = cd_offs;
+    for (int i = 0; i < entries; i++) {
+	const uchar* hdr = data + pos;
+	if (pos + ZIP_CENTRAL_SIZE > end || util::rd32(hdr) != ZIP_CENTRAL_SIG) {
+	    m_error = QString("ZIP central directory entry #%1 is corrupt").arg(i);
+	    return false;
+	}
+	const int name_len = static_cast<int>(util::rd16(hdr + 28));
+	const int extra_len = static_cast<int>(util::rd16(hdr + 30));
+	const int comment_len = static_cast<int>(util::rd16(hdr + 32));
+	if (pos + ZIP_CENTRAL_SIZE + name_len > end) {
+	    m_error = QString("ZIP central directory entry #%1 is corrupt").arg(i);
+	    return false;
+	}
+
+	Member m;
+	m.flags = static_cast<quint16>(util::rd16(hdr + 8));
+	m.method = static_cast<quint16>(util::rd16(hdr + 10));
+	m.crc32 = util::rd32(hdr + 16);
+	m.csize = util::rd32(hdr + 20);
+	m.usize = util::rd32(hdr + 24);
+	m.offs = util::rd32(hdr + 42);
+	const char* name = reinterpret_cast<const char *>(hdr + ZIP_CENTRAL_SIZE);
+	m.name = (m.flags & ZIP_FLAG_UTF8) ? QString::fromUtf8(name, name_len)
+					   : QString::fromLatin1(name, name_len);
+	pos += ZIP_CENTRAL_SIZE + name_len + extra_len + comment_len;
+
+	// Skip directories
+	if (m.name.endsWith(QChar('/')))
+	    continue;
+	m_index.insert(m.name, m_members.count());
+	m_members += m;
+    }
+    m_error.clear();
+    return true;
+}
+
+void CasZip::close()
+{
+    if (m_map)
+	m_file.unmap(m_map);
+    m_file.close();
+    m_map = nullptr;
+    m_data = nullptr;
+    m_size = 0;
+    m_members.clear();
+    m_index.clear();
+}
+
+/**
+ * @brief Return the reason why open() failed
+ */
+QString CasZip::error_string() const
+{
+    return m_error;
+}
+
+int CasZip::count() const
+{
+    return m_members.count();
+}
+
+const CasZip::Member& CasZip::member(int index) const
+{
+    return m_members[index];
+}
+
+/**
+ * @brief Return the index of the member @p name, or -1
+ */
+int CasZip::find(const QString& name) const
+{
+    return m_index.value(name, -1);
+}
+
+/**
+ * @brief Return the indices of the members which are cassette images
+ * These are the *.cas and *.wav files, as in a directory scan.
+ */
+QVector<int> CasZip::cassettes() const
+{
+    QVector<int> res;
+    for (int i = 0; i < m_members.count(); i++) {
+	const QString& name = m_members[i].name;
+	if (name.endsWith(QLatin1String(".cas"), Qt::CaseInsensitive) ||
+	    name.endsWith(QLatin1String(".wav"), Qt::CaseInsensitive))
+	    res += i;
+    }
+    return res;
+}
+
+/**
+ * @brief Inflate the member @p index into @p buffer
+ *
+ * The buffer only grows, so reading many members into the same buffer
+ * allocates just once for the largest of them. The CRC32 of the data
+ * is checked.
+ *
+ * @param index index of the member
+ * @param buffer reference to the QByteArray receiving the data
+ * @param error optional pointer to a QString receiving an error message
+ * @return true on success, or false on error
+ */
+bool CasZip::read(int index, QByteArray& buffer, QString* error) const
+{
+    QString dummy;
+    QString& msg = error ? *error : dummy;
+    if (index < 0 || index >= m_members.count()) {
+	msg = QString("No ZIP member #%1").arg(index);
+	return false;
+    }
+
+    const Member& m = m_members[index];
+    if (m.flags & ZIP_FLAG_ENCRYPTED) {
+	msg = QString("ZIP member '%1' is encrypted").arg(m.name);
+	return false;
+    }
+    const uchar* hdr = m_data + m.offs;
+    if (m.offs + ZIP_LOCAL_SIZE > m_size || util::rd32(hdr) != ZIP_LOCAL_SIG) {
+	msg = QString("ZIP member '%1' has no local header").arg(m.name);
+	return false;
+    }
+    const qint64 start = m.offs + ZIP_LOCAL_SIZE + util::rd16(hdr + 26) + util::rd16(hdr + 28);
+    if (start + m.csize > m_size || m.usize > 0x7fffffff) {
+	msg = QString("ZIP member '%1' is truncated").arg(m.name);
+	return false;
+    }
+
+    const int usize = static_cast<int>(m.usize);
+    if (buffer.capacity() < usize)
+	buffer.reserve(usize);
+    buffer.resize(usize);
+    Bytef* dst = reinterpret_cast<Bytef *>(buffer.data());
+
+    switch (m.method) {
+    case ZIP_STORED:
+	if (m.csize != m.usize) {
+	    msg = QString("ZIP member '%1' has a size mismatch").arg(m.name);
+	    return false;
+	}
+	memcpy(dst, m_data + start, static_cast<size_t>(usize));
+	break;
+
+    case ZIP_DEFLATED:
+	{
+	    z_stream zs;
+	    memset(&zs, 0, sizeof(zs));
+	    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+		msg = QString("Cannot initialize zlib for '%1'").arg(m.name);
+		return false;
+	    }
+	    zs.next_in = const_cast<Bytef *>(m_data + start);
+	    zs.avail_in = static_cast<uInt>(m.csize);
+	    zs.next_out = dst;
+	    zs.avail_out = static_cast<uInt>(usize);
+	    const int rc = inflate(&zs, Z_FINISH);
+	    const uLong total = zs.total_out;
+	    inflateEnd(&zs);
+	    if (rc != Z_STREAM_END || total != static_cast<uLong>(usize)) {
+		msg = QString("Inflating ZIP member '%1' failed").arg(m.name);
+		return false;
+	    }
+	}
+	break;
+
+    default:
+	msg = QString("ZIP member '%1' uses unsupported method %2").arg(m.name).arg(m.method);
+	return false;
+    }
+
+    const uLong crc = ::crc32(::crc32(0L, Z_NULL, 0), dst, static_cast<uInt>(usize));
+    if (static_cast<quint32>(crc) != m.crc32) {
+	msg = QString("ZIP member '%1' has a CRC32 error").arg(m.name);
+	return false;
+    }
+    return true;
+}
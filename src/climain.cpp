@@ -0,0 +1,209 @@
+/****************************************************************************
+ *
+ * Cass80 tool - command line tool main
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include "cass80batch.h"
+#include "cascache.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setApplicationName(QLatin1String("Cass80-cli"));
+    a.setApplicationVersion(QLatin1String("0.2.0"));
+    a.setOrganizationName(QLatin1String("pullmoll"));
+    a.setOrganizationDomain(QLatin1String("mamedev.myds.me"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QLatin1String("Batch processing of TRS80 and EG2000 cassette images"));
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    QCommandLineOption opt_hash(QStringList() << "c" << "hash",
+	QLatin1String("Print CRC32 and SHA1 digests of each image (default)."));
+    QCommandLineOption opt_listing(QStringList() << "l" << "listing",
+	QLatin1String("Write the BASIC source or Z80 disassembly to <name>.lst."));
+    QCommandLineOption opt_xml(QStringList() << "x" << "xml",
+	QLatin1String("Write the cassette XML description to <name>.xml."));
+    QCommandLineOption opt_repair(QStringList() << "r" << "repair",
+	QLatin1String("Write a cleaned up cassette image to <name>.out."));
+    QCommandLineOption opt_wav(QStringList() << "w" << "wav",
+	QLatin1String("Write the image as 16 bit PCM audio to <name>.wav."));
+    QCommandLineOption opt_csw(QStringList() << "csw",
+	QLatin1String("Write the image as compressed square wave to <name>.csw."));
+    QCommandLineOption opt_xref(QStringList() << "xref",
+	QLatin1String("Write the cross references of SYSTEM programs to <name>.xref."));
+    QCommandLineOption opt_split(QStringList() << "s" << "split",
+	QLatin1String("Decode every program on multi-program tapes (outputs get -NN tags)."));
+    QCommandLineOption opt_output_dir(QStringList() << "o" << "output-dir",
+	QLatin1String("Write output files to <dir> instead of next to the input."),
+	QLatin1String("dir"));
+    QCommandLineOption opt_jobs(QStringList() << "j" << "jobs",
+	QLatin1String("Number of images to process in parallel (default: all cores)."),
+	QLatin1String("n"));
+    QCommandLineOption opt_files_from(QStringList() << "f" << "files-from",
+	QLatin1String("Read file and directory names from <list>, one per line (- for stdin)."),
+	QLatin1String("list"));
+    QCommandLineOption opt_defs(QStringList() << "d" << "defs",
+	QLatin1String("Use the Z80 definitions in <xml> for listings."),
+	QLatin1String("xml"));
+    QCommandLineOption opt_uppercase(QStringList() << "u" << "uppercase",
+	QLatin1String("Use upper case in disassembly listings."));
+    QCommandLineOption opt_cache(QStringList() << "cache",
+	QString("Keep decoded images and listings in <file> (default: %1).")
+	    .arg(CasCache::default_filename()),
+	QLatin1String("file"));
+    QCommandLineOption opt_softlist(QStringList() << "softlist",
+	QLatin1String("Write a MAME software list of all images to <xml> (- for stdout)."),
+	QLatin1String("xml"));
+    QCommandLineOption opt_verify(QStringList() << "verify",
+	QLatin1String("Verify the MAME software list <xml> against the images."),
+	QLatin1String("xml"));
+    QCommandLineOption opt_list_name(QStringList() << "list-name",
+	QLatin1String("Name of the software list (default: cgenie_cass)."),
+	QLatin1String("name"), QLatin1String("cgenie_cass"));
+    QCommandLineOption opt_catalog(QStringList() << "catalog",
+	QLatin1String("Add the images to the deduplicating catalog <file>."),
+	QLatin1String("file"));
+    QCommandLineOption opt_duplicates(QStringList() << "duplicates",
+	QLatin1String("Report where else in the catalog the images or their blocks occur."));
+    QCommandLineOption opt_similar(QStringList() << "similar",
+	QLatin1String("Report clusters of near duplicate programs, e.g. patched or relocated."));
+    QCommandLineOption opt_base(QStringList() << "base",
+	QLatin1String("Use <image> as the base for --diff and to rebuild images from *.patch files."),
+	QLatin1String("image"));
+    QCommandLineOption opt_diff(QStringList() << "diff",
+	QLatin1String("Report the block differences to the --base image and write <name>.patch."));
+    QCommandLineOption opt_no_cache(QStringList() << "no-cache",
+	QLatin1String("Always decode images; do not read or write the cache."));
+
+    parser.addOption(opt_hash);
+    parser.addOption(opt_listing);
+    parser.addOption(opt_xml);
+    parser.addOption(opt_repair);
+    parser.addOption(opt_wav);
+    parser.addOption(opt_csw);
+    parser.addOption(opt_xref);
+    parser.addOption(opt_split);
+    parser.addOption(opt_output_dir);
+    parser.addOption(opt_jobs);
+    parser.addOption(opt_files_from);
+    parser.addOption(opt_defs);
+    parser.addOption(opt_uppercase);
+    parser.addOption(opt_softlist);
+    parser.addOption(opt_verify);
+    parser.addOption(opt_list_name);
+    parser.addOption(opt_cache);
+    parser.addOption(opt_no_cache);
+    parser.addOption(opt_catalog);
+    parser.addOption(opt_duplicates);
+    parser.addOption(opt_similar);
+    parser.addOption(opt_base);
+    parser.addOption(opt_diff);
+    parser.addPositionalArgument(QLatin1String("paths"),
+	QLatin1String("Cassette images, ZIP archives, or directories to scan for *.cas, *.wav and *.zip files."),
+	QLatin1String("[paths...]"));
+    parser.process(a);
+
+    quint32 outputs = Cass80Batch::OUT_NONE;
+    if (parser.isSet(opt_hash))
+	outputs |= Cass80Batch::OUT_HASH;
+    if (parser.isSet(opt_listing))
+	outputs |= Cass80Batch::OUT_LISTING;
+    if (parser.isSet(opt_xml))
+	outputs |= Cass80Batch::OUT_XML;
+    if (parser.isSet(opt_repair))
+	outputs |= Cass80Batch::OUT_REPAIR;
+    if (parser.isSet(opt_wav))
+	outputs |= Cass80Batch::OUT_WAV;
+    if (parser.isSet(opt_csw))
+	outputs |= Cass80Batch::OUT_CSW;
+    if (parser.isSet(opt_xref))
+	outputs |= Cass80Batch::OUT_XREF;
+    if (parser.isSet(opt_softlist))
+	outputs |= Cass80Batch::OUT_SOFTLIST;
+    if (parser.isSet(opt_verify))
+	outputs |= Cass80Batch::OUT_VERIFY;
+    if (parser.isSet(opt_duplicates))
+	outputs |= Cass80Batch::OUT_DUPLICATES;
+    if (parser.isSet(opt_similar))
+	outputs |= Cass80Batch::OUT_SIMILAR;
+    if (parser.isSet(opt_duplicates) && !parser.isSet(opt_catalog)) {
+	qCritical("--duplicates needs a --catalog");
+	return 2;
+    }
+    if (parser.isSet(opt_diff))
+	outputs |= Cass80Batch::OUT_DIFF;
+    if (parser.isSet(opt_diff) && !parser.isSet(opt_base)) {
+	qCritical("--diff needs a --base");
+	return 2;
+    }
+    if ((outputs & Cass80Batch::OUT_SOFTLIST) && (outputs & Cass80Batch::OUT_VERIFY)) {
+	qCritical("--softlist and --verify cannot be used together");
+	return 2;
+    }
+    if (Cass80Batch::OUT_NONE == outputs)
+	outputs = Cass80Batch::OUT_HASH;
+
+    Cass80Batch batch(outputs);
+    batch.set_uppercase(parser.isSet(opt_uppercase));
+    batch.set_split(parser.isSet(opt_split));
+    if (parser.isSet(opt_output_dir))
+	batch.set_output_dir(parser.value(opt_output_dir));
+    if (parser.isSet(opt_jobs))
+	batch.set_jobs(parser.value(opt_jobs).toInt());
+    if (parser.isSet(opt_defs) && !batch.set_defs(parser.value(opt_defs)))
+	return 2;
+    if (parser.isSet(opt_softlist))
+	batch.set_softlist(parser.value(opt_softlist), parser.value(opt_list_name));
+    if (parser.isSet(opt_verify))
+	batch.set_softlist(parser.value(opt_verify), parser.value(opt_list_name));
+    if (!parser.isSet(opt_no_cache))
+	batch.set_cache(parser.isSet(opt_cache) ? parser.value(opt_cache)
+						: CasCache::default_filename());
+
+    if (parser.isSet(opt_catalog) && !batch.set_catalog(parser.value(opt_catalog)))
+	return 2;
+    if (parser.isSet(opt_base) && !batch.set_base(parser.value(opt_base)))
+	return 2;
+
+    foreach(const QString& list, parser.values(opt_files_from))
+	batch.add_file_list(list);
+    foreach(const QString& path, parser.positionalArguments())
+	batch.add_path(path);
+
+    if (batch.files().isEmpty())
+	parser.showHelp(1);
+
+    return batch.run() ? 1 : 0;
+}
@@ -31,10 +31,10 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  ****************************************************************************/
+#include <cstring>
 #include "bdfcgenie.h"
 #include "z80defs.h"
 #include "z80dasm.h"
-#include "z80token.h"
 #include "util.h"
 
 z80Dasm::z80Dasm(bool upper, const z80Defs* defs, const bdfCgenie* bdf)
@@ -45,6 +45,9 @@ z80Dasm::z80Dasm(bool upper, const z80Defs* defs, const bdfCgenie* bdf)
     , m_comment_column(48)
     , m_defs(defs)
     , m_bdf(bdf)
+    , m_code()
+    , m_insn()
+    , m_xref()
 {
     Q_ASSERT(m_defs);
     if (!m_defs) {
@@ -113,11 +116,11 @@ int z80Dasm::offs(qint8 offset)
 
 QString z80Dasm::symbol_w(quint32 ea)
 {
-    z80Def ent = m_defs->entry(ea);
-    if (!ent.isNull() && ent->has_symbol()) {
+    const z80DefObj& ent = m_defs->at(ea);
+    if (ent.has_symbol()) {
 	if (m_uppercase)
-	    return ent->symbol().toUpper();
-	return ent->symbol().toLower();
+	    return ent.symbol().toUpper();
+	return ent.symbol().toLower();
     }
     return hexw(ea);
 }
@@ -217,8 +220,7 @@ QString z80Dasm::dasm_defs(quint32 pc, off_t& pos, const quint8* opram)
     while (pc + pos < 0x10000 && byte == opram[pos]) {
 	n++;
 	pos++;
-	z80Def ent = m_defs->entry(pc + pos);
-	if (ent->type() != z80DefObj::DEFS)
+	if (m_defs->type(pc + pos) != z80DefObj::DEFS)
 	    break;
     }
     dasm += str + QString::number(n);
@@ -265,8 +267,8 @@ QString z80Dasm::dasm_text(quint32 pc, off_t& pos, const quint8* opram)
 	}
 	prev = opram[pos++];
 
-	z80Def ent = m_defs->entry(pc + pos);
-	if (ent->is_at_addr(pc + pos) && ent->type() != z80DefObj::TEXT)
+	const z80DefObj& ent = m_defs->at(pc + pos);
+	if (ent.is_at_addr(pc + pos) && ent.type() != z80DefObj::TEXT)
 	    break;
     }
 
@@ -334,8 +336,8 @@ QString z80Dasm::dasm_token(quint32 pc, off_t& pos, const quint8* opram)
 		str += QChar(uc);
 	    }
 	}
-	z80Def ent = m_defs->entry(pc + pos);
-	if (ent->is_at_addr(pc + pos) && ent->type() != z80DefObj::TOKEN)
+	const z80DefObj& ent = m_defs->at(pc + pos);
+	if (ent.is_at_addr(pc + pos) && ent.type() != z80DefObj::TOKEN)
 	    break;
 	pos++;
     }
@@ -349,10 +351,13 @@ QString z80Dasm::dasm_token(quint32 pc, off_t& pos, const quint8* opram)
 }
 
 /**
- * @brief Disassemble a Z80 opcode
+ * @brief Decode the Z80 instruction at @p pc
  *
- * Disassemble a single opcode. The distinction between @p oprom and @p opram
- * is here because MAME uses it to provide support for encrypted memory.
+ * Decode a single opcode into its length, mnemonic, operands and the
+ * target of a jump or call. No text is formatted, so this is cheap
+ * enough for passes over all of the 64 KiB address space. The
+ * distinction between @p oprom and @p opram is here because MAME uses
+ * it to provide support for encrypted memory.
  *
  * This means opram could be different from oprom and point to a decrypted
  * memory range for the same program counter.
@@ -361,67 +366,139 @@ QString z80Dasm::dasm_token(quint32 pc, off_t& pos, const quint8* opram)
  * the Z80 while @p opram is used for data following that opcode.
  *
  * @param pc program counter
- * @param pos position in opram
- * @param flags flags for the opcode
- * @param oprom pointer to opcode ROM
- * @param opram pointer to opcode RAM
- * @return string with words defined
+ * @param oprom pointer to opcode ROM at @p pc
+ * @param opram pointer to opcode RAM at @p pc
+ * @return z80Insn with the decoded instruction
  */
-QString z80Dasm::dasm_code(quint32 pc, off_t& pos, quint32& flags, const quint8* oprom, const quint8* opram)
+z80Insn z80Dasm::decode(quint32 pc, const quint8* oprom, const quint8* opram)
 {
-    QString dasm;
-    QString ixy = QLatin1String("oops!!");
-    qint8 offset = 0;
-    quint8 op = oprom[pos++];
-    quint8 op1 = 0;
-    quint32 ea = 0;
-    z80Token d;
-
-    switch (op) {
+    z80Insn insn;
+    const z80Token* d;
+    int pos = 0;
+
+    insn.pc = pc;
+    insn.op = oprom[pos++];
+    switch (insn.op) {
     case 0xcb:	// CB prefixed instructions (shift, rotate, bit manipulation, ...)
-	op = oprom[pos++];
-	d = z80Token::mnemonic_cb(op);
+	insn.prefix = insn.op;
+	insn.op = oprom[pos++];
+	d = &z80Token::mnemonic_cb(insn.op);
 	break;
 
     case 0xed:	// ED prefixed instructions (block move, in, out, 16bit arith, ...)
-	op1 = oprom[pos++];
-	d = z80Token::mnemonic_ed(op1);
+	insn.prefix = insn.op;
+	insn.op1 = oprom[pos++];
+	d = &z80Token::mnemonic_ed(insn.op1);
 	break;
 
     case 0xdd:	// DD prefixed instructions (IX register)
-	ixy = QLatin1String("ix");
-	op1 = oprom[pos++];
-	if(op1 == 0xcb) {
-	    offset = static_cast<qint8>(opram[pos++]);
-	    op1 = opram[pos++]; /* fourth byte from opbase.ram! */
-	    d = z80Token::mnemonic_xx_cb(op1);
-	} else {
-	    d = z80Token::mnemonic_xx(op1);
-	}
-	break;
-
-    case 0xfd:	// DD prefixed instructions (IY register)
-	ixy = QLatin1String("iy");
-	op1 = oprom[pos++];
-	if (op1 == 0xcb) {
-	    offset = static_cast<qint8>(opram[pos++]);
-	    op1 = opram[pos++]; /* fourth byte from opbase.ram! */
-	    d = z80Token::mnemonic_xx_cb(op1);
+    case 0xfd:	// FD prefixed instructions (IY register)
+	insn.prefix = insn.op;
+	insn.op1 = oprom[pos++];
+	if (insn.op1 == 0xcb) {
+	    insn.offset = static_cast<qint8>(opram[pos++]);
+	    insn.op1 = opram[pos++]; /* fourth byte from opbase.ram! */
+	    d = &z80Token::mnemonic_xx_cb(insn.op1);
 	} else {
-	    d = z80Token::mnemonic_xx(op1);
+	    d = &z80Token::mnemonic_xx(insn.op1);
 	}
 	break;
 
     default:
-	d = z80Token::mnemonic_main(op);
+	d = &z80Token::mnemonic_main(insn.op);
 	break;
     }
 
-    if (nullptr == d.parameters()) {
-	dasm += z80Token::string(d.mnemonic());
+    insn.mnemonic = d->mnemonic();
+    insn.operands = d->parameters();
+    insn.flags = d->flags();
+
+    for (const char* p = insn.operands; p && *p; p++) {
+	switch (*p) {
+	case 'A':	// address op arg
+	case 'N':	// 16 bit immediate
+	case 'W':	// Memory address word
+	    insn.ea = util::rd16(opram + pos);
+	    pos += 2;
+	    insn.has_target = 'A' == *p;
+	    break;
+	case 'B':	// byte op arg
+	case 'P':	// Port number
+	    insn.ea = opram[pos++];
+	    break;
+	case 'O':	// Offset relative to PC
+	    insn.ea = static_cast<quint16>(pc + static_cast<qint8>(opram[pos++]) + 2);
+	    insn.has_target = true;
+	    break;
+	case 'V':	// Restart vector
+	    insn.ea = insn.op & 0x38;
+	    insn.has_target = true;
+	    break;
+	case 'X':	// Signed 7 bit offset
+	    insn.offset = static_cast<qint8>(opram[pos++]);
+	    break;
+	}
+    }
+
+    insn.length = pos;
+    // Only jumps and calls have a target
+    if (!(insn.flags & (z80Token::DASMFLAG_JUMP | z80Token::DASMFLAG_CALL)))
+	insn.has_target = false;
+    if (insn.has_target)
+	insn.target = insn.ea;
+    return insn;
+}
+
+/**
+ * @brief Decode the Z80 instruction at @p pc of @p memory
+ *
+ * Bytes past the end of the memory read as 00h, so an instruction
+ * at the very end is decoded without reading past the buffer.
+ *
+ * @param memory const reference to the memory image
+ * @param pc program counter
+ * @return z80Insn with the decoded instruction
+ */
+z80Insn z80Dasm::decode(const QByteArray& memory, quint32 pc)
+{
+    const quint8* mem = reinterpret_cast<const quint8 *>(memory.constData());
+    const quint32 size = static_cast<quint32>(memory.size());
+    if (pc + 4 <= size)
+	return decode(pc, mem + pc, mem + pc);
+
+    quint8 bytes[4];
+    for (quint32 i = 0; i < 4; i++)
+	bytes[i] = pc + i < size ? mem[pc + i] : 0x00;
+    return decode(pc, bytes, bytes);
+}
+
+/**
+ * @brief Render the decoded instruction @p insn as text
+ * @param insn const reference to the z80Insn
+ * @return string with the mnemonic and its operands
+ */
+QString z80Dasm::text(const z80Insn& insn)
+{
+    if (m_uppercase)
+	return dasm_code(insn).toUpper();
+    return dasm_code(insn).toLower();
+}
+
+/**
+ * @brief Format a decoded Z80 opcode
+ * @param insn const reference to the z80Insn
+ * @return string with the mnemonic and its operands
+ */
+QString z80Dasm::dasm_code(const z80Insn& insn)
+{
+    QString dasm;
+    const QString ixy = QLatin1String(0xdd == insn.prefix ? "ix" : 0xfd == insn.prefix ? "iy" : "oops!!");
+
+    if (nullptr == insn.operands) {
+	dasm += z80Token::string(insn.mnemonic);
     } else {
-	const char* params = d.parameters();
-	QString str = z80Token::string(d.mnemonic());
+	const char* params = insn.operands;
+	QString str = z80Token::string(insn.mnemonic);
 	str.resize(7, QChar::Space);
 	dasm += str;
 
@@ -429,50 +506,28 @@ QString z80Dasm::dasm_code(quint32 pc, off_t& pos, quint32& flags, const quint8*
 	    switch (params[i]) {
 	    case '?':	// illegal opcode
 		dasm += QString("%1,%2")
-			.arg(hexb(op))
-			.arg(hexb(op1));
+			.arg(hexb(insn.op))
+			.arg(hexb(insn.op1));
 		break;
 	    case 'A':	// address op arg
-		ea = util::rd16(opram + pos);
-		pos += 2;
-		dasm += symbol_w(ea);
-		break;
-	    case 'B':   // byte op arg
-		ea = opram[pos++];
-		dasm += hexb(ea);
-		break;
-	    case 'N':   // 16 bit immediate
-		ea = util::rd16(opram + pos);
-		pos += 2;
-		dasm += hexw(ea);
-		break;
 	    case 'O':   // Offset relative to PC
-		offset = static_cast<qint8>(opram[pos++]);
-		ea = static_cast<quint16>(pc + offset + 2);
-		dasm += symbol_w(ea);
+		dasm += symbol_w(insn.ea);
 		break;
+	    case 'B':   // byte op arg
 	    case 'P':   // Port number
-		ea = opram[pos++];
-		dasm += hexb(ea);
-		break;
 	    case 'V':   // Restart vector
-		ea = op & 0x38;
-		dasm += hexb(ea);
+		dasm += hexb(insn.ea);
 		break;
+	    case 'N':   // 16 bit immediate
 	    case 'W':   // Memory address word
-		ea = static_cast<quint32>(opram[pos+0]) |
-			(static_cast<quint32>(opram[pos+1]) << 8);
-		pos += 2;
-		dasm += hexw(ea);
+		dasm += hexw(insn.ea);
 		break;
 	    case 'X':	// Signed 7 bit offset
-		offset = static_cast<qint8>(opram[pos++]);
-		/* fall through */
 	    case 'Y':	// IX or IY +/- offset
 		dasm += QString("%1%2%3")
 			.arg(ixy)
-			.arg(sign(offset))
-			.arg(hexb(offs(offset)));
+			.arg(sign(insn.offset))
+			.arg(hexb(offs(insn.offset)));
 		break;
 	    case 'I':	// IX or IY
 		dasm += ixy;
@@ -483,11 +538,218 @@ QString z80Dasm::dasm_code(quint32 pc, off_t& pos, quint32& flags, const quint8*
 	}
     }
 
-    flags = d.flags();
-
     return dasm;
 }
 
+/**
+ * @brief Disassemble a run of data bytes
+ *
+ * The run ends after m_bytes_per_line bytes, at code found by
+ * discover(), at a definition, or at a referenced address.
+ *
+ * @param pc program counter
+ * @param pos reference to a counter for the number of bytes
+ * @param opram pointer to the RAM at address of @p pc
+ * @return string with the bytes defined
+ */
+QString z80Dasm::dasm_data(quint32 pc, off_t& pos, const quint8* opram)
+{
+    QString str = z80Token::string(z80Token::z80DEFB);
+    str.resize(7, QChar::Space);
+    pos = 0;
+    do {
+	if (pos > 0)
+	    str += QChar(',');
+	str += hexb(opram[pos]);
+	pos++;
+    } while (pos < m_bytes_per_line && pc + pos < 0x10000 && !is_code(pc + pos) &&
+	     !m_defs->at(pc + pos).is_at_addr(pc + pos) && 0 == m_xref.count(pc + pos));
+
+    if (m_uppercase)
+	return str.toUpper();
+    return str.toLower();
+}
+
+/**
+ * @brief Find the code reachable from @p entries by following the flow
+ *
+ * Starting at each entry, instructions are decoded up to an
+ * unconditional jump or return. The targets of all jumps and calls
+ * are added to the worklist. Decoding stops at instructions found
+ * before, and at definitions of anything but code. RST 08h is
+ * followed by the byte it compares with, which is skipped.
+ *
+ * With a ROM of @p rom_size bytes in @p memory the restart vectors,
+ * the NMI handler and the code definitions inside the ROM are entries,
+ * too.
+ *
+ * Afterwards listing() lists the bytes not found to be code as DEFB.
+ * Without entries, e.g. for a truncated image, or if no code is found
+ * from @p pc_min to @p pc_max, nothing is known and listing() decodes
+ * everything as code like without discover().
+ *
+ * @param memory const reference to the 64 KiB memory image
+ * @param entries list of entry addresses, e.g. of the BT_ENTRY blocks
+ * @param pc_min first address of the program
+ * @param pc_max last address of the program
+ * @param rom_size size of the ROM at address 0000h, or 0 if there is none
+ */
+void z80Dasm::discover(const QByteArray& memory, const QVector<quint32>& entries,
+		       quint32 pc_min, quint32 pc_max, quint32 rom_size)
+{
+    QVector<quint32> work = entries;
+
+    m_code.clear();
+    m_insn.clear();
+    if (entries.isEmpty())
+	return;
+
+    m_code.fill(false, 0x10000);
+    m_insn.fill(false, 0x10000);
+    if (rom_size > 0x66) {
+	for (quint32 vector = 0x00; vector <= 0x38; vector += 8)
+	    work += vector;
+	work += 0x66;
+	const QMap<quint32,z80Def> defs = m_defs->defs();
+	foreach(const z80Def& def, defs) {
+	    if (z80DefObj::CODE == def->type() && def->orig() < rom_size)
+		work += def->orig();
+	}
+    }
+
+    const quint32 flow = z80Token::DASMFLAG_JUMP | z80Token::DASMFLAG_RETURN;
+    while (!work.isEmpty()) {
+	quint32 pc = work.takeLast() & 0xffff;
+	while (!m_insn.testBit(static_cast<int>(pc))) {
+	    const z80DefObj& def = m_defs->at(pc);
+	    if (def.is_at_addr(pc) && z80DefObj::CODE != def.type())
+		break;
+
+	    const z80Insn insn = decode(memory, pc);
+	    m_insn.setBit(static_cast<int>(pc));
+	    for (int i = 0; i < insn.length; i++)
+		m_code.setBit(static_cast<int>((pc + static_cast<quint32>(i)) & 0xffff));
+	    if (insn.has_target)
+		work += insn.target;
+	    if (insn.flags & z80Token::DASMFLAG_FINAL)
+		break;
+	    if ((insn.flags & flow) && !(insn.flags & z80Token::DASMFLAG_COND))
+		break;
+
+	    quint32 next = pc + static_cast<quint32>(insn.length);
+	    if (z80Token::z80RST == insn.mnemonic && 0x08 == insn.ea)
+		next++;
+	    pc = next & 0xffff;
+	}
+    }
+
+    for (quint32 pc = pc_min; pc <= pc_max && pc < 0x10000; pc++)
+	if (m_code.testBit(static_cast<int>(pc)))
+	    return;
+    m_code.clear();
+    m_insn.clear();
+}
+
+/**
+ * @brief Return true if discover() found @p addr to be part of code
+ * @param addr address
+ * @return true for code, or if discover() was not run
+ */
+bool z80Dasm::is_code(quint32 addr) const
+{
+    if (m_code.isEmpty())
+	return true;
+    return m_code.testBit(static_cast<int>(addr & 0xffff));
+}
+
+/**
+ * @brief Return true if discover() found an instruction starting at @p addr
+ * @param addr address
+ * @return true for the first byte of an instruction
+ */
+bool z80Dasm::is_insn(quint32 addr) const
+{
+    if (m_insn.isEmpty())
+	return false;
+    return m_insn.testBit(static_cast<int>(addr & 0xffff));
+}
+
+/**
+ * @brief Build the cross reference index of the code from @p pc_min to @p pc_max
+ *
+ * Each instruction is decoded once. Jumps and calls refer to their
+ * target, loads and stores to their memory address (nn). After
+ * discover() the instructions found are decoded, otherwise the code
+ * is decoded in sequence like listing() does.
+ *
+ * listing() then writes the references to an address as XREF comments.
+ *
+ * @param memory const reference to the 64 KiB memory image
+ * @param pc_min first address
+ * @param pc_max last address
+ */
+void z80Dasm::cross_reference(const QByteArray& memory, quint32 pc_min, quint32 pc_max)
+{
+    m_xref.clear();
+    for (quint32 pc = pc_min; pc <= pc_max && pc < 0x10000; /* */) {
+	const bool code = m_insn.isEmpty() ? z80DefObj::CODE == m_defs->type(pc) : is_insn(pc);
+	if (!code) {
+	    pc++;
+	    continue;
+	}
+
+	const z80Insn insn = decode(memory, pc);
+	if (insn.has_target) {
+	    const bool call = insn.flags & z80Token::DASMFLAG_CALL;
+	    m_xref.add(pc, insn.target, call ? z80Xref::XREF_CALL : z80Xref::XREF_JUMP);
+	}
+	const char* mem = insn.operands ? strchr(insn.operands, 'W') : nullptr;
+	if (mem) {
+	    // Memory is read if (nn) is the source operand
+	    const char* comma = strchr(insn.operands, ',');
+	    const bool read = comma && comma < mem;
+	    m_xref.add(pc, insn.ea, read ? z80Xref::XREF_READ : z80Xref::XREF_WRITE);
+	}
+	pc += static_cast<quint32>(insn.length);
+    }
+    m_xref.finish();
+}
+
+/**
+ * @brief Return the cross reference index built by cross_reference()
+ */
+const z80Xref& z80Dasm::xref() const
+{
+    return m_xref;
+}
+
+/**
+ * @brief Return the XREF comment lines for the address @p pc
+ * @param pc address
+ * @return QStringList with the comments, up to six references per line
+ */
+QStringList z80Dasm::xref_comments(quint32 pc)
+{
+    QStringList result;
+    QStringList refs;
+    const z80Ref* ref = m_xref.refs(pc);
+    for (int i = 0; i < m_xref.count(pc); i++, ref++) {
+	refs += QString("%1 %2")
+		.arg(QString(z80Xref::name(ref->kind)))
+		.arg(x16(ref->from));
+	if (6 == refs.count()) {
+	    result += QString("; XREF %1").arg(refs.join(QString(", ")));
+	    refs.clear();
+	}
+    }
+    if (!refs.isEmpty())
+	result += QString("; XREF %1").arg(refs.join(QString(", ")));
+
+    for (int i = 0; i < result.count(); i++)
+	result[i] = m_uppercase ? result[i].toUpper() : result[i].toLower();
+    return result;
+}
+
 /**
  * @brief disassemble opcode at @p pc and return number of bytes it takes
  * @param pc current program counter
@@ -501,17 +763,10 @@ QString z80Dasm::dasm(quint32 pc, off_t& pos, quint32& flags, const quint8 *opro
     QString buffer;
     QString dasm;
     QString ixy;
-    z80Def def = m_defs->entry(pc);
-
-    if (def.isNull()) {
-	def = z80Def(new z80DefObj());
-	def->set_type(z80DefObj::CODE);
-    }
-
     pos = 0;
     flags = 0;
 
-    switch (def->type()) {
+    switch (m_defs->type(pc)) {
     case z80DefObj::DEFB:
 	dasm += dasm_defb(pc, pos, opram);
 	break;
@@ -537,7 +792,12 @@ QString z80Dasm::dasm(quint32 pc, off_t& pos, quint32& flags, const quint8 *opro
 	break;
 
     case z80DefObj::CODE:
-	dasm += dasm_code(pc, pos, flags, oprom, opram);
+	{
+	    const z80Insn insn = decode(pc, oprom, opram);
+	    dasm += dasm_code(insn);
+	    pos = insn.length;
+	    flags = insn.flags;
+	}
 	break;
 
     default:
@@ -563,25 +823,31 @@ QStringList z80Dasm::listing(const QByteArray& memory, quint32 pc_min, quint32 p
     result.reserve(pc_max + 1 - pc_min);
 
     for (quint32 pc = pc_min; pc <= pc_max; /* */) {
-	z80Def def = m_defs->entry(pc);
-	bool at_addr = def->is_at_addr(pc);
+	const z80DefObj& def = m_defs->at(pc);
+	bool at_addr = def.is_at_addr(pc);
 
-	if (at_addr && def->has_block_comments()) {
-	    QStringList comments = def->block_comments();
+	if (at_addr && def.has_block_comments()) {
+	    QStringList comments = def.block_comments();
 	    foreach(const QString& comment, comments) {
 		result += QString("; %1").arg(comment);
 	    }
 	}
 
-	if (at_addr && def->has_symbol()) {
-	    QString symbol = def->symbol(m_uppercase);
+	if (at_addr && def.has_symbol()) {
+	    QString symbol = def.symbol(m_uppercase);
 	    result += QString("\n%1:").arg(symbol);
 	}
 
+	if (m_xref.count(pc) > 0)
+	    result += xref_comments(pc);
+
 	off_t bytes = 0;
 	quint32 flags = 0;
 	QString bdump;
-	QString line = dasm(pc, bytes, flags, oprom + pc, opram + pc);
+	// Code the flow never reached is data
+	QString line = z80DefObj::CODE == def.type() && !is_code(pc)
+		     ? dasm_data(pc, bytes, opram + pc)
+		     : dasm(pc, bytes, flags, oprom + pc, opram + pc);
 	for (off_t i = 0; i < m_bytes_per_line; i++) {
 	    if (i < bytes) {
 		bdump += x08(oprom[pc+i]);
@@ -594,10 +860,10 @@ QStringList z80Dasm::listing(const QByteArray& memory, quint32 pc_min, quint32 p
 			 .arg(bdump)
 			 .arg(line);
 
-	if (at_addr && def->has_line_comments()) {
+	if (at_addr && def.has_line_comments()) {
 	    if (buffer.length() < m_comment_column)
 		buffer.resize(m_comment_column, QChar::Space);
-	    QStringList comments = def->line_comments();
+	    QStringList comments = def.line_comments();
 	    buffer += QString("; %1").arg(comments.first());
 
 	    if (comments.count() > 1) {
@@ -33,10 +33,40 @@
  ****************************************************************************/
 #pragma once
 #include <QtCore>
+#include "z80token.h"
+#include "z80xref.h"
 
 class bdfCgenie;
 class z80Defs;
 
+/**
+ * @brief One decoded Z80 instruction
+ *
+ * This is everything the analysis of code needs, decoded from the
+ * bytes without formatting any text. z80Dasm::text() renders it.
+ */
+class z80Insn
+{
+public:
+    z80Insn()
+	: pc(0), length(1), mnemonic(z80Token::z80DB), operands(nullptr), flags(0)
+	, ea(0), target(0), has_target(false), offset(0), prefix(0), op(0), op1(0)
+    {}
+
+    quint32 pc;			//!< address of the first byte
+    int length;			//!< length in bytes, 1 to 4
+    z80Token::z80Mnemonic mnemonic;
+    const char* operands;	//!< operand template of the z80Token
+    quint32 flags;		//!< z80Token::z80Flags
+    quint32 ea;			//!< address, immediate, port or vector operand
+    quint32 target;		//!< target of a jump or call, if has_target
+    bool has_target;		//!< true if the target is known from the bytes
+    qint8 offset;		//!< IX or IY offset
+    quint8 prefix;		//!< CBh, EDh, DDh, FDh, or 0 for none
+    quint8 op;			//!< opcode, as printed for illegal opcodes
+    quint8 op1;			//!< opcode after the prefix, as printed for illegal opcodes
+};
+
 class z80Dasm
 {
 public:
@@ -44,6 +74,18 @@ public:
     QString dasm(quint32 pc, off_t& bytes, quint32& flags, const quint8* oprom, const quint8* opram);
     QStringList listing(const QByteArray& memory, quint32 pc_min, quint32 pc_max);
 
+    static z80Insn decode(quint32 pc, const quint8* oprom, const quint8* opram);
+    static z80Insn decode(const QByteArray& memory, quint32 pc);
+    QString text(const z80Insn& insn);
+
+    void discover(const QByteArray& memory, const QVector<quint32>& entries,
+		  quint32 pc_min, quint32 pc_max, quint32 rom_size = 0);
+    bool is_code(quint32 addr) const;
+    bool is_insn(quint32 addr) const;
+
+    void cross_reference(const QByteArray& memory, quint32 pc_min, quint32 pc_max);
+    const z80Xref& xref() const;
+
 private:
     quint32 unicode(uchar ch) const;
     QString hexb(quint32 val);
@@ -59,7 +101,9 @@ private:
     QString dasm_defs(quint32 pc, off_t& pos, const quint8* opram);
     QString dasm_text(quint32 pc, off_t& pos, const quint8* opram);
     QString dasm_token(quint32 pc, off_t& pos, const quint8* opram);
-    QString dasm_code(quint32 pc, off_t& pos, quint32& flags, const quint8* oprom, const quint8* opram);
+    QString dasm_code(const z80Insn& insn);
+    QString dasm_data(quint32 pc, off_t& pos, const quint8* opram);
+    QStringList xref_comments(quint32 pc);
     bool m_uppercase;
     bool m_comment_glyphs;
     int m_bytes_per_line;
@@ -67,6 +111,9 @@ private:
     int m_comment_column;
     const z80Defs* m_defs;
     const bdfCgenie* m_bdf;
+    QBitArray m_code;		//!< bytes found to be code by discover()
+    QBitArray m_insn;		//!< first bytes of the instructions found by discover()
+    z80Xref m_xref;		//!< references built by cross_reference()
 
     static inline QChar sign(qint8 offset);
     static inline int offs(qint8 offset);
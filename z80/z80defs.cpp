@@ -46,11 +46,28 @@ z80Defs::z80Defs(const QString& filename)
     , m_doc()
     , m_defs()
     , m_dummy(new z80DefObj())
+    , m_index()
+    , m_table()
 {
-    if (nullptr != m_filename)
-	load();
     m_dummy->set_type(z80DefObj::CODE);
     m_dummy->set_orig(~0u);
+    clear_index();
+    if (nullptr != m_filename)
+	load();
+}
+
+/**
+ * @brief Empty the address index
+ *
+ * Every address of the 64K address space has a slot in m_index with
+ * the position of its definition in m_table. Position 0 is the dummy
+ * definition, so a lookup never has to test for a missing entry.
+ */
+void z80Defs::clear_index()
+{
+    m_index.fill(0, 0x10000);
+    m_table.clear();
+    m_table += m_dummy.data();
 }
 
 bool z80Defs::load(const QString& filename)
@@ -76,12 +93,13 @@ bool z80Defs::load(const QString& filename)
     }
 
     m_defs.clear();
+    clear_index();
     QDomElement root = m_doc.firstChildElement();
     QString tag_name = root.tagName().toUpper();
     if (tag_name == xml_tag_def) {
 	for (QDomElement child = root.firstChildElement(); !child.isNull(); child = child.nextSiblingElement()) {
 	    z80DefObj* def = new z80DefObj(child);
-	    m_defs.insert(def->orig(), z80Def(def));
+	    insert(def->orig(), def);
 	}
     } else {
 	res = false;
@@ -139,6 +157,22 @@ z80Def z80Defs::entry(quint32 addr) const
     return m_dummy;
 }
 
+/**
+ * @brief Return the definition for the address @p addr
+ *
+ * This is the lookup for the disassembler. It is one access to the
+ * address index and one to the table, without copying a z80Def.
+ *
+ * @param addr address
+ * @return const reference to the definition, or to a CODE dummy
+ */
+const z80DefObj& z80Defs::at(quint32 addr) const
+{
+    if (addr > 0xffff)
+	return *entry(addr);
+    return *m_table[static_cast<int>(m_index[static_cast<int>(addr)])];
+}
+
 z80Def z80Defs::add_entry(quint32 addr)
 {
     z80Def def;
@@ -168,13 +202,19 @@ z80Def z80Defs::add_entry(quint32 addr)
 
 z80DefObj::EntryType z80Defs::type(quint32 addr) const
 {
-    z80Def d = entry(addr);
-    if (d.isNull())
-	return z80DefObj::INVALID;
-    return d->type();
+    return at(addr).type();
 }
 
 void z80Defs::insert(quint32 addr, z80DefObj* def)
 {
     m_defs.insert(addr, z80Def(def));
+    if (addr > 0xffff)
+	return;
+    quint32& pos = m_index[static_cast<int>(addr)];
+    if (0 == pos) {
+	pos = static_cast<quint32>(m_table.count());
+	m_table += def;
+    } else {
+	m_table[static_cast<int>(pos)] = def;
+    }
 }
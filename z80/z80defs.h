@@ -33,6 +33,7 @@
  ****************************************************************************/
 #pragma once
 #include <QMap>
+#include <QVector>
 #include "z80def.h"
 
 class z80Defs
@@ -47,6 +48,7 @@ public:
     QString system() const;
     QMap<quint32,z80Def> defs() const;
     z80Def entry(quint32 addr) const;
+    const z80DefObj& at(quint32 addr) const;
     z80DefObj::EntryType type(quint32 addr) const;
 
     void insert(quint32 addr, z80DefObj* entry);
@@ -58,4 +60,7 @@ private:
     QDomDocument m_doc;
     QMap<quint32,z80Def> m_defs;
     z80Def m_dummy;
+    QVector<quint32> m_index;		//!< 64K addresses to positions in m_table
+    QVector<const z80DefObj*> m_table;	//!< definitions; position 0 is m_dummy
+    void clear_index();
 };
@@ -34,13 +34,6 @@
 #include <QHash>
 #include "z80token.h"
 
-z80Token::z80Token(const z80Token& other)
-    : m_mnemonic(other.m_mnemonic)
-    , m_parameters(other.m_parameters)
-    , m_flags(other.m_flags)
-{
-}
-
 z80Token::z80Mnemonic z80Token::mnemonic() const
 {
     return m_mnemonic;
@@ -51,25 +44,75 @@ const char* z80Token::parameters() const
     return m_parameters;
 }
 
-z80Token::z80Flags z80Token::flags() const
+quint32 z80Token::flags() const
 {
     return m_flags;
 }
 
-z80Token::z80Token(z80Token::z80Mnemonic m, const char* p, const z80Flags flags)
-    : m_mnemonic(m)
-    , m_parameters(p)
-    , m_flags(flags)
+/**
+ * @brief Return the number of bytes read for the operands
+ * This does not include the opcode and its prefixes.
+ * @return number of bytes
+ */
+int z80Token::operand_bytes() const
+{
+    return m_operand_bytes;
+}
+
+/**
+ * @brief Decode the instruction at @p oprom
+ *
+ * This only looks up the tables; no text is formatted.
+ *
+ * @param oprom pointer to the first opcode byte
+ * @param length optional pointer to an int receiving the length in bytes
+ * @return const reference to the decode table entry
+ */
+const z80Token& z80Token::decode(const quint8* oprom, int* length)
 {
+    int prefix;
+    const z80Token* d;
 
+    switch (oprom[0]) {
+    case 0xcb:
+	prefix = 2;
+	d = &mnemonic_cb(oprom[1]);
+	break;
+    case 0xed:
+	prefix = 2;
+	d = &mnemonic_ed(oprom[1]);
+	break;
+    case 0xdd:
+    case 0xfd:
+	if (0xcb == oprom[1]) {
+	    // The offset comes before the opcode
+	    prefix = 4;
+	    d = &mnemonic_xx_cb(oprom[3]);
+	} else {
+	    prefix = 2;
+	    d = &mnemonic_xx(oprom[1]);
+	}
+	break;
+    default:
+	prefix = 1;
+	d = &mnemonic_main(oprom[0]);
+	break;
+    }
+    if (length)
+	*length = prefix + d->operand_bytes();
+    return *d;
 }
 
-z80Token& z80Token::operator=(const z80Token& other)
+/**
+ * @brief Return the length of the instruction at @p oprom in bytes
+ * @param oprom pointer to the first opcode byte
+ * @return length in bytes, 1 to 4
+ */
+int z80Token::length(const quint8* oprom)
 {
-    m_mnemonic = other.m_mnemonic;
-    m_parameters = other.m_parameters;
-    m_flags = other.m_flags;
-    return *this;
+    int length;
+    decode(oprom, &length);
+    return length;
 }
 
 QLatin1String z80Token::string(z80Mnemonic m)
@@ -153,9 +196,9 @@ QLatin1String z80Token::string(z80Mnemonic m)
     return lookup.value(m);
 }
 
-z80Token z80Token::mnemonic_xx_cb(uchar op)
+const z80Token& z80Token::mnemonic_xx_cb(uchar op)
 {
-    static const QVector<z80Token> lookup({
+    static constexpr z80Token lookup[256] = {
 	z80Token(z80RLC,"b=Y"),
 	z80Token(z80RLC,"c=Y"),
 	z80Token(z80RLC,"d=Y"),
@@ -412,13 +455,13 @@ z80Token z80Token::mnemonic_xx_cb(uchar op)
 	z80Token(z80SET,"l=7,Y"),
 	z80Token(z80SET,"7,Y"),
 	z80Token(z80SET,"a=7,Y")
-    });
-    return lookup.value(op);
+    };
+    return lookup[op];
 }
 
-z80Token z80Token::mnemonic_cb(uchar op)
+const z80Token& z80Token::mnemonic_cb(uchar op)
 {
-    static const QVector<z80Token> lookup({
+    static constexpr z80Token lookup[256] = {
 	z80Token(z80RLC,"b"),
 	z80Token(z80RLC,"c"),
 	z80Token(z80RLC,"d"),
@@ -675,14 +718,13 @@ z80Token z80Token::mnemonic_cb(uchar op)
 	z80Token(z80SET,"7,l"),
 	z80Token(z80SET,"7,(hl)"),
 	z80Token(z80SET,"7,a")
-    });
-
-    return lookup.value(op);
+    };
+    return lookup[op];
 }
 
-z80Token z80Token::mnemonic_ed(uchar op)
+const z80Token& z80Token::mnemonic_ed(uchar op)
 {
-    static const QVector<z80Token> lookup({
+    static constexpr z80Token lookup[256] = {
 	z80Token(z80DB,"?"),
 	z80Token(z80DB,"?"),
 	z80Token(z80DB,"?"),
@@ -939,14 +981,13 @@ z80Token z80Token::mnemonic_ed(uchar op)
 	z80Token(z80DB,"?"),
 	z80Token(z80DB,"?"),
 	z80Token(z80DB,"?")
-    });
-
-    return lookup.value(op);
+    };
+    return lookup[op];
 }
 
-z80Token z80Token::mnemonic_xx(uchar op)
+const z80Token& z80Token::mnemonic_xx(uchar op)
 {
-    static const QVector<z80Token> lookup({
+    static constexpr z80Token lookup[256] = {
 	z80Token(z80DB,"?"),
 	z80Token(z80DB,"?"),
 	z80Token(z80DB,"?"),
@@ -1203,13 +1244,13 @@ z80Token z80Token::mnemonic_xx(uchar op)
 	z80Token(z80DB,"?"),
 	z80Token(z80DB,"?"),
 	z80Token(z80DB,"?")
-    });
-    return lookup.value(op);
+    };
+    return lookup[op];
 }
 
-z80Token z80Token::mnemonic_main(uchar op)
+const z80Token& z80Token::mnemonic_main(uchar op)
 {
-    static const QVector<z80Token> lookup({
+    static constexpr z80Token lookup[256] = {
 	z80Token(z80NOP,NULL),
 	z80Token(z80LD,"bc,N"),
 	z80Token(z80LD,"(bc),a"),
@@ -1466,6 +1507,6 @@ z80Token z80Token::mnemonic_main(uchar op)
 	z80Token(z80DB,"fd"),
 	z80Token(z80CP,"B"),
 	z80Token(z80RST,"V")
-    });
-    return lookup.value(op);
+    };
+    return lookup[op];
 }
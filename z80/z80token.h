@@ -32,13 +32,17 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  ****************************************************************************/
 #pragma once
-#include <QVector>
+#include <QString>
 
 class z80Token
 {
 public:
     enum z80Flags {
 	DASMFLAG_NONE = 0,
+	DASMFLAG_JUMP = (1u << 24),	//!< JP, JR or DJNZ
+	DASMFLAG_CALL = (1u << 25),	//!< CALL or RST
+	DASMFLAG_RETURN = (1u << 26),	//!< RET, RETI or RETN
+	DASMFLAG_COND = (1u << 27),	//!< the jump, call or return depends on a condition
 	DASMFLAG_FINAL = (1u << 28),
 	DASMFLAG_OVER = (1u << 29),
 	DASMFLAG_SKIP = (1u << 30),
@@ -122,24 +126,66 @@ public:
 	z80XOR	    //!< logical XOR
     };
 
-    explicit z80Token(z80Mnemonic m = z80DB, const char* p = nullptr, const z80Flags flags = DASMFLAG_NONE);
-    z80Token(const z80Token& other);
+    /**
+     * @brief Constructor of a decode table entry
+     *
+     * The operand bytes and the flow flags are derived from the
+     * mnemonic and the parameter template while compiling.
+     *
+     * @param m mnemonic
+     * @param p parameter template, or nullptr if there are none
+     * @param flags additional flags
+     */
+    explicit constexpr z80Token(z80Mnemonic m = z80DB, const char* p = nullptr, quint32 flags = DASMFLAG_NONE)
+	: m_mnemonic(m)
+	, m_parameters(p)
+	, m_flags(flags | flow(m, p))
+	, m_operand_bytes(operand_bytes(p))
+    {}
 
     z80Mnemonic mnemonic() const;
     const char* parameters() const;
-    z80Flags flags() const;
+    quint32 flags() const;
+    int operand_bytes() const;
 
     static QLatin1String string(z80Mnemonic m);
-    static z80Token mnemonic_xx_cb(uchar op);
-    static z80Token mnemonic_cb(uchar op);
-    static z80Token mnemonic_ed(uchar op);
-    static z80Token mnemonic_xx(uchar op);
-    static z80Token mnemonic_main(uchar op);
-
-    z80Token& operator= (const z80Token& other);
+    static const z80Token& mnemonic_xx_cb(uchar op);
+    static const z80Token& mnemonic_cb(uchar op);
+    static const z80Token& mnemonic_ed(uchar op);
+    static const z80Token& mnemonic_xx(uchar op);
+    static const z80Token& mnemonic_main(uchar op);
+    static const z80Token& decode(const quint8* oprom, int* length = nullptr);
+    static int length(const quint8* oprom);
 
 private:
+    /** @brief Return true if the template @p p contains @p ch */
+    static constexpr bool has(const char* p, char ch)
+    {
+	return nullptr != p && '\0' != *p && (ch == *p || has(p + 1, ch));
+    }
+
+    /** @brief Return the number of bytes read for the operands in template @p p */
+    static constexpr int operand_bytes(const char* p)
+    {
+	return nullptr == p || '\0' == *p ? 0
+	    : ('A' == *p || 'N' == *p || 'W' == *p ? 2
+	    : 'B' == *p || 'O' == *p || 'P' == *p || 'X' == *p ? 1 : 0) + operand_bytes(p + 1);
+    }
+
+    /** @brief Return the flow flags of mnemonic @p m with template @p p */
+    static constexpr quint32 flow(z80Mnemonic m, const char* p)
+    {
+	return z80JP == m || z80JR == m ? quint32(DASMFLAG_JUMP) | (has(p, ',') ? quint32(DASMFLAG_COND) : 0u)
+	    : z80DJNZ == m ? quint32(DASMFLAG_JUMP) | quint32(DASMFLAG_COND)
+	    : z80CALL == m ? quint32(DASMFLAG_CALL) | (has(p, ',') ? quint32(DASMFLAG_COND) : 0u)
+	    : z80RST == m ? quint32(DASMFLAG_CALL)
+	    : z80RET == m ? quint32(DASMFLAG_RETURN) | (nullptr != p ? quint32(DASMFLAG_COND) : 0u)
+	    : z80RETI == m || z80RETN == m ? quint32(DASMFLAG_RETURN)
+	    : 0u;
+    }
+
     z80Mnemonic m_mnemonic;
     const char* m_parameters;
-    z80Flags m_flags;
+    quint32 m_flags;
+    int m_operand_bytes;	//!< number of bytes read for the operands
 };
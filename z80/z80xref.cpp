@@ -0,0 +1,175 @@
+/****************************************************************************
+ *
+ * Cass80 tool - Z80 cross reference index
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#include "util.h"
+#include "z80xref.h"
+
+z80Xref::z80Xref()
+    : m_first()
+    , m_refs()
+    , m_added()
+    , m_to()
+{
+}
+
+/**
+ * @brief Remove all references
+ */
+void z80Xref::clear()
+{
+    m_first.clear();
+    m_refs.clear();
+    m_added.clear();
+    m_to.clear();
+}
+
+/**
+ * @brief Add a reference from @p from to @p to
+ *
+ * The reference can be found after the next finish().
+ *
+ * @param from address of the referencing instruction
+ * @param to address referenced
+ * @param kind type of the reference
+ */
+void z80Xref::add(quint32 from, quint32 to, Kind kind)
+{
+    m_added += z80Ref(static_cast<quint16>(from), static_cast<quint16>(kind));
+    m_to += static_cast<quint16>(to);
+}
+
+/**
+ * @brief Build the index from the references added since the last call
+ *
+ * This is a counting sort, so the order of the references to one
+ * address is the order in which they were added.
+ */
+void z80Xref::finish()
+{
+    QVector<quint32> first(0x10001, 0);
+    foreach(quint16 to, m_to)
+	first[to + 1]++;
+    for (int addr = 0; addr < 0x10000; addr++)
+	first[addr + 1] += first[addr];
+
+    QVector<z80Ref> refs(m_added.count());
+    QVector<quint32> next = first;
+    for (int i = 0; i < m_added.count(); i++)
+	refs[static_cast<int>(next[m_to[i]]++)] = m_added[i];
+
+    m_first = first;
+    m_refs = refs;
+    m_added.clear();
+    m_to.clear();
+}
+
+/**
+ * @brief Return true if there are no references
+ */
+bool z80Xref::isEmpty() const
+{
+    return m_first.isEmpty() || m_refs.isEmpty();
+}
+
+/**
+ * @brief Return the number of references to @p addr
+ * @param addr address
+ * @return number of references
+ */
+int z80Xref::count(quint32 addr) const
+{
+    if (m_first.isEmpty() || addr > 0xffff)
+	return 0;
+    const int pos = static_cast<int>(addr);
+    return static_cast<int>(m_first[pos + 1] - m_first[pos]);
+}
+
+/**
+ * @brief Return the references to @p addr
+ * @param addr address
+ * @return pointer to the first of count() references
+ */
+const z80Ref* z80Xref::refs(quint32 addr) const
+{
+    if (0 == count(addr))
+	return nullptr;
+    return m_refs.constData() + m_first[static_cast<int>(addr)];
+}
+
+/**
+ * @brief Return the index as text for other tools
+ *
+ * Each line has the address, the type, and the address of the
+ * referencing instruction separated by tabs, sorted by address.
+ *
+ * @param uppercase if true, use upper case hex digits
+ * @return QStringList with one line per reference
+ */
+QStringList z80Xref::report(bool uppercase) const
+{
+    QStringList lines;
+    if (isEmpty())
+	return lines;
+
+    lines.reserve(m_refs.count());
+    for (quint32 addr = 0; addr < 0x10000; addr++) {
+	const z80Ref* ref = refs(addr);
+	for (int i = 0; i < count(addr); i++, ref++) {
+	    lines += QString("%1\t%2\t%3")
+		     .arg(util::x16(addr, uppercase))
+		     .arg(QString(name(ref->kind)))
+		     .arg(util::x16(ref->from, uppercase));
+	}
+    }
+    return lines;
+}
+
+/**
+ * @brief Return the name of a reference type
+ * @param kind z80Xref::Kind
+ * @return QLatin1String with the name
+ */
+QLatin1String z80Xref::name(quint32 kind)
+{
+    switch (kind) {
+    case XREF_CALL:
+	return QLatin1String("CALL");
+    case XREF_JUMP:
+	return QLatin1String("JUMP");
+    case XREF_READ:
+	return QLatin1String("READ");
+    case XREF_WRITE:
+	return QLatin1String("WRITE");
+    }
+    return QLatin1String("?");
+}
@@ -0,0 +1,90 @@
+/****************************************************************************
+ *
+ * Cass80 tool - Z80 cross reference index
+ *
+ * Copyright (C) 2020 Jürgen Buchmüller <pullmoll@t-online.de>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ****************************************************************************/
+#pragma once
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @brief One reference to an address
+ */
+class z80Ref
+{
+public:
+    z80Ref(quint16 from = 0, quint16 kind = 0)
+	: from(from), kind(kind)
+    {}
+
+    quint16 from;		//!< address of the referencing instruction
+    quint16 kind;		//!< z80Xref::Kind of the reference
+};
+Q_DECLARE_TYPEINFO(z80Ref, Q_PRIMITIVE_TYPE);
+
+/**
+ * @brief Cross reference index of a 64 KiB memory image
+ *
+ * The references are collected with add() and then sorted by their
+ * target in finish(), which replaces the index. The sorted references
+ * are kept in one array, and a second array
+ * holds the position of the first reference to each address, so the
+ * references to an address are found in constant time.
+ */
+class z80Xref
+{
+public:
+    enum Kind {
+	XREF_CALL,		//!< CALL or RST
+	XREF_JUMP,		//!< JP, JR or DJNZ
+	XREF_READ,		//!< load from (nn)
+	XREF_WRITE		//!< store to (nn)
+    };
+
+    z80Xref();
+
+    void clear();
+    void add(quint32 from, quint32 to, Kind kind);
+    void finish();
+
+    bool isEmpty() const;
+    int count(quint32 addr) const;
+    const z80Ref* refs(quint32 addr) const;
+    QStringList report(bool uppercase = false) const;
+
+    static QLatin1String name(quint32 kind);
+
+private:
+    QVector<quint32> m_first;	//!< 64K+1 positions of the first reference to an address
+    QVector<z80Ref> m_refs;	//!< references sorted by target address
+    QVector<z80Ref> m_added;	//!< references added since finish()
+    QVector<quint16> m_to;	//!< target addresses of m_added
+};